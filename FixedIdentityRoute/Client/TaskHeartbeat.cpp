@@ -1,11 +1,17 @@
 #include <string>
 #include <algorithm>
+#include <Poco/Timestamp.h>
+#include <Poco/Util/Application.h>
 #include <zmq_addon.hpp>
 #include "TaskHeartbeat.h"
 #include "ClientEvents.h"
 
 #define HEARTBEAT_PING 0x55
 #define HEARTBEAT_PONG 0xAA
+#define HEARTBEAT_HELLO 0x5A
+#define HEARTBEAT_BYE 0xA5
+// msec without a ping before the client announces itself again, e.g. to a restarted server
+#define HELLO_TIMEOUT 6000
 
 using std::string;
 using Poco::Logger;
@@ -14,6 +20,7 @@ TaskHeartbeat::TaskHeartbeat(string & id)
 	: Task("TaskHeartbeat")
 	, _logger(Logger::get("Heartbeat"))
 	, _identity(id)
+	, _capabilities(Poco::Util::Application::instance().config().getString("application.capabilities", ""))
 {
 }
 
@@ -24,10 +31,27 @@ void TaskHeartbeat::runTask()
 	socketDealer.setsockopt(ZMQ_IDENTITY, _identity.c_str(), _identity.size());
 	socketDealer.connect("tcp://127.0.0.1:6801");
 
+	// the server registers the client with its hello, then pings it; nothing is sent blocking,
+	// a hello that cannot be queued yet, before the server is connected, goes out the next period
+	Poco::Timestamp lastPing;
+	bool announce = true;
 	while (!sleep(10))
 	{
 		try
 		{
+			if (announce || lastPing.isElapsed(HELLO_TIMEOUT * 1000))
+			{
+				zmq::multipart_t msgHello;
+				msgHello.addtyp<uint8_t>(HEARTBEAT_HELLO);
+				msgHello.addstr(_capabilities);
+				announce = !msgHello.send(socketDealer, ZMQ_DONTWAIT);
+				if (!announce)
+				{
+					poco_trace(_logger, "--> hello, announce " + _identity);
+					lastPing.update();
+				}
+			}
+
 			zmq::multipart_t msgIncoming;
 			if (msgIncoming.recv(socketDealer, ZMQ_DONTWAIT))
 			{
@@ -37,10 +61,12 @@ void TaskHeartbeat::runTask()
 				if (HEARTBEAT_PING == msgIncoming.poptyp<uint8_t>())
 				{
 					poco_trace(_logger, "<-- heartbeat ping received, send back a pong.");
+					lastPing.update();
 					postNotification(new Event_ServerLinkUp);
 					zmq::multipart_t msgOutgoing;
 					msgOutgoing.addtyp<uint8_t>(HEARTBEAT_PONG);
-					msgOutgoing.send(socketDealer);
+					// a pong that cannot be queued is dropped, the server counts it as missing
+					msgOutgoing.send(socketDealer, ZMQ_DONTWAIT);
 				}
 			}
 		}
@@ -50,6 +76,20 @@ void TaskHeartbeat::runTask()
 		}
 	}
 
-	socketDealer.disconnect("tcp://127.0.0.1:6866");
+	// let the server remove the client right away, without waiting long for a gone server
+	try
+	{
+		int linger = 100;
+		socketDealer.setsockopt(ZMQ_LINGER, &linger, sizeof(linger));
+		zmq::multipart_t msgBye;
+		msgBye.addtyp<uint8_t>(HEARTBEAT_BYE);
+		msgBye.send(socketDealer, ZMQ_DONTWAIT);
+	}
+	catch (std::exception &e)
+	{
+		poco_debug(_logger, e.what());
+	}
+
+	socketDealer.disconnect("tcp://127.0.0.1:6801");
 }
 
@@ -8,6 +8,8 @@ class TaskHeartbeat : public Poco::Task
 private:
 	Poco::Logger& _logger;
 	std::string _identity;
+	// announced to the server when registering, application.capabilities
+	std::string _capabilities;
 
 public:
 	TaskHeartbeat(std::string& id);
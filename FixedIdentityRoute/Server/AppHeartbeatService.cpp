@@ -12,6 +12,7 @@
 
 #include "AppHeartbeatService.h"
 #include "ServerState.h"
+#include "ClientRegistry.h"
 
 using std::string;
 using std::vector;
@@ -23,6 +24,9 @@ using Poco::Util::OptionSet;
 using Poco::Util::OptionCallback;
 using Poco::Util::HelpFormatter;
 
+// admitted clients registered at once at most, unless application.admit.max says otherwise
+#define DEFAULT_ADMIT_MAX 256
+
 class TaskErrorHandler : public Poco::ErrorHandler
 {
 public:
@@ -59,9 +63,9 @@ void AppHeartbeatService::handleHelp(const std::string & name, const std::string
 	stopOptionsProcessing();
 }
 
-vector<string> AppHeartbeatService::getClientList()
+vector<string> AppHeartbeatService::getList(const string& key)
 {
-	stringstream list(config().getString("application.clients", ""));
+	stringstream list(config().getString(key, ""));
 	vector<string> listClient;
 	std::move(istream_iterator<string>(list), istream_iterator<string>(), back_inserter(listClient));
 	return listClient;
@@ -120,8 +124,11 @@ int AppHeartbeatService::main(const ArgVec & args)
 		TaskErrorHandler newEH;
 		Poco::ErrorHandler* pOldEH = Poco::ErrorHandler::set(&newEH);
 
+		// clients may register themselves later on, a new identity has to match application.allow if given
+		ClientRegistry registry(getList("application.clients"), getList("application.allow"),
+			(std::size_t)config().getUInt("application.admit.max", DEFAULT_ADMIT_MAX));
 		Poco::TaskManager taskManager;
-		ServerState serverState(taskManager, _eventQueue, getClientList());
+		ServerState serverState(taskManager, _eventQueue, registry);
 		serverState.start();
 
 		_eventTerminated.set();
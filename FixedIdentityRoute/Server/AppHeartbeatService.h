@@ -17,7 +17,7 @@ private:
 	void handleHelp(const std::string& name, const std::string& value);
 	// for events handle by state machine
 	static Poco::NotificationQueue _eventQueue;
-	std::vector<std::string> getClientList();
+	std::vector<std::string> getList(const std::string& key);
 
 protected:
 	void initialize(Poco::Util::Application& self);
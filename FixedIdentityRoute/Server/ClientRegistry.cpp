@@ -0,0 +1,84 @@
+#include "ClientRegistry.h"
+
+using std::vector;
+using std::string;
+
+ClientRegistry::ClientRegistry(const vector<string>& clients, const vector<string>& allow, std::size_t admitMax)
+	: _size(0)
+	, _slots(vector<string>())
+	, _admitMax(admitMax)
+	, _admitted(0)
+{
+	for (const auto& pattern : allow)
+		_allow.emplace_back(pattern);
+	for (const auto& id : clients)
+	{
+		// a duplicated identity gets the slot it already has
+		if (add(id, string()) == (int)_configured.size())
+			_configured.push_back(id);
+	}
+}
+
+bool ClientRegistry::allowed(const string& id)
+{
+	if (_allow.empty())
+		return true;
+	for (auto& rule : _allow)
+	{
+		if (rule.match(id))
+			return true;
+	}
+	return false;
+}
+
+// register a new identity in a free slot or the next one, the entry is filled in before it gets published
+int ClientRegistry::add(const string& id, const string& capabilities)
+{
+	int slot = _slots.find(id.data(), id.size());
+	if (slot != NONE)
+		return slot;
+	if (_slots.size() == (std::size_t)MAX_SEGMENTS * SEGMENT_SIZE)
+		return NONE;
+	slot = _slots.add(id);
+
+	if (!_segments[slot >> SEGMENT_BITS])
+		_segments[slot >> SEGMENT_BITS].reset(new Entry[SEGMENT_SIZE]);
+	std::atomic_store(&entry(slot).client, std::shared_ptr<const Client>(new Client{ id, capabilities }));
+	if (_slots.size() > size())
+		_size.store(_slots.size(), std::memory_order_release);
+	return slot;
+}
+
+int ClientRegistry::find(const void* data, std::size_t size) const
+{
+	return _slots.find(data, size);
+}
+
+int ClientRegistry::admit(const string& id, const string& capabilities)
+{
+	int slot = _slots.find(id.data(), id.size());
+	if (slot == NONE)
+	{
+		if (_admitted >= _admitMax || !allowed(id))
+			return NONE;
+		slot = add(id, capabilities);
+		if (slot != NONE)
+			++_admitted;
+		return slot;
+	}
+
+	// the capabilities a reader still holds go away with its last reference
+	Entry& known = entry(slot);
+	if (std::atomic_load(&known.client)->capabilities != capabilities)
+		std::atomic_store(&known.client, std::shared_ptr<const Client>(new Client{ id, capabilities }));
+	return slot;
+}
+
+void ClientRegistry::remove(int slot)
+{
+	if (configured(slot) || !std::atomic_load(&entry(slot).client))
+		return;
+	std::atomic_store(&entry(slot).client, std::shared_ptr<const Client>());
+	_slots.remove(slot);
+	--_admitted;
+}
@@ -0,0 +1,76 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <cstddef>
+#include <Poco/Glob.h>
+#include "ClientSlots.h"
+
+// the clients known to the server, the configured ones first, then those admitted as they register;
+// the heartbeat task is the only writer. The size is read lock-free, an entry is filled in before the
+// size is released to cover it. A client is swapped as a whole through std::atomic_load/atomic_store
+// on its shared_ptr, which the standard libraries implement with a short internal lock, not lock-free;
+// a reader keeps the client it loaded for as long as it holds it. ServerState, the only reader so far,
+// runs on the heartbeat thread through the task notifications. Admitted clients are removed again when
+// they leave or expire and their slots are reused, the configured ones stay for good
+class ClientRegistry
+{
+public:
+	struct Client
+	{
+		std::string id;
+		std::string capabilities;
+	};
+
+private:
+	static const unsigned SEGMENT_BITS = 8;
+	static const unsigned SEGMENT_SIZE = 1u << SEGMENT_BITS;
+	static const unsigned MAX_SEGMENTS = 4096;
+
+	struct Entry
+	{
+		// null while the slot is free, loaded and stored with std::atomic_load and std::atomic_store,
+		// which take a lock inside the standard library
+		std::shared_ptr<const Client> client;
+	};
+
+	// entries in segments allocated as needed, never reallocated
+	std::unique_ptr<Entry[]> _segments[MAX_SEGMENTS];
+	std::atomic<std::size_t> _size;
+	// routing id lookup, for the writer only
+	ClientSlots _slots;
+	// ids of the configured clients in the order of their slots, never changed once built,
+	// so their pings can be sent without copying them
+	std::vector<std::string> _configured;
+	// admitted clients registered at once at most, and those registered now
+	const std::size_t _admitMax;
+	std::size_t _admitted;
+	// patterns a new identity has to match, anyone may register without them
+	std::vector<Poco::Glob> _allow;
+
+	Entry& entry(int slot) const { return _segments[slot >> SEGMENT_BITS][slot & (SEGMENT_SIZE - 1)]; }
+	bool allowed(const std::string& id);
+	int add(const std::string& id, const std::string& capabilities);
+
+public:
+	static const int NONE = ClientSlots::NONE;
+
+	// the configured clients are registered right away, the allow-list and admitMax do not apply to them
+	ClientRegistry(const std::vector<std::string>& clients, const std::vector<std::string>& allow, std::size_t admitMax);
+
+	// writer: slot of the routing id, NONE if it is not registered
+	int find(const void* data, std::size_t size) const;
+	// writer: slot of the client, registered first if it is new; NONE if it is not allowed or admitMax are registered
+	int admit(const std::string& id, const std::string& capabilities);
+	// writer: free the slot of an admitted client
+	void remove(int slot);
+	// writer: true for the slot of a configured client
+	bool configured(int slot) const { return (std::size_t)slot < _configured.size(); }
+	// writer: id of a registered client, the id of a configured one never moves
+	const std::string& id(int slot) const { return configured(slot) ? _configured[slot] : _slots.id(slot); }
+
+	// readers: slots 0 ... size() - 1 have been registered, the client of a free one is null
+	std::size_t size() const { return _size.load(std::memory_order_acquire); }
+	std::shared_ptr<const Client> client(int slot) const { return std::atomic_load(&entry(slot).client); }
+};
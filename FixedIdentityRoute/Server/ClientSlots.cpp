@@ -0,0 +1,101 @@
+#include <cstring>
+#include "ClientSlots.h"
+
+using std::vector;
+using std::string;
+
+// FNV-1a, routing ids are short
+uint64_t ClientSlots::hash(const void* data, std::size_t size)
+{
+	const unsigned char* bytes = static_cast<const unsigned char*>(data);
+	uint64_t h = 0xcbf29ce484222325ull;
+	for (std::size_t i = 0; i < size; ++i)
+	{
+		h ^= bytes[i];
+		h *= 0x100000001b3ull;
+	}
+	return h;
+}
+
+ClientSlots::ClientSlots(const vector<string>& ids)
+{
+	_buckets.assign(8, 0);
+	_mask = _buckets.size() - 1;
+	for (const auto& id : ids)
+		add(id);
+}
+
+// list the slot in its bucket, the buckets hold a free one
+void ClientSlots::place(int slot)
+{
+	std::size_t bucket = (std::size_t)_hashes[slot] & _mask;
+	while (_buckets[bucket] != 0)
+		bucket = (bucket + 1) & _mask;
+	_buckets[bucket] = slot + 1;
+}
+
+int ClientSlots::add(const string& id)
+{
+	int slot = find(id.data(), id.size());
+	if (slot != NONE)
+		return slot;
+
+	if (!_free.empty())
+	{
+		// the buckets have room for every slot, taken or free, and there are no free slots when they grow
+		slot = _free.back();
+		_free.pop_back();
+		_ids[slot] = id;
+		_hashes[slot] = hash(id.data(), id.size());
+		place(slot);
+		return slot;
+	}
+
+	_ids.push_back(id);
+	_hashes.push_back(hash(id.data(), id.size()));
+	// keep the buckets at most half full, the probes stay short
+	if (2 * _ids.size() > _buckets.size())
+	{
+		_buckets.assign(2 * _buckets.size(), 0);
+		_mask = _buckets.size() - 1;
+		for (int i = 0; i < (int)_ids.size() - 1; ++i)
+			place(i);
+	}
+	slot = (int)_ids.size() - 1;
+	place(slot);
+	return slot;
+}
+
+// the slots probed past the freed bucket are shifted back, so no probe stops short of them
+void ClientSlots::remove(int slot)
+{
+	std::size_t hole = (std::size_t)_hashes[slot] & _mask;
+	while (_buckets[hole] != slot + 1)
+		hole = (hole + 1) & _mask;
+	for (std::size_t bucket = (hole + 1) & _mask; _buckets[bucket] != 0; bucket = (bucket + 1) & _mask)
+	{
+		std::size_t home = (std::size_t)_hashes[_buckets[bucket] - 1] & _mask;
+		// the hole lies on the probe from its home bucket
+		if (((bucket - home) & _mask) >= ((bucket - hole) & _mask))
+		{
+			_buckets[hole] = _buckets[bucket];
+			hole = bucket;
+		}
+	}
+	_buckets[hole] = 0;
+	_ids[slot].clear();
+	_ids[slot].shrink_to_fit();
+	_free.push_back(slot);
+}
+
+int ClientSlots::find(const void* data, std::size_t size) const
+{
+	uint64_t h = hash(data, size);
+	for (std::size_t bucket = (std::size_t)h & _mask; _buckets[bucket] != 0; bucket = (bucket + 1) & _mask)
+	{
+		int slot = _buckets[bucket] - 1;
+		if (_hashes[slot] == h && _ids[slot].size() == size && std::memcmp(_ids[slot].data(), data, size) == 0)
+			return slot;
+	}
+	return NONE;
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+// the client identities interned into dense slots 0 ... size() - 1 in order of their arrival,
+// so per-client state can live in flat arrays indexed by slot; the routing id
+// bytes of an incoming frame are resolved to their slot without building a string;
+// a removed identity leaves its slot free, the next new identity takes it
+class ClientSlots
+{
+private:
+	std::vector<std::string> _ids;
+	std::vector<uint64_t> _hashes;
+	// open addressing table of slot + 1, 0 for an empty bucket
+	std::vector<int32_t> _buckets;
+	std::size_t _mask;
+	// slots of removed identities
+	std::vector<int> _free;
+
+	static uint64_t hash(const void* data, std::size_t size);
+	void place(int slot);
+
+public:
+	static const int NONE = -1;
+
+	// duplicated identities get a single slot
+	explicit ClientSlots(const std::vector<std::string>& ids);
+
+	// slot of the identity, interned into a free slot or the next one if it is new
+	int add(const std::string& id);
+	// free the slot of an identity
+	void remove(int slot);
+
+	// slot of the routing id, NONE if it is not a known client
+	int find(const void* data, std::size_t size) const;
+	// slots taken or free
+	std::size_t size() const { return _ids.size(); }
+	const std::string& id(int slot) const { return _ids[slot]; }
+};
@@ -26,3 +26,14 @@ public:
 private:
 	std::string _id;
 };
+
+// an admitted client left or stopped answering, it is no longer registered
+class Event_ClientRemoved : public Poco::Notification
+{
+public:
+	Event_ClientRemoved(std::string id) : _id(id) {}
+	std::string identity() const { return _id; }
+
+private:
+	std::string _id;
+};
@@ -1,6 +1,5 @@
 ﻿#include <string>
 #include <vector>
-#include <utility>
 #include <Poco/Util/Application.h>
 #include <Poco/TaskManager.h>
 #include <Poco/NotificationQueue.h>
@@ -18,16 +17,17 @@ using Poco::Notification;
 using Poco::NotificationQueue;
 using Poco::NObserver;
 
-ServerState::ServerState(TaskManager & taskmgr, NotificationQueue & queue, vector<string> list)
+ServerState::ServerState(TaskManager & taskmgr, NotificationQueue & queue, ClientRegistry & registry)
 	: _currentState(new StartupState)
 	, _nextStateInfo{ {"type", (int8_t)StateType::StayAsWere} }
 	, _logger(Logger::get("ServerState"))
 	, _taskManager(taskmgr)
 	, _stateQueue(queue)
-	, _clientList(std::move(list))
+	, _registry(registry)
 {
-	for (const auto& id : _clientList)
+	for (int slot = 0; slot < (int)_registry.size(); ++slot)
 	{
+		const string& id = _registry.client(slot)->id;
 		poco_information(_logger, "add client: " + id);
 		_clientLink[id] = false;
 	}
@@ -37,7 +37,8 @@ void ServerState::start()
 {
 	_taskManager.addObserver(NObserver<ServerState, Event_ClientLinkUp>(*this, &ServerState::onClientLinkUp));
 	_taskManager.addObserver(NObserver<ServerState, Event_ClientLinkDown>(*this, &ServerState::onClientLinkDown));
-	_taskManager.start(new TaskHeartbeat(_clientList));
+	_taskManager.addObserver(NObserver<ServerState, Event_ClientRemoved>(*this, &ServerState::onClientRemoved));
+	_taskManager.start(new TaskHeartbeat(_registry));
 
 	for (;;)
 	{
@@ -104,13 +105,8 @@ void ServerState::onClientLinkUp(const Poco::AutoPtr<Event_ClientLinkUp>& pNotif
 	// the valid identity should already be checked in protocol
 	_clientLink[pNotify->identity()] = true;
 
-	// check if all client are linked up
-	bool allUp = std::all_of(_clientLink.cbegin(), _clientLink.cend(),
-		[](const ClientLinkState::value_type & element) {
-			return element.second;
-		});
-
-	if (_currentState->type() == StateType::Startup && allUp)
+	// check if all client are linked up, including those registered meanwhile
+	if (_currentState->type() == StateType::Startup && allUp())
 		_stateQueue.enqueueNotification(pNotify);
 }
 
@@ -123,13 +119,38 @@ void ServerState::onClientLinkDown(const Poco::AutoPtr<Event_ClientLinkDown>& pN
 		_stateQueue.enqueueNotification(pNotify);
 }
 
+void ServerState::onClientRemoved(const Poco::AutoPtr<Event_ClientRemoved>& pNotify)
+{
+	// its link went down before, if it was up
+	_clientLink.erase(pNotify->identity());
+
+	// the client the others were waiting for may be the one gone
+	if (_currentState->type() == StateType::Startup && !_clientLink.empty() && allUp())
+		_stateQueue.enqueueNotification(pNotify);
+}
+
+bool ServerState::allUp() const
+{
+	// the slots of removed clients are free until they are reused, they do not count
+	for (int slot = 0; slot < (int)_registry.size(); ++slot)
+	{
+		auto client = _registry.client(slot);
+		if (!client)
+			continue;
+		auto link = _clientLink.find(client->id);
+		if (link == _clientLink.end() || !link->second)
+			return false;
+	}
+	return true;
+}
+
 /**********************************************************************************
  * State Patterns for ServerState
  **********************************************************************************/
 StateInfo StartupState::handleEvent(ServerState & machine, const Poco::AutoPtr<Poco::Notification>& pNotify)
 {
 	StateInfo stanfo;
-	if (auto pevent = pNotify.cast<Event_ClientLinkUp>())
+	if (pNotify.cast<Event_ClientLinkUp>() || pNotify.cast<Event_ClientRemoved>())
 		stanfo["type"] = (int8_t)StateType::Online;
 	else
 		stanfo["type"] = (int8_t)StateType::StayAsWere;
@@ -9,6 +9,7 @@
 #include <Poco/DynamicAny.h>
 
 #include "ServerEvents.h"
+#include "ClientRegistry.h"
 
 // available module states
 enum class StateType : uint8_t
@@ -34,14 +35,17 @@ private:
 	Poco::Logger& _logger;
 	Poco::TaskManager& _taskManager;
 	Poco::NotificationQueue& _stateQueue;
-	std::vector<std::string> _clientList;
+	// TaskHeartbeat registers new clients into it, the observers read it on the heartbeat thread
+	ClientRegistry& _registry;
 	ClientLinkState _clientLink;
 
 protected:
 	void transitState();
+	// true if the links of all the registered clients are up
+	bool allUp() const;
 
 public:
-	ServerState(Poco::TaskManager& taskmgr, Poco::NotificationQueue& queue, std::vector<std::string> list);
+	ServerState(Poco::TaskManager& taskmgr, Poco::NotificationQueue& queue, ClientRegistry& registry);
 
 	// start looping and wait for events
 	void start();
@@ -52,6 +56,7 @@ public:
 	// event observers
 	void onClientLinkUp(const Poco::AutoPtr<Event_ClientLinkUp>& pNotify);
 	void onClientLinkDown(const Poco::AutoPtr<Event_ClientLinkDown>& pNotify);
+	void onClientRemoved(const Poco::AutoPtr<Event_ClientRemoved>& pNotify);
 };
 
 // abstract base class for all the states defined for this machine
@@ -1,10 +1,19 @@
-#include <algorithm>
-#include <zmq_addon.hpp>
+#include <Poco/Timestamp.h>
 #include "TaskHeartbeat.h"
 #include "ServerEvents.h"
 
 #define HEARTBEAT_PING 0x55
 #define HEARTBEAT_PONG 0xAA
+// a client announces its identity and capabilities to register, and that it leaves
+#define HEARTBEAT_HELLO 0x5A
+#define HEARTBEAT_BYE 0xA5
+// pings in a row without a pong after which an admitted client is removed, its slot is reused
+#define HEARTBEAT_EXPIRY 30
+// msec between two pings of a client, and the resolution of the ping deadlines
+#define HEARTBEAT_INTERVAL 2000
+#define HEARTBEAT_TICK 10
+// cancel() wakes up the poll of runTask() through this endpoint
+#define HEARTBEAT_WAKEUP "inproc://heartbeat-wakeup"
 
 #define HB_ALIVE 1
 #define HB_WAITPONG 0
@@ -17,108 +26,241 @@ using Poco::Logger;
 using std::vector;
 using std::string;
 
-TaskHeartbeat::TaskHeartbeat(vector<string>& clientlist)
+TaskHeartbeat::TaskHeartbeat(ClientRegistry& registry)
 	: Task("TaskHeartbeat")
 	, _logger(Logger::get("Heartbeat"))
-	, _clientid(clientlist)
+	, _context(1)
+	, _registry(registry)
+	, _clientHeart(_registry.size(), HB_AWAY)
+	, _clientUnreachable(_registry.size(), 0)
+	, _clientMissed(_registry.size(), 0)
+	, _wheel(_registry.size())
 {
-	for (const auto& id : _clientid)
-		_clientHeart[id] = HB_AWAY;
+}
+
+// count the missing pongs since the previous ping of the clients, then ping them again
+void TaskHeartbeat::ping(zmq::socket_t& socketRouter, const vector<int>& slots)
+{
+	// the frames are sent straight from the ids of the configured clients, which never move, and a
+	// constant ping byte, zero-copy and without building any message; the id of an admitted client
+	// may be gone before its ping is sent, it is copied
+	static const uint8_t framePing = HEARTBEAT_PING;
+	void* router = static_cast<void*>(socketRouter);
+	for (int slot : slots)
+	{
+		// an admitted client that stopped answering is forgotten, it registers again when it comes back
+		if (!_registry.configured(slot) && ++_clientMissed[slot] > HEARTBEAT_EXPIRY)
+		{
+			remove(slot, "expired");
+			continue;
+		}
+		const string& id = _registry.id(slot);
+		int8_t& heart = _clientHeart[slot];
+		// client is considered away if 5 pongs are missing
+		if (heart == HB_MISSINGPONG4)
+		{
+			heart = HB_AWAY;
+			poco_trace(_logger, id + " is gone");
+			postNotification(new Event_ClientLinkDown(id));
+		}
+		else if (heart > HB_MISSINGPONG4)
+		{
+			heart = heart - 1;
+		}
+
+		// dead or alive, send out heartbeat ping; a full pipe just drops the ping, it counts as missing pong
+		int sent = _registry.configured(slot)
+			? zmq_send_const(router, id.data(), id.size(), ZMQ_SNDMORE | ZMQ_DONTWAIT)
+			: zmq_send(router, id.data(), id.size(), ZMQ_SNDMORE | ZMQ_DONTWAIT);
+		if (sent >= 0
+			&& zmq_send_const(router, &framePing, sizeof(framePing), ZMQ_DONTWAIT) >= 0)
+		{
+			_clientUnreachable[slot] = 0;
+		}
+		else if (zmq_errno() == EHOSTUNREACH)
+		{
+			// the client is not connected, the router refused the id frame
+			if (_clientUnreachable[slot]++ == 0)
+			{
+				poco_trace(_logger, id + " is unreachable");
+			}
+		}
+		else if (zmq_errno() != EAGAIN)
+		{
+			throw zmq::error_t();
+		}
+	}
+}
+
+// register the client, or welcome it back
+void TaskHeartbeat::admit(const string& id, const string& capabilities)
+{
+	bool known = _registry.find(id.data(), id.size()) != ClientRegistry::NONE;
+	int slot = _registry.admit(id, capabilities);
+	if (slot == ClientRegistry::NONE)
+	{
+		poco_debug(_logger, id + " is not allowed to register, or too many clients are");
+		return;
+	}
+	if (!known)
+	{
+		poco_information(_logger, "register client: " + id + " [" + capabilities + "]");
+		if ((std::size_t)slot >= _clientHeart.size())
+		{
+			_clientHeart.resize(slot + 1, HB_AWAY);
+			_clientUnreachable.resize(slot + 1, 0);
+			_clientMissed.resize(slot + 1, 0);
+			_wheel.resize(slot + 1);
+		}
+	}
+	// ping it with the next tick, its pong brings the link up
+	_wheel.schedule(slot, _wheel.now());
+}
+
+// forget an admitted client, a link that was up goes down first
+void TaskHeartbeat::remove(int slot, const char* reason)
+{
+	string id = _registry.id(slot);
+	if (_clientHeart[slot] != HB_AWAY)
+		postNotification(new Event_ClientLinkDown(id));
+	_wheel.cancel(slot);
+	_clientHeart[slot] = HB_AWAY;
+	_clientUnreachable[slot] = 0;
+	_clientMissed[slot] = 0;
+	_registry.remove(slot);
+	poco_information(_logger, "remove client: " + id + " (" + reason + ")");
+	postNotification(new Event_ClientRemoved(id));
+}
+
+// resolve the client of an incoming message, then count its pong or register it
+void TaskHeartbeat::receive(zmq::multipart_t& msgIncoming)
+{
+	// the first frame is client id appended by router socket, resolved without copying it
+	zmq::message_t frameId = msgIncoming.pop();
+	if (msgIncoming.empty())
+	{
+		poco_debug(_logger, "Invalid message: empty payload");
+		return;
+	}
+	uint8_t type = msgIncoming.poptyp<uint8_t>();
+	if (HEARTBEAT_HELLO == type)
+	{
+		admit(string(static_cast<const char*>(frameId.data()), frameId.size()), msgIncoming.empty() ? string() : msgIncoming.popstr());
+		return;
+	}
+
+	int slot = _registry.find(frameId.data(), frameId.size());
+	// is it one of the registered clients? 
+	if (slot == ClientRegistry::NONE)
+		return;
+
+	const string& id = _registry.id(slot);
+	poco_trace(_logger, "Incoming message from " + id);
+	if (HEARTBEAT_BYE == type)
+	{
+		poco_trace(_logger, "<-- Heartbeat_Bye from " + id);
+		if (!_registry.configured(slot))
+			remove(slot, "bye");
+		else if (_clientHeart[slot] != HB_AWAY)
+		{
+			// a configured client stays registered, its link goes down without waiting for the missing pongs
+			_clientHeart[slot] = HB_AWAY;
+			postNotification(new Event_ClientLinkDown(id));
+		}
+	}
+	else if (HEARTBEAT_PONG == type)
+	{
+		_clientMissed[slot] = 0;
+		int8_t& heart = _clientHeart[slot];
+		switch (heart)
+		{
+		case HB_MISSINGPONG2:
+		case HB_MISSINGPONG3:
+		case HB_MISSINGPONG4:
+		case HB_AWAY:
+			heart = HB_ALIVE;
+			poco_trace(_logger, "<-- Heartbeat_Pong from " + id);
+			postNotification(new Event_ClientLinkUp(id));
+			break;
+
+		case HB_WAITPONG:
+			heart += 1;
+			break;
+
+		case HB_ALIVE:
+		default:
+			break;
+		}
+	}
+}
+
+void TaskHeartbeat::cancel()
+{
+	Task::cancel();
+	// runTask() may be blocked in poll until the next ping is due, wake it up right away
+	try
+	{
+		zmq::socket_t signal(_context, zmq::socket_type::push);
+		// do not hold the context open if runTask() has already gone
+		int linger = 100;
+		signal.setsockopt(ZMQ_LINGER, &linger, sizeof(linger));
+		signal.connect(HEARTBEAT_WAKEUP);
+		signal.send("", 0, ZMQ_DONTWAIT);
+	}
+	catch (std::exception &e)
+	{
+		poco_debug(_logger, "Failed to signal cancellation - " + string(e.what()));
+	}
 }
 
 void TaskHeartbeat::runTask()
 {
-	zmq::context_t context(1);
-	zmq::socket_t socketRouter(context, zmq::socket_type::router);
+	zmq::socket_t socketRouter(_context, zmq::socket_type::router);
+	zmq::socket_t socketWakeup(_context, zmq::socket_type::pull);
+	socketWakeup.bind(HEARTBEAT_WAKEUP);
 	int raiseIfUnroutable = 1;
 	socketRouter.setsockopt(ZMQ_ROUTER_MANDATORY, &raiseIfUnroutable, sizeof(raiseIfUnroutable));
 	socketRouter.bind("tcp://127.0.0.1:6801");
 
-	zmq::pollitem_t items[] = { { socketRouter, 0, ZMQ_POLLIN, 0 } };
-	// for simplicity, use a counter to send heartbeat between desired time interval
-	uint16_t interval = 0;
+	zmq::pollitem_t items[] = {
+		{ socketRouter, 0, ZMQ_POLLIN, 0 },
+		{ socketWakeup, 0, ZMQ_POLLIN, 0 }
+	};
+	// every client has its own ping deadline, spread evenly over the interval at the start,
+	// so the pings and the pongs coming back are not sent in one burst for all clients
+	const uint64_t ticksPerPing = HEARTBEAT_INTERVAL / HEARTBEAT_TICK;
+	for (int slot = 0; slot < (int)_clientHeart.size(); ++slot)
+		_wheel.schedule(slot, 1 + slot * ticksPerPing / _clientHeart.size());
+	std::vector<int> expired;
+	Poco::Timestamp started;
 
-	while (!sleep(10))
+	while (!isCancelled())
 	{
-		++interval;
 		try
 		{
-			// heartbeat shall ping about every 2000 msec
-			if (interval >= 200)
-			{
-				// reset interval
-				interval = 0;
-				// send heartbeat ping to every expected client
-				for (const auto& id : _clientid)
-				{
-					// client is considered away if 5 pongs are missing
-					if (_clientHeart[id] == HB_MISSINGPONG4)
-					{
-						_clientHeart[id] = HB_AWAY;
-						poco_trace(_logger, id + " is gone");
-						postNotification(new Event_ClientLinkDown(id));
-					}
-					else if (_clientHeart[id] > HB_MISSINGPONG4)
-					{
-						_clientHeart[id] = _clientHeart[id] - 1;
-					}
-
-					// dead or alive, send out heartbeat ping
-					zmq::multipart_t msgOutgoing;
-					msgOutgoing.addstr(id);
-					msgOutgoing.addtyp<uint8_t>(HEARTBEAT_PING);
-					try
-					{
-						msgOutgoing.send(socketRouter);
-					}
-					catch (std::exception &e)
-					{
-						// unroutable message should raise exception EHOSTUNREACH
-						poco_trace(_logger, e.what());
-						continue;
-					}
-				}
-			}
+			// a late wakeup catches up on the ticks it missed
+			_wheel.advance((uint64_t)(started.elapsed() / (HEARTBEAT_TICK * 1000)), expired);
+			// the next ping keeps the phase of the client, however late this one was
+			for (int slot : expired)
+				_wheel.schedule(slot, _wheel.expiry(slot) + ticksPerPing);
+			// all the pings due by now go out in one go
+			ping(socketRouter, expired);
 
-			// polling the incoming message
-			zmq::poll(items, 1, 0);
+			// block until the next ping is due, a message arrives or the task gets cancelled
+			Poco::Timestamp::TimeDiff due = (Poco::Timestamp::TimeDiff)_wheel.next() * HEARTBEAT_TICK * 1000 - started.elapsed();
+			long timeout = due > 0 ? (long)((due + 999) / 1000) : 0;
+			zmq::poll(items, 2, timeout);
+			if (items[1].revents & ZMQ_POLLIN)
+				break;
+
+			// drain all the queued messages, not just one per wakeup
 			if (items[0].revents & ZMQ_POLLIN)
 			{
 				zmq::multipart_t msgIncoming;
-				if (msgIncoming.recv(socketRouter, ZMQ_DONTWAIT))
+				while (msgIncoming.recv(socketRouter, ZMQ_DONTWAIT))
 				{
-					// the first frame is client id appended by router socket
-					std::string id = msgIncoming.popstr();
-					auto itclient = std::find(_clientid.cbegin(), _clientid.cend(), id);
-					poco_trace(_logger, "Incoming message from " + *itclient);
-					// is it one of the expected clients? 
-					if (itclient != _clientid.cend())
-					{
-						if (msgIncoming.empty())
-							poco_debug(_logger, "Invalid message: empty payload");
-						if (HEARTBEAT_PONG == msgIncoming.poptyp<uint8_t>())
-						{
-							switch (_clientHeart[id])
-							{
-							case HB_MISSINGPONG2:
-							case HB_MISSINGPONG3:
-							case HB_MISSINGPONG4:
-							case HB_AWAY:
-								_clientHeart[id] = HB_ALIVE;
-								poco_trace(_logger, "<-- Heartbeat_Pong from " + *itclient);
-								postNotification(new Event_ClientLinkUp(*itclient));
-								break;
-
-							case HB_WAITPONG:
-								_clientHeart[id] += 1;
-								break;
-
-							case HB_ALIVE:
-							default:
-								break;
-							}
-						}
-					}
+					receive(msgIncoming);
+					msgIncoming.clear();
 				}
 			}
 		}
@@ -128,4 +270,3 @@ void TaskHeartbeat::runTask()
 		}
 	}
 }
-
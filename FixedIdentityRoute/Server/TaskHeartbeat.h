@@ -1,20 +1,38 @@
 #pragma once
-#include <unordered_map>
+#include <string>
 #include <vector>
 #include <Poco/Task.h>
 #include <Poco/Logger.h>
+#include <zmq_addon.hpp>
+#include "ClientRegistry.h"
+#include "TimerWheel.h"
 
-typedef std::unordered_map<std::string, int8_t> ClientHeartbeatState;
+// heartbeat state of every client, indexed by its slot
+typedef std::vector<int8_t> ClientHeartbeatState;
 
 class TaskHeartbeat : public Poco::Task
 {
 private:
 	Poco::Logger& _logger;
-	std::vector<std::string> _clientid;
+	zmq::context_t _context;
+	// shared with ServerState, the task registers the clients that announce themselves
+	ClientRegistry& _registry;
 	ClientHeartbeatState _clientHeart;
+	// pings in a row the router could not route to the client, it is not connected
+	std::vector<uint32_t> _clientUnreachable;
+	// pings since the last pong of the client, an admitted client that misses too many is removed
+	std::vector<uint32_t> _clientMissed;
+	// ping deadline of every client
+	TimerWheel _wheel;
+
+	void ping(zmq::socket_t& socketRouter, const std::vector<int>& slots);
+	void admit(const std::string& id, const std::string& capabilities);
+	void remove(int slot, const char* reason);
+	void receive(zmq::multipart_t& msgIncoming);
 
 public:
-	TaskHeartbeat(std::vector<std::string>& clientlist);
+	TaskHeartbeat(ClientRegistry& registry);
+	void cancel();
 	void runTask();
 };
 
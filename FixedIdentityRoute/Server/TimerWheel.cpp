@@ -0,0 +1,118 @@
+#include "TimerWheel.h"
+
+TimerWheel::TimerWheel(std::size_t slots)
+	: _heads(WHEEL_LEVELS * WHEEL_SIZE, -1)
+	, _next(slots, -1)
+	, _prev(slots, -1)
+	, _bucket(slots, -1)
+	, _expiry(slots, 0)
+	, _now(0)
+{
+}
+
+void TimerWheel::resize(std::size_t slots)
+{
+	_next.resize(slots, -1);
+	_prev.resize(slots, -1);
+	_bucket.resize(slots, -1);
+	_expiry.resize(slots, 0);
+}
+
+// list the slot in the bucket of its expiry, at the lowest level that reaches it
+void TimerWheel::place(int slot)
+{
+	uint64_t expiry = _expiry[slot] < _now ? _now : _expiry[slot];
+	uint64_t delta = expiry - _now;
+	unsigned level = 0;
+	while (level + 1 < WHEEL_LEVELS && delta >= ((uint64_t)1 << (WHEEL_BITS * (level + 1))))
+		++level;
+	// beyond the top level the timer waits in the farthest bucket and is placed again from there
+	if (delta >> (WHEEL_BITS * WHEEL_LEVELS))
+		expiry = _now + ((uint64_t)1 << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+	int32_t bucket = (int32_t)(level * WHEEL_SIZE + ((expiry >> (WHEEL_BITS * level)) & (WHEEL_SIZE - 1)));
+	_bucket[slot] = bucket;
+	_prev[slot] = -1;
+	_next[slot] = _heads[bucket];
+	if (_heads[bucket] >= 0)
+		_prev[_heads[bucket]] = slot;
+	_heads[bucket] = slot;
+}
+
+void TimerWheel::unlink(int slot)
+{
+	int32_t bucket = _bucket[slot];
+	if (_prev[slot] >= 0)
+		_next[_prev[slot]] = _next[slot];
+	else
+		_heads[bucket] = _next[slot];
+	if (_next[slot] >= 0)
+		_prev[_next[slot]] = _prev[slot];
+	_bucket[slot] = -1;
+}
+
+// move the timers of the bucket of level that the wheel just reached to the levels below
+void TimerWheel::cascade(unsigned level)
+{
+	int32_t bucket = (int32_t)(level * WHEEL_SIZE + ((_now >> (WHEEL_BITS * level)) & (WHEEL_SIZE - 1)));
+	int32_t slot = _heads[bucket];
+	_heads[bucket] = -1;
+	while (slot >= 0)
+	{
+		int32_t next = _next[slot];
+		place(slot);
+		slot = next;
+	}
+}
+
+void TimerWheel::schedule(int slot, uint64_t tick)
+{
+	if (_bucket[slot] >= 0)
+		unlink(slot);
+	_expiry[slot] = tick;
+	place(slot);
+}
+
+void TimerWheel::cancel(int slot)
+{
+	if (_bucket[slot] >= 0)
+		unlink(slot);
+}
+
+void TimerWheel::advance(uint64_t tick, std::vector<int>& expired)
+{
+	expired.clear();
+	for (; _now <= tick; ++_now)
+	{
+		// at the start of every lap of a level the bucket of the level above is due
+		for (unsigned level = 1; level < WHEEL_LEVELS; ++level)
+		{
+			if (_now & (((uint64_t)1 << (WHEEL_BITS * level)) - 1))
+				break;
+			cascade(level);
+		}
+		int32_t bucket = (int32_t)(_now & (WHEEL_SIZE - 1));
+		int32_t slot = _heads[bucket];
+		_heads[bucket] = -1;
+		while (slot >= 0)
+		{
+			int32_t next = _next[slot];
+			_bucket[slot] = -1;
+			expired.push_back(slot);
+			slot = next;
+		}
+	}
+}
+
+uint64_t TimerWheel::next() const
+{
+	// the timers of the levels above come down at the start of a lap of level 0
+	if ((_now & (WHEEL_SIZE - 1)) == 0)
+		return _now;
+	uint64_t lap = (_now | (WHEEL_SIZE - 1)) + 1;
+	for (uint64_t tick = _now; tick < lap; ++tick)
+	{
+		if (_heads[tick & (WHEEL_SIZE - 1)] >= 0)
+			return tick;
+	}
+	return lap;
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+// hierarchical timer wheel with one timer per client slot, time is counted in ticks:
+// level 0 has a bucket for each of the next WHEEL_SIZE ticks, a bucket of level n covers
+// WHEEL_SIZE^n ticks and is cascaded down when the wheel gets there, so advancing by one
+// tick costs the timers that expire plus, once every WHEEL_SIZE ticks, those cascaded;
+// the timers of a bucket are an intrusive list over flat per-slot arrays
+class TimerWheel
+{
+private:
+	static const unsigned WHEEL_BITS = 8;
+	static const unsigned WHEEL_SIZE = 1u << WHEEL_BITS;
+	static const unsigned WHEEL_LEVELS = 3;
+
+	// first bucket of every list, -1 when it is empty
+	std::vector<int32_t> _heads;
+	std::vector<int32_t> _next;
+	std::vector<int32_t> _prev;
+	// bucket a slot is listed in, -1 when its timer is not armed
+	std::vector<int32_t> _bucket;
+	std::vector<uint64_t> _expiry;
+	// the next tick to be expired
+	uint64_t _now;
+
+	void place(int slot);
+	void unlink(int slot);
+	void cascade(unsigned level);
+
+public:
+	explicit TimerWheel(std::size_t slots);
+
+	// make room for more slots, their timers are not armed
+	void resize(std::size_t slots);
+
+	// arm the timer of the slot to expire at tick, a timer already armed is moved;
+	// a tick that has passed expires with the next advance()
+	void schedule(int slot, uint64_t tick);
+	void cancel(int slot);
+	bool scheduled(int slot) const { return _bucket[slot] >= 0; }
+	// the tick the timer of the slot was last armed for
+	uint64_t expiry(int slot) const { return _expiry[slot]; }
+	// expire all timers up to and including tick, their slots are appended to expired in order of their ticks
+	void advance(uint64_t tick, std::vector<int>& expired);
+	// the next tick to be expired
+	uint64_t now() const { return _now; }
+	// the tick advance() has to reach next, the earliest expiry or a cascade that may bring one
+	uint64_t next() const;
+};
@@ -1,5 +1,7 @@
 ﻿#include <iostream>
 #include <string>
+#include <vector>
+#include <algorithm>
 #include <Poco/Util/Option.h>
 #include <Poco/Util/HelpFormatter.h>
 #include <Poco/ErrorHandler.h>
@@ -7,11 +9,15 @@
 #include <Poco/AsyncChannel.h>
 #include <Poco/ConsoleChannel.h>
 #include <Poco/TaskManager.h>
+#include <Poco/ThreadPool.h>
+#include <Poco/Format.h>
+#include <Poco/Environment.h>
 #include <Poco/Notification.h>
 #include <Poco/NotificationQueue.h>
 #include "Poco/Util/AbstractConfiguration.h"
 #include "AppPullWorker.h"
 #include "TaskPull.hpp"
+#include "PushConfig.hpp"
 
 using std::string;
 using Poco::Util::Application;
@@ -21,9 +27,19 @@ using Poco::Util::OptionCallback;
 using Poco::Util::HelpFormatter;
 using Poco::Util::AbstractConfiguration;
 using Poco::TaskManager;
+using Poco::ThreadPool;
 using Poco::Notification;
 
 #define DEFAULT_PULLFROM_ADDRESS "tcp://127.0.0.1:6866"
+#define DEFAULT_PULL_BATCH 64
+#define DEFAULT_PULL_WORKERS 1
+#define DEFAULT_REPORT_INTERVAL 10000
+#define DEFAULT_KERNEL_RADIUS 1.0
+#define DEFAULT_CREDIT_WINDOW 32
+#define DEFAULT_CREDIT_REFRESH 1000
+#define DEFAULT_STREAM_MEMORY 256
+#define INPROC_JOBS_ADDRESS "inproc://pullworker-jobs"
+#define INPROC_CREDIT_ADDRESS "inproc://pullworker-credit"
 
 class TaskErrorHandler : public Poco::ErrorHandler
 {
@@ -113,13 +129,80 @@ int AppPullWorker::main(const ArgVec & args)
 		TaskErrorHandler newEH;
 		Poco::ErrorHandler* pOldEH = Poco::ErrorHandler::set(&newEH);
 
-		string pullfrom = config().getString("application.pull.from", DEFAULT_PULLFROM_ADDRESS);
-		TaskManager taskmanager;
-		taskmanager.start(new TaskPull(pullfrom));
+		PullSettings settings;
+		settings.pullfrom = config().getString("application.pull.from", DEFAULT_PULLFROM_ADDRESS);
+		settings.batch = std::max(1, config().getInt("application.pull.batch", DEFAULT_PULL_BATCH));
+		settings.kernels = nullptr;
+		settings.radius = config().getDouble("application.pull.kernels.radius", DEFAULT_KERNEL_RADIUS);
+		settings.publish = config().getString("application.pull.kernels.publish", "");
+		settings.keyed = (config().getString("application.pull.routing", "roundrobin") == "keyed");
+		settings.handoff = false;
+		settings.name = config().getString("application.pull.name", Poco::Environment::nodeName());
+		settings.sinkTo = config().getString("application.pull.sink.to", "");
+		settings.dumpItems = (std::size_t)std::max(0, config().getInt("application.pull.dump.items", (int)DEFAULT_DUMP_ITEMS));
+		settings.rcvhwm = config().getInt("application.pull.rcvhwm", -1);
+		settings.creditTo = config().getString("application.pull.credit.to", "");
+		settings.creditWindow = std::max(1, config().getInt("application.pull.credit.window", DEFAULT_CREDIT_WINDOW));
+		settings.creditRefresh = config().getInt("application.pull.credit.refresh", DEFAULT_CREDIT_REFRESH);
+		settings.streamMemory = (std::size_t)std::max(1, config().getInt("application.pull.stream.memory", DEFAULT_STREAM_MEMORY)) << 20;
+		if (config().getBool("application.pull.kernels", false))
+		{
+			// check the dispatched kernels once against the scalar reference before trusting them
+			string report;
+			const PointKernels& best = pointKernels();
+			if (verifyPointKernels(best, report))
+			{
+				settings.kernels = &best;
+				poco_information(logger(), report);
+			}
+			else
+			{
+				settings.kernels = &pointKernels(SimdLevel::Scalar);
+				poco_warning(logger(), report + ", fall back to scalar kernels");
+			}
+		}
+		int workers = std::max(1, config().getInt("application.pull.workers", DEFAULT_PULL_WORKERS));
+		// one I/O thread moves roughly a gigabyte per second, add one for every 8 workers by default
+		int iothreads = config().getInt("application.pull.iothreads", 1 + workers / 8);
+		long reportInterval = config().getInt("application.pull.report.interval", DEFAULT_REPORT_INTERVAL);
+		// in-process mode: the pusher is one more task of this process, configured by the push.* keys,
+		// and hands the jobs over to the workers by pointer instead of sending them over the wire
+		bool inproc = config().getBool("application.pull.inproc", false);
+		PushSettings pushSettings;
+		if (inproc)
+		{
+			pushSettings = readPushSettings(config(), logger());
+			handOffPushSettings(pushSettings, INPROC_JOBS_ADDRESS, logger());
+			settings.pullfrom = pushSettings.pushto;
+			settings.keyed = pushSettings.keyed;
+			settings.handoff = true;
+			// flow control is on if the workers are configured to grant credit
+			if (!settings.creditTo.empty())
+				settings.creditTo = INPROC_CREDIT_ADDRESS;
+			pushSettings.creditBind = settings.creditTo;
+		}
+
+		// the pool of the pusher must outlive the context
+		BufferPool pool(64 * 1024, inproc ? pushSettings.poolBuffers : 0);
+		// all workers share one context, ZeroMQ fair-queues the pushed jobs across their sockets
+		zmq::context_t context(std::max(1, iothreads));
+		// the default thread pool is limited to 16 threads, every worker needs its own, the pusher one more
+		int threads = workers + (inproc ? 1 : 0);
+		ThreadPool threadpool(threads, threads);
+		TaskManager taskmanager(threadpool);
+		if (inproc)
+			taskmanager.start(new TaskPush(context, pool, pushSettings));
+		for (int id = 1; id <= workers; ++id)
+			taskmanager.start(new TaskPull(context, settings, id));
+		poco_information(logger(), Poco::format("started %d pull workers on %d I/O threads%s", workers, std::max(1, iothreads),
+			string(inproc ? ", jobs handed over in process" : "")));
 
+		std::vector<PullStatsSnapshot> lastStats(workers + 1);
 		for (;;)
 		{
-			Notification::Ptr pNotify(_stateQueue.waitDequeueNotification());
+			Notification::Ptr pNotify(reportInterval > 0
+				? _stateQueue.waitDequeueNotification(reportInterval)
+				: _stateQueue.waitDequeueNotification());
 			if (pNotify)
 			{
 				// no terminating state, check the event here and exist right away
@@ -129,6 +212,8 @@ int AppPullWorker::main(const ArgVec & args)
 					break;
 				}
 			}
+			else if (reportInterval > 0)
+				reportStats(taskmanager, lastStats, reportInterval);
 			else
 				break;
 		}
@@ -156,6 +241,82 @@ int AppPullWorker::main(const ArgVec & args)
 	return Application::EXIT_OK;
 }
 
+void AppPullWorker::reportStats(TaskManager& taskmanager, std::vector<PullStatsSnapshot>& lastStats, long interval)
+{
+	for (const auto& pTask : taskmanager.taskList())
+	{
+		// the pusher of the in-process mode
+		TaskPush* pPush = dynamic_cast<TaskPush*>(pTask.get());
+		if (pPush)
+		{
+			poco_information(logger(), Poco::format("pusher: %Lu jobs handed over, %Lu queued, %Lu dropped",
+				(Poco::UInt64)pPush->stats().sent.load(),
+				(Poco::UInt64)pPush->stats().queued.load(),
+				(Poco::UInt64)pPush->stats().dropped.load()));
+			continue;
+		}
+		TaskPull* pPull = dynamic_cast<TaskPull*>(pTask.get());
+		if (!pPull || pPull->id() >= (int)lastStats.size())
+			continue;
+
+		const PullStats& stats = pPull->stats();
+		PullStatsSnapshot now{ stats.jobs.load(), stats.bytes.load(), stats.busyMicroseconds.load(),
+			stats.queueWait.snapshot(), stats.decode.snapshot(), stats.process.snapshot() };
+		uint64_t resultsDropped = stats.resultsDropped.load();
+		PullStatsSnapshot& last = lastStats[pPull->id()];
+		double seconds = interval / 1000.0;
+		poco_information(logger(), Poco::format("%s: %.1f jobs/s, %.2f MB/s, %.1f%% busy, %Lu jobs total, %Lu results dropped, %Lu errors",
+			pPull->name(),
+			(now.jobs - last.jobs) / seconds,
+			(now.bytes - last.bytes) / seconds / (1024.0 * 1024.0),
+			(now.busyMicroseconds - last.busyMicroseconds) / (interval * 10.0),
+			(Poco::UInt64)now.jobs,
+			(Poco::UInt64)resultsDropped,
+			(Poco::UInt64)stats.errors.load()));
+		// latencies of the whole jobs since the last report
+		LatencySnapshot process = now.process.since(last.process);
+		if (process.count > 0)
+		{
+			LatencySnapshot queueWait = now.queueWait.since(last.queueWait);
+			if (queueWait.count > 0)
+			{
+				poco_information(logger(), pPull->name() + ": queue wait " + latencyText(queueWait));
+			}
+			poco_information(logger(), pPull->name() + ": decode " + latencyText(now.decode.since(last.decode)));
+			poco_information(logger(), pPull->name() + ": process " + latencyText(process));
+		}
+		// only workers that received jobs in batches, in shared memory, misaligned or streamed jobs report on them
+		if (stats.batches.load() > 0)
+		{
+			poco_information(logger(), Poco::format("%s: %Lu batches of small jobs unpacked",
+				pPull->name(),
+				(Poco::UInt64)stats.batches.load()));
+		}
+		if (stats.shared.load() > 0)
+		{
+			poco_information(logger(), Poco::format("%s: %Lu jobs in shared memory, %Lu discarded with the lease expired",
+				pPull->name(),
+				(Poco::UInt64)stats.shared.load(),
+				(Poco::UInt64)stats.sharedLost.load()));
+		}
+		if (stats.copied.load() > 0)
+		{
+			poco_information(logger(), Poco::format("%s: %Lu jobs received at a misaligned address and copied before reading",
+				pPull->name(),
+				(Poco::UInt64)stats.copied.load()));
+		}
+		if (stats.chunks.load() > 0)
+		{
+			poco_information(logger(), Poco::format("%s: %Lu chunks, %.2f MB held by open streams, %Lu streams dropped",
+				pPull->name(),
+				(Poco::UInt64)stats.chunks.load(),
+				stats.streamBytes.load() / (1024.0 * 1024.0),
+				(Poco::UInt64)stats.streamsDropped.load()));
+		}
+		last = now;
+	}
+}
+
 bool AppPullWorker::helpRequested()
 {
 	return _helpRequested;
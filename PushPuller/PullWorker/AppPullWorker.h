@@ -1,10 +1,25 @@
 ﻿#pragma once
 #include <string>
+#include <vector>
+#include <cstdint>
 #include <Poco/Util/Application.h>
 #include <Poco/Util/OptionSet.h>
 #include <Poco/Event.h>
 #include <Poco/Notification.h>
 #include <Poco/NotificationQueue.h>
+#include <Poco/TaskManager.h>
+#include "LatencyHistogram.hpp"
+
+// counters of a pull worker as seen at the last report
+struct PullStatsSnapshot
+{
+	uint64_t jobs;
+	uint64_t bytes;
+	uint64_t busyMicroseconds;
+	LatencySnapshot queueWait;
+	LatencySnapshot decode;
+	LatencySnapshot process;
+};
 
 class AppPullWorker: public Poco::Util::Application
 {
@@ -17,6 +32,8 @@ private:
 	void handleHelp(const std::string& name, const std::string& value);
 	// for events handle by state machine
 	static Poco::NotificationQueue _stateQueue;
+	// log the throughput and latencies of every pull worker since the last report
+	void reportStats(Poco::TaskManager& taskmanager, std::vector<PullStatsSnapshot>& lastStats, long interval);
 
 protected:
 	void initialize(Poco::Util::Application& self);
@@ -0,0 +1,576 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <vector>
+#include <Poco/Format.h>
+#include "PointKernels.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define POINTKERNELS_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+// MSVC accepts AVX2 intrinsics in any function
+#define POINTKERNELS_AVX2_TARGET
+#define POINTKERNELS_SSE2_TARGET
+#else
+#include <cpuid.h>
+#define POINTKERNELS_AVX2_TARGET __attribute__((target("avx2")))
+#define POINTKERNELS_SSE2_TARGET __attribute__((target("sse2")))
+#endif
+#endif
+
+// lanes start on a cache line and are padded to it
+static constexpr std::size_t LANE_ALIGNMENT = 64;
+
+/**********************************************************************************
+ * Scalar reference implementation
+ **********************************************************************************/
+namespace scalar
+{
+	void transpose(const Point3d* points, std::size_t n, double* x, double* y, double* z)
+	{
+		for (std::size_t i = 0; i < n; ++i)
+		{
+			x[i] = points[i].x;
+			y[i] = points[i].y;
+			z[i] = points[i].z;
+		}
+	}
+
+	void sum(const PointLanesView& lanes, double out[3])
+	{
+		out[0] = out[1] = out[2] = 0.0;
+		for (std::size_t i = 0; i < lanes.size; ++i)
+		{
+			out[0] += lanes.x[i];
+			out[1] += lanes.y[i];
+			out[2] += lanes.z[i];
+		}
+	}
+
+	void bounds(const PointLanesView& lanes, double lower[3], double upper[3])
+	{
+		lower[0] = upper[0] = lanes.x[0];
+		lower[1] = upper[1] = lanes.y[0];
+		lower[2] = upper[2] = lanes.z[0];
+		for (std::size_t i = 1; i < lanes.size; ++i)
+		{
+			lower[0] = std::min(lower[0], lanes.x[i]);
+			lower[1] = std::min(lower[1], lanes.y[i]);
+			lower[2] = std::min(lower[2], lanes.z[i]);
+			upper[0] = std::max(upper[0], lanes.x[i]);
+			upper[1] = std::max(upper[1], lanes.y[i]);
+			upper[2] = std::max(upper[2], lanes.z[i]);
+		}
+	}
+
+	void norms(const PointLanesView& lanes, double* out)
+	{
+		for (std::size_t i = 0; i < lanes.size; ++i)
+			out[i] = std::sqrt(lanes.x[i] * lanes.x[i] + lanes.y[i] * lanes.y[i] + lanes.z[i] * lanes.z[i]);
+	}
+
+	std::size_t within(const PointLanesView& lanes, const double center[3], double radius, uint32_t* indices)
+	{
+		const double r2 = radius * radius;
+		std::size_t count = 0;
+		for (std::size_t i = 0; i < lanes.size; ++i)
+		{
+			double dx = lanes.x[i] - center[0];
+			double dy = lanes.y[i] - center[1];
+			double dz = lanes.z[i] - center[2];
+			if (dx * dx + dy * dy + dz * dz <= r2)
+				indices[count++] = (uint32_t)i;
+		}
+		return count;
+	}
+}
+
+#ifdef POINTKERNELS_X86
+/**********************************************************************************
+ * SSE2, two points per step
+ **********************************************************************************/
+namespace sse2
+{
+	POINTKERNELS_SSE2_TARGET
+	void transpose(const Point3d* points, std::size_t n, double* x, double* y, double* z)
+	{
+		const double* p = reinterpret_cast<const double*>(points);
+		std::size_t i = 0;
+		for (; i + 2 <= n; i += 2, p += 6)
+		{
+			// a = x0 y0, b = z0 x1, c = y1 z1
+			__m128d a = _mm_loadu_pd(p);
+			__m128d b = _mm_loadu_pd(p + 2);
+			__m128d c = _mm_loadu_pd(p + 4);
+			_mm_storeu_pd(x + i, _mm_shuffle_pd(a, b, 0x2));
+			_mm_storeu_pd(y + i, _mm_shuffle_pd(a, c, 0x1));
+			_mm_storeu_pd(z + i, _mm_shuffle_pd(b, c, 0x2));
+		}
+		scalar::transpose(points + i, n - i, x + i, y + i, z + i);
+	}
+
+	POINTKERNELS_SSE2_TARGET
+	void sum(const PointLanesView& lanes, double out[3])
+	{
+		__m128d sx = _mm_setzero_pd(), sy = _mm_setzero_pd(), sz = _mm_setzero_pd();
+		std::size_t i = 0;
+		for (; i + 2 <= lanes.size; i += 2)
+		{
+			sx = _mm_add_pd(sx, _mm_loadu_pd(lanes.x + i));
+			sy = _mm_add_pd(sy, _mm_loadu_pd(lanes.y + i));
+			sz = _mm_add_pd(sz, _mm_loadu_pd(lanes.z + i));
+		}
+		double tx[2], ty[2], tz[2];
+		_mm_storeu_pd(tx, sx);
+		_mm_storeu_pd(ty, sy);
+		_mm_storeu_pd(tz, sz);
+		out[0] = tx[0] + tx[1];
+		out[1] = ty[0] + ty[1];
+		out[2] = tz[0] + tz[1];
+		for (; i < lanes.size; ++i)
+		{
+			out[0] += lanes.x[i];
+			out[1] += lanes.y[i];
+			out[2] += lanes.z[i];
+		}
+	}
+
+	POINTKERNELS_SSE2_TARGET
+	void bounds(const PointLanesView& lanes, double lower[3], double upper[3])
+	{
+		__m128d lx = _mm_set1_pd(lanes.x[0]), ly = _mm_set1_pd(lanes.y[0]), lz = _mm_set1_pd(lanes.z[0]);
+		__m128d ux = lx, uy = ly, uz = lz;
+		std::size_t i = 0;
+		for (; i + 2 <= lanes.size; i += 2)
+		{
+			__m128d vx = _mm_loadu_pd(lanes.x + i);
+			__m128d vy = _mm_loadu_pd(lanes.y + i);
+			__m128d vz = _mm_loadu_pd(lanes.z + i);
+			lx = _mm_min_pd(lx, vx); ux = _mm_max_pd(ux, vx);
+			ly = _mm_min_pd(ly, vy); uy = _mm_max_pd(uy, vy);
+			lz = _mm_min_pd(lz, vz); uz = _mm_max_pd(uz, vz);
+		}
+		double t[2];
+		_mm_storeu_pd(t, lx); lower[0] = std::min(t[0], t[1]);
+		_mm_storeu_pd(t, ly); lower[1] = std::min(t[0], t[1]);
+		_mm_storeu_pd(t, lz); lower[2] = std::min(t[0], t[1]);
+		_mm_storeu_pd(t, ux); upper[0] = std::max(t[0], t[1]);
+		_mm_storeu_pd(t, uy); upper[1] = std::max(t[0], t[1]);
+		_mm_storeu_pd(t, uz); upper[2] = std::max(t[0], t[1]);
+		for (; i < lanes.size; ++i)
+		{
+			lower[0] = std::min(lower[0], lanes.x[i]); upper[0] = std::max(upper[0], lanes.x[i]);
+			lower[1] = std::min(lower[1], lanes.y[i]); upper[1] = std::max(upper[1], lanes.y[i]);
+			lower[2] = std::min(lower[2], lanes.z[i]); upper[2] = std::max(upper[2], lanes.z[i]);
+		}
+	}
+
+	POINTKERNELS_SSE2_TARGET
+	void norms(const PointLanesView& lanes, double* out)
+	{
+		std::size_t i = 0;
+		for (; i + 2 <= lanes.size; i += 2)
+		{
+			__m128d vx = _mm_loadu_pd(lanes.x + i);
+			__m128d vy = _mm_loadu_pd(lanes.y + i);
+			__m128d vz = _mm_loadu_pd(lanes.z + i);
+			__m128d d2 = _mm_add_pd(_mm_add_pd(_mm_mul_pd(vx, vx), _mm_mul_pd(vy, vy)), _mm_mul_pd(vz, vz));
+			_mm_storeu_pd(out + i, _mm_sqrt_pd(d2));
+		}
+		PointLanesView tail{ lanes.x + i, lanes.y + i, lanes.z + i, lanes.size - i };
+		scalar::norms(tail, out + i);
+	}
+
+	POINTKERNELS_SSE2_TARGET
+	std::size_t within(const PointLanesView& lanes, const double center[3], double radius, uint32_t* indices)
+	{
+		const __m128d cx = _mm_set1_pd(center[0]), cy = _mm_set1_pd(center[1]), cz = _mm_set1_pd(center[2]);
+		const __m128d r2 = _mm_set1_pd(radius * radius);
+		std::size_t count = 0;
+		std::size_t i = 0;
+		for (; i + 2 <= lanes.size; i += 2)
+		{
+			__m128d dx = _mm_sub_pd(_mm_loadu_pd(lanes.x + i), cx);
+			__m128d dy = _mm_sub_pd(_mm_loadu_pd(lanes.y + i), cy);
+			__m128d dz = _mm_sub_pd(_mm_loadu_pd(lanes.z + i), cz);
+			__m128d d2 = _mm_add_pd(_mm_add_pd(_mm_mul_pd(dx, dx), _mm_mul_pd(dy, dy)), _mm_mul_pd(dz, dz));
+			int mask = _mm_movemask_pd(_mm_cmple_pd(d2, r2));
+			if (mask & 1) indices[count++] = (uint32_t)i;
+			if (mask & 2) indices[count++] = (uint32_t)(i + 1);
+		}
+		PointLanesView tail{ lanes.x + i, lanes.y + i, lanes.z + i, lanes.size - i };
+		std::size_t tailCount = scalar::within(tail, center, radius, indices + count);
+		for (std::size_t k = 0; k < tailCount; ++k)
+			indices[count + k] += (uint32_t)i;
+		return count + tailCount;
+	}
+}
+
+/**********************************************************************************
+ * AVX2, four points per step
+ **********************************************************************************/
+namespace avx2
+{
+	POINTKERNELS_AVX2_TARGET
+	void transpose(const Point3d* points, std::size_t n, double* x, double* y, double* z)
+	{
+		const double* p = reinterpret_cast<const double*>(points);
+		std::size_t i = 0;
+		for (; i + 4 <= n; i += 4, p += 12)
+		{
+			// m03 = x0 y0 | x2 y2, m14 = z0 x1 | z2 x3, m25 = y1 z1 | y3 z3
+			__m256d m03 = _mm256_insertf128_pd(_mm256_castpd128_pd256(_mm_loadu_pd(p)), _mm_loadu_pd(p + 6), 1);
+			__m256d m14 = _mm256_insertf128_pd(_mm256_castpd128_pd256(_mm_loadu_pd(p + 2)), _mm_loadu_pd(p + 8), 1);
+			__m256d m25 = _mm256_insertf128_pd(_mm256_castpd128_pd256(_mm_loadu_pd(p + 4)), _mm_loadu_pd(p + 10), 1);
+			_mm256_storeu_pd(x + i, _mm256_shuffle_pd(m03, m14, 0xA));
+			_mm256_storeu_pd(y + i, _mm256_shuffle_pd(m03, m25, 0x5));
+			_mm256_storeu_pd(z + i, _mm256_shuffle_pd(m14, m25, 0xA));
+		}
+		scalar::transpose(points + i, n - i, x + i, y + i, z + i);
+	}
+
+	POINTKERNELS_AVX2_TARGET
+	static double horizontal(__m256d v, double (*op)(double, double))
+	{
+		double t[4];
+		_mm256_storeu_pd(t, v);
+		return op(op(t[0], t[1]), op(t[2], t[3]));
+	}
+
+	static double add(double a, double b) { return a + b; }
+	static double lesser(double a, double b) { return std::min(a, b); }
+	static double greater(double a, double b) { return std::max(a, b); }
+
+	POINTKERNELS_AVX2_TARGET
+	void sum(const PointLanesView& lanes, double out[3])
+	{
+		__m256d sx = _mm256_setzero_pd(), sy = _mm256_setzero_pd(), sz = _mm256_setzero_pd();
+		std::size_t i = 0;
+		for (; i + 4 <= lanes.size; i += 4)
+		{
+			sx = _mm256_add_pd(sx, _mm256_loadu_pd(lanes.x + i));
+			sy = _mm256_add_pd(sy, _mm256_loadu_pd(lanes.y + i));
+			sz = _mm256_add_pd(sz, _mm256_loadu_pd(lanes.z + i));
+		}
+		out[0] = horizontal(sx, add);
+		out[1] = horizontal(sy, add);
+		out[2] = horizontal(sz, add);
+		for (; i < lanes.size; ++i)
+		{
+			out[0] += lanes.x[i];
+			out[1] += lanes.y[i];
+			out[2] += lanes.z[i];
+		}
+	}
+
+	POINTKERNELS_AVX2_TARGET
+	void bounds(const PointLanesView& lanes, double lower[3], double upper[3])
+	{
+		__m256d lx = _mm256_set1_pd(lanes.x[0]), ly = _mm256_set1_pd(lanes.y[0]), lz = _mm256_set1_pd(lanes.z[0]);
+		__m256d ux = lx, uy = ly, uz = lz;
+		std::size_t i = 0;
+		for (; i + 4 <= lanes.size; i += 4)
+		{
+			__m256d vx = _mm256_loadu_pd(lanes.x + i);
+			__m256d vy = _mm256_loadu_pd(lanes.y + i);
+			__m256d vz = _mm256_loadu_pd(lanes.z + i);
+			lx = _mm256_min_pd(lx, vx); ux = _mm256_max_pd(ux, vx);
+			ly = _mm256_min_pd(ly, vy); uy = _mm256_max_pd(uy, vy);
+			lz = _mm256_min_pd(lz, vz); uz = _mm256_max_pd(uz, vz);
+		}
+		lower[0] = horizontal(lx, lesser); upper[0] = horizontal(ux, greater);
+		lower[1] = horizontal(ly, lesser); upper[1] = horizontal(uy, greater);
+		lower[2] = horizontal(lz, lesser); upper[2] = horizontal(uz, greater);
+		for (; i < lanes.size; ++i)
+		{
+			lower[0] = std::min(lower[0], lanes.x[i]); upper[0] = std::max(upper[0], lanes.x[i]);
+			lower[1] = std::min(lower[1], lanes.y[i]); upper[1] = std::max(upper[1], lanes.y[i]);
+			lower[2] = std::min(lower[2], lanes.z[i]); upper[2] = std::max(upper[2], lanes.z[i]);
+		}
+	}
+
+	POINTKERNELS_AVX2_TARGET
+	void norms(const PointLanesView& lanes, double* out)
+	{
+		std::size_t i = 0;
+		for (; i + 4 <= lanes.size; i += 4)
+		{
+			__m256d vx = _mm256_loadu_pd(lanes.x + i);
+			__m256d vy = _mm256_loadu_pd(lanes.y + i);
+			__m256d vz = _mm256_loadu_pd(lanes.z + i);
+			__m256d d2 = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(vx, vx), _mm256_mul_pd(vy, vy)), _mm256_mul_pd(vz, vz));
+			_mm256_storeu_pd(out + i, _mm256_sqrt_pd(d2));
+		}
+		PointLanesView tail{ lanes.x + i, lanes.y + i, lanes.z + i, lanes.size - i };
+		scalar::norms(tail, out + i);
+	}
+
+	POINTKERNELS_AVX2_TARGET
+	std::size_t within(const PointLanesView& lanes, const double center[3], double radius, uint32_t* indices)
+	{
+		const __m256d cx = _mm256_set1_pd(center[0]), cy = _mm256_set1_pd(center[1]), cz = _mm256_set1_pd(center[2]);
+		const __m256d r2 = _mm256_set1_pd(radius * radius);
+		std::size_t count = 0;
+		std::size_t i = 0;
+		for (; i + 4 <= lanes.size; i += 4)
+		{
+			__m256d dx = _mm256_sub_pd(_mm256_loadu_pd(lanes.x + i), cx);
+			__m256d dy = _mm256_sub_pd(_mm256_loadu_pd(lanes.y + i), cy);
+			__m256d dz = _mm256_sub_pd(_mm256_loadu_pd(lanes.z + i), cz);
+			__m256d d2 = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy)), _mm256_mul_pd(dz, dz));
+			int mask = _mm256_movemask_pd(_mm256_cmp_pd(d2, r2, _CMP_LE_OQ));
+			for (int k = 0; k < 4; ++k)
+				if (mask & (1 << k))
+					indices[count++] = (uint32_t)(i + k);
+		}
+		PointLanesView tail{ lanes.x + i, lanes.y + i, lanes.z + i, lanes.size - i };
+		std::size_t tailCount = scalar::within(tail, center, radius, indices + count);
+		for (std::size_t k = 0; k < tailCount; ++k)
+			indices[count + k] += (uint32_t)i;
+		return count + tailCount;
+	}
+}
+#endif
+
+/**********************************************************************************
+ * Runtime dispatch
+ **********************************************************************************/
+static const PointKernels kernelTable[] = {
+	{ SimdLevel::Scalar, "scalar", scalar::transpose, scalar::sum, scalar::bounds, scalar::norms, scalar::within },
+#ifdef POINTKERNELS_X86
+	{ SimdLevel::SSE2, "SSE2", sse2::transpose, sse2::sum, sse2::bounds, sse2::norms, sse2::within },
+	{ SimdLevel::AVX2, "AVX2", avx2::transpose, avx2::sum, avx2::bounds, avx2::norms, avx2::within },
+#endif
+};
+
+SimdLevel detectSimd()
+{
+#ifdef POINTKERNELS_X86
+#if defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	int maxLeaf = info[0];
+	__cpuid(info, 1);
+	bool sse2 = (info[3] & (1 << 26)) != 0;
+	// AVX state has to be enabled by the operating system as well
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	bool avx = (info[2] & (1 << 28)) != 0;
+	bool avx2 = false;
+	if (maxLeaf >= 7 && osxsave && avx && (_xgetbv(0) & 0x6) == 0x6)
+	{
+		__cpuidex(info, 7, 0);
+		avx2 = (info[1] & (1 << 5)) != 0;
+	}
+#else
+	__builtin_cpu_init();
+	bool sse2 = __builtin_cpu_supports("sse2");
+	bool avx2 = __builtin_cpu_supports("avx2");
+#endif
+	if (avx2)
+		return SimdLevel::AVX2;
+	if (sse2)
+		return SimdLevel::SSE2;
+#endif
+	return SimdLevel::Scalar;
+}
+
+const PointKernels& pointKernels(SimdLevel level)
+{
+	const PointKernels* best = &kernelTable[0];
+	SimdLevel available = detectSimd();
+	for (const auto& kernels : kernelTable)
+	{
+		if (kernels.level <= level && kernels.level <= available)
+			best = &kernels;
+	}
+	return *best;
+}
+
+const PointKernels& pointKernels()
+{
+	static const PointKernels& best = pointKernels(detectSimd());
+	return best;
+}
+
+bool verifyPointKernels(const PointKernels& kernels, std::string& report)
+{
+	const PointKernels& reference = kernelTable[0];
+	// odd sizes exercise the scalar tails of the vector loops
+	for (std::size_t n : { 1, 2, 3, 5, 8, 13, 64, 1001 })
+	{
+		std::vector<Point3d> points(n);
+		for (std::size_t i = 0; i < n; ++i)
+			points[i] = Point3d{ std::sin(0.1 * i) * 3.0, std::cos(0.37 * i) * 2.0, 0.01 * i - 1.0 };
+
+		PointLanes expected, actual;
+		const PointLanesView& ref = expected.assign(reference, points.data(), n);
+		const PointLanesView& lanes = actual.assign(kernels, points.data(), n);
+		if (std::memcmp(ref.x, lanes.x, n * sizeof(double)) != 0
+			|| std::memcmp(ref.y, lanes.y, n * sizeof(double)) != 0
+			|| std::memcmp(ref.z, lanes.z, n * sizeof(double)) != 0)
+		{
+			report = Poco::format("%s transpose differs for %z points", std::string(kernels.name), n);
+			return false;
+		}
+
+		// summation order differs between implementations, compare with a relative tolerance
+		double s0[3], s1[3];
+		reference.sum(ref, s0);
+		kernels.sum(lanes, s1);
+		for (int k = 0; k < 3; ++k)
+		{
+			if (std::fabs(s0[k] - s1[k]) > 1e-12 * std::max(1.0, std::fabs(s0[k])) * n)
+			{
+				report = Poco::format("%s sum differs for %z points", std::string(kernels.name), n);
+				return false;
+			}
+		}
+
+		double l0[3], u0[3], l1[3], u1[3];
+		reference.bounds(ref, l0, u0);
+		kernels.bounds(lanes, l1, u1);
+		if (std::memcmp(l0, l1, sizeof(l0)) != 0 || std::memcmp(u0, u1, sizeof(u0)) != 0)
+		{
+			report = Poco::format("%s bounds differ for %z points", std::string(kernels.name), n);
+			return false;
+		}
+
+		reference.norms(ref, expected.norms());
+		kernels.norms(lanes, actual.norms());
+		if (std::memcmp(expected.norms(), actual.norms(), n * sizeof(double)) != 0)
+		{
+			report = Poco::format("%s norms differ for %z points", std::string(kernels.name), n);
+			return false;
+		}
+
+		const double center[3] = { 0.5, -0.25, 0.0 };
+		std::size_t c0 = reference.within(ref, center, 2.0, expected.indices());
+		std::size_t c1 = kernels.within(lanes, center, 2.0, actual.indices());
+		if (c0 != c1 || std::memcmp(expected.indices(), actual.indices(), c0 * sizeof(uint32_t)) != 0)
+		{
+			report = Poco::format("%s distance filter differs for %z points", std::string(kernels.name), n);
+			return false;
+		}
+	}
+
+	report = Poco::format("%s kernels match the scalar reference", std::string(kernels.name));
+	return true;
+}
+
+/**********************************************************************************
+ * PointLanes
+ **********************************************************************************/
+PointLanes::PointLanes()
+	: _capacity(0)
+	, _norms(nullptr)
+	, _owned{ nullptr, nullptr, nullptr, 0 }
+	, _view{ nullptr, nullptr, nullptr, 0 }
+{
+}
+
+void PointLanes::reserve(std::size_t n)
+{
+	if (n <= _capacity)
+		return;
+
+	// four lanes (x, y, z and norms), each padded to a cache line, plus room to align the first one
+	const std::size_t perLane = LANE_ALIGNMENT / sizeof(double);
+	std::size_t stride = (n + perLane - 1) / perLane * perLane;
+	_storage.reset(new double[4 * stride + perLane]);
+	_indices.reset(new uint32_t[stride]);
+	_capacity = stride;
+
+	std::uintptr_t addr = reinterpret_cast<std::uintptr_t>(_storage.get());
+	double* base = _storage.get() + ((LANE_ALIGNMENT - addr % LANE_ALIGNMENT) % LANE_ALIGNMENT) / sizeof(double);
+	_owned.x = base;
+	_owned.y = base + stride;
+	_owned.z = base + 2 * stride;
+	_norms = base + 3 * stride;
+}
+
+const PointLanesView& PointLanes::assign(const PointKernels& kernels, const Point3d* points, std::size_t n)
+{
+	reserve(n);
+	kernels.transpose(points, n, const_cast<double*>(_owned.x), const_cast<double*>(_owned.y), const_cast<double*>(_owned.z));
+	_view = _owned;
+	_view.size = n;
+	return _view;
+}
+
+const PointLanesView& PointLanes::wrap(const PointLanesView& lanes)
+{
+	// only the scratch space for the kernel outputs is needed
+	reserve(lanes.size);
+	_view = lanes;
+	return _view;
+}
+
+PointStats computePointStats(const PointKernels& kernels, PointLanes& lanes, double radius)
+{
+	PointStats stats;
+	std::memset(&stats, 0, sizeof(stats));
+	const PointLanesView& view = lanes.view();
+	stats.count = (uint32_t)view.size;
+	if (view.size == 0)
+		return stats;
+
+	double sum[3], lower[3], upper[3];
+	kernels.sum(view, sum);
+	kernels.bounds(view, lower, upper);
+	stats.centroid = Point3d{ sum[0] / view.size, sum[1] / view.size, sum[2] / view.size };
+	stats.lower = Point3d{ lower[0], lower[1], lower[2] };
+	stats.upper = Point3d{ upper[0], upper[1], upper[2] };
+
+	kernels.norms(view, lanes.norms());
+	stats.maxNorm = *std::max_element(lanes.norms(), lanes.norms() + view.size);
+
+	const double center[3] = { stats.centroid.x, stats.centroid.y, stats.centroid.z };
+	stats.withinRadius = (uint32_t)kernels.within(view, center, radius, lanes.indices());
+	return stats;
+}
+
+PointStatsAccumulator::PointStatsAccumulator()
+{
+	std::memset(&_stats, 0, sizeof(_stats));
+	_sum[0] = _sum[1] = _sum[2] = 0.0;
+}
+
+void PointStatsAccumulator::add(const PointKernels& kernels, PointLanes& lanes)
+{
+	const PointLanesView& view = lanes.view();
+	if (view.size == 0)
+		return;
+
+	double sum[3], lower[3], upper[3];
+	kernels.sum(view, sum);
+	kernels.bounds(view, lower, upper);
+	kernels.norms(view, lanes.norms());
+	double maxNorm = *std::max_element(lanes.norms(), lanes.norms() + view.size);
+	for (int axis = 0; axis < 3; ++axis)
+		_sum[axis] += sum[axis];
+	if (_stats.count == 0)
+	{
+		_stats.lower = Point3d{ lower[0], lower[1], lower[2] };
+		_stats.upper = Point3d{ upper[0], upper[1], upper[2] };
+		_stats.maxNorm = maxNorm;
+	}
+	else
+	{
+		_stats.lower = Point3d{ std::min(_stats.lower.x, lower[0]), std::min(_stats.lower.y, lower[1]), std::min(_stats.lower.z, lower[2]) };
+		_stats.upper = Point3d{ std::max(_stats.upper.x, upper[0]), std::max(_stats.upper.y, upper[1]), std::max(_stats.upper.z, upper[2]) };
+		_stats.maxNorm = std::max(_stats.maxNorm, maxNorm);
+	}
+	_stats.count += (uint32_t)view.size;
+}
+
+PointStats PointStatsAccumulator::result() const
+{
+	PointStats stats = _stats;
+	if (stats.count > 0)
+		stats.centroid = Point3d{ _sum[0] / stats.count, _sum[1] / stats.count, _sum[2] / stats.count };
+	return stats;
+}
@@ -0,0 +1,107 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include "JobTypes.h"
+
+// instruction sets the point kernels are implemented for
+enum class SimdLevel : uint8_t
+{
+	Scalar,
+	SSE2,
+	AVX2
+};
+
+// read-only structure-of-arrays view of a point cloud
+struct PointLanesView
+{
+	const double* x;
+	const double* y;
+	const double* z;
+	std::size_t size;
+};
+
+// table of kernel implementations for one instruction set
+struct PointKernels
+{
+	SimdLevel level;
+	const char* name;
+	// split interleaved points into the x, y and z lanes
+	void (*transpose)(const Point3d* points, std::size_t n, double* x, double* y, double* z);
+	// per-lane sums, the centroid is sum / n
+	void (*sum)(const PointLanesView& lanes, double out[3]);
+	// per-lane minimum and maximum, n must not be zero
+	void (*bounds)(const PointLanesView& lanes, double lower[3], double upper[3]);
+	// euclidean norm of every point
+	void (*norms)(const PointLanesView& lanes, double* out);
+	// indices of the points within radius of center, returns how many were written
+	std::size_t (*within)(const PointLanesView& lanes, const double center[3], double radius, uint32_t* indices);
+};
+
+// highest instruction set supported by this CPU and operating system
+SimdLevel detectSimd();
+// kernels of the given level, falls back to the best available level below it
+const PointKernels& pointKernels(SimdLevel level);
+// kernels of the best level available at runtime
+const PointKernels& pointKernels();
+// compare the kernels against the scalar reference on synthetic data,
+// returns false and describes the first mismatch in report
+bool verifyPointKernels(const PointKernels& kernels, std::string& report);
+
+// PointLanes owns 64-byte aligned lanes plus scratch space for the kernel outputs,
+// it is kept per worker and reused across jobs to avoid reallocation
+class PointLanes
+{
+private:
+	std::unique_ptr<double[]> _storage;
+	std::unique_ptr<uint32_t[]> _indices;
+	std::size_t _capacity;
+	double* _norms;
+	// lanes in _storage, _view either refers to them or to lanes given to wrap()
+	PointLanesView _owned;
+	PointLanesView _view;
+
+	void reserve(std::size_t n);
+
+public:
+	PointLanes();
+	// transpose the interleaved points into the lanes
+	const PointLanesView& assign(const PointKernels& kernels, const Point3d* points, std::size_t n);
+	// use lanes that already exist elsewhere, e.g. in a received frame, without copying them
+	const PointLanesView& wrap(const PointLanesView& lanes);
+	const PointLanesView& view() const { return _view; }
+	// output buffers for norms() and within(), sized for the assigned points
+	double* norms() const { return _norms; }
+	uint32_t* indices() const { return _indices.get(); }
+};
+
+// results of running the kernels over one job
+struct PointStats
+{
+	uint32_t count;
+	uint32_t withinRadius;
+	Point3d centroid;
+	Point3d lower;
+	Point3d upper;
+	double maxNorm;
+};
+
+// centroid, bounding box, largest norm and the number of points within radius of the centroid
+PointStats computePointStats(const PointKernels& kernels, PointLanes& lanes, double radius);
+
+// PointStats of points that arrive in pieces, e.g. the chunks of a streamed job, without keeping them;
+// counting the points within radius of the centroid needs all points at once and is left to computePointStats
+class PointStatsAccumulator
+{
+private:
+	PointStats _stats;
+	double _sum[3];
+
+public:
+	PointStatsAccumulator();
+	// add the points assigned to or wrapped by lanes
+	void add(const PointKernels& kernels, PointLanes& lanes);
+	// stats of all points added so far, withinRadius stays zero
+	PointStats result() const;
+};
@@ -1,119 +1,530 @@
 #pragma once
 #include <string>
 #include <memory>
-#include <sstream>
 #include <vector>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
 #include <Poco/Task.h>
 #include <Poco/Logger.h>
 #include <Poco/Format.h>
+#include <Poco/Timestamp.h>
 #include <Poco/NotificationQueue.h>
 #include <zmq_addon.hpp>
 //#include <Eigen/Core>
+#include "JobTypes.h"
+#include "JobView.hpp"
+#include "JobReader.hpp"
+#include "JobResult.hpp"
+#include "JobStream.hpp"
+#include "JobRing.hpp"
+#include "JobBatch.hpp"
+#include "JobCredit.hpp"
+#include "LatencyHistogram.hpp"
+#include "JobDump.hpp"
+#include "PointKernels.h"
 
 using std::string;
-using std::ostringstream;
 using std::vector;
 
-struct Point3d
+// per-worker counters, written by the worker and read by the reporter at any time
+struct PullStats
 {
-	double x;
-	double y;
-	double z;
+	std::atomic<uint64_t> jobs{ 0 };
+	std::atomic<uint64_t> bytes{ 0 };
+	std::atomic<uint64_t> busyMicroseconds{ 0 };
+	// jobs and chunks rejected as invalid, and errors of the receive loop
+	std::atomic<uint64_t> errors{ 0 };
+	// results the sink socket did not take
+	std::atomic<uint64_t> resultsDropped{ 0 };
+	// chunks of streamed jobs, a streamed job counts as a job once its last chunk is processed
+	std::atomic<uint64_t> chunks{ 0 };
+	// streams given up or rejected before their last chunk
+	std::atomic<uint64_t> streamsDropped{ 0 };
+	// bytes held by the open streams
+	std::atomic<uint64_t> streamBytes{ 0 };
+	// jobs read from the shared memory ring of the pusher, and those discarded because it took them back
+	std::atomic<uint64_t> shared{ 0 };
+	std::atomic<uint64_t> sharedLost{ 0 };
+	// jobs whose frames arrived at a misaligned address and were copied before they were read
+	std::atomic<uint64_t> copied{ 0 };
+	// batches of small jobs, every job of a batch counts as a job as well
+	std::atomic<uint64_t> batches{ 0 };
+	// nanoseconds from the pusher making a job to its arrival here, for jobs stamped on this host,
+	// to decode a job, and to run the kernels over it and send its result; whole jobs only
+	LatencyHistogram queueWait;
+	LatencyHistogram decode;
+	LatencyHistogram process;
+};
+
+// settings shared by all workers of the pool
+struct PullSettings
+{
+	string pullfrom;
+	// maximum number of jobs drained per wakeup before checking for cancellation again
+	int batch;
+	// kernels run on every job, null to skip the processing
+	const PointKernels* kernels;
+	// radius of the distance filter around the centroid
+	double radius;
+	// PUB endpoint the kernel results are sent to, empty to only log them
+	string publish;
+	// receive over a DEALER socket from a pusher that routes jobs by key
+	bool keyed;
+	// the pusher is a task of this process and hands the jobs over by pointer on an inproc endpoint
+	bool handoff;
+	// identity prefix of the workers with keyed routing or flow control, unique per PullWorker process and stable across restarts
+	string name;
+	// endpoint of the sink every job result is pushed to, empty to push no results
+	string sinkTo;
+	// points and doubles of every job dumped at trace level
+	std::size_t dumpItems;
+	// ZMQ_RCVHWM of the pull socket, 0 for unlimited and negative to keep the ZeroMQ default
+	int rcvhwm;
+	// endpoint of the pusher to grant credits to, empty if the pusher runs without flow control;
+	// the jobs then come over a DEALER socket as well, the pusher addresses every worker by its credit
+	string creditTo;
+	// jobs granted up front, at most this many are queued for the worker
+	int creditWindow;
+	// milliseconds without jobs after which the grant is repeated, in case the pusher restarted
+	long creditRefresh;
+	// bytes the open streams of a worker may hold together
+	std::size_t streamMemory;
 };
 
 class TaskPull : public Poco::Task
 {
 private:
 	Poco::Logger& _logger;
-	const string _pullfrom;
+	// the context is shared by all workers of the pool
+	zmq::context_t& _context;
+	const PullSettings _settings;
+	const int _id;
+	// the identity of the worker towards a keyed or credited pusher
+	const string _identity;
+	// cancel() signals the blocking poll through this inproc endpoint
+	const string _wakeup;
+	// handed over jobs are only accepted from an inproc endpoint, a frame that looks like one may come from anywhere else
+	const bool _handoff;
+	// see JobCredit.hpp, the epoch starts with runTask()
+	uint64_t _creditEpoch;
+	uint64_t _taken;
+	PullStats _stats;
+	// reused by every job to keep the kernels free of allocations
+	PointLanes _lanes;
+	std::unique_ptr<zmq::socket_t> _publisher;
+	// back channel to the pusher, null without credit-based flow control
+	std::unique_ptr<zmq::socket_t> _credit;
+	std::unique_ptr<zmq::socket_t> _sink;
+	// streamed jobs, processed chunk by chunk
+	JobStreamReader _streams;
+	// decodes the jobs, and reads those in the shared memory ring of the pusher
+	JobReader _reader;
+
+	// runs the kernels over every chunk of a streamed job, the result is sent once the last chunk arrived
+	class StreamedJob : public JobStreamConsumer
+	{
+	private:
+		TaskPull& _task;
+		const JobHeader _header;
+		PointStatsAccumulator _accumulator;
+
+	public:
+		StreamedJob(TaskPull& task, const JobHeader& header)
+			: _task(task)
+			, _header(header)
+		{
+		}
+
+		void points(const Point3d* points, std::size_t first, std::size_t count)
+		{
+			if (first == 0 && _task._logger.trace())
+			{
+				std::string& text = dumpBuffer();
+				text += ">>> Point3d array, first chunk:\n";
+				dumpPoints(text, PointsView(FrameView<Point3d>(points, count)), _task._settings.dumpItems);
+				poco_trace(_task._logger, text);
+			}
+			if (_task._settings.kernels)
+			{
+				_task._lanes.assign(*_task._settings.kernels, points, count);
+				_accumulator.add(*_task._settings.kernels, _task._lanes);
+			}
+		}
+
+		// the kernels only look at the points
+		void doubles(const double* values, std::size_t first, std::size_t count)
+		{
+		}
+
+		void end()
+		{
+			PointStats result = _accumulator.result();
+			if (_task._settings.kernels)
+				_task.publishStats(result);
+			if (_task._sink)
+				_task.sendResult(_header, _task._settings.kernels ? &result : nullptr);
+		}
+	};
+
+	std::unique_ptr<JobStreamConsumer> openStream(const JobHeader& header)
+	{
+		poco_debug(_logger, Poco::format("### New streamed job#%Lu: %u points, %Lu doubles, scalar %f",
+			(Poco::UInt64)header.sequence, header.pointCount, (Poco::UInt64)(header.doubles.length / sizeof(double)), header.scalar));
+		return std::unique_ptr<JobStreamConsumer>(new StreamedJob(*this, header));
+	}
+
+	// jobs come over a DEALER socket from a pusher that addresses every worker
+	bool addressed() const
+	{
+		return _settings.keyed || !_settings.creditTo.empty();
+	}
+
+	// tell a keyed or credited pusher that this worker takes jobs, or that it leaves
+	void announce(zmq::socket_t& puller, const char* command)
+	{
+		if (addressed())
+			puller.send(command, std::strlen(command), ZMQ_DONTWAIT);
+	}
+
+	// count the jobs taken off the queue and allow the pusher a window beyond them
+	void grantCredit(uint32_t taken)
+	{
+		_taken += taken;
+		// the grant is absolute, a lost one is made up for by the next
+		if (_credit)
+		{
+			zmq::message_t grant = makeCreditGrant(_identity, _creditEpoch, _taken, (uint32_t)_settings.creditWindow);
+			_credit->send(grant, ZMQ_DONTWAIT);
+		}
+	}
+
+	// tag the result with the sequence number of the job, the sink puts the results back in order
+	void sendResult(const JobHeader& header, const PointStats* stats)
+	{
+		ResultHeader result = makeResultHeader((uint32_t)_id, header.sequence, header.sendTime, stats ? RESULT_FLAG_POINT_STATS : 0);
+		zmq::multipart_t msgResult;
+		msgResult.addmem(&result, sizeof(result));
+		if (stats)
+			msgResult.addmem(stats, sizeof(*stats));
+		else
+			msgResult.add(zmq::message_t());
+		if (!msgResult.send(*_sink, ZMQ_DONTWAIT))
+		{
+			_stats.resultsDropped.fetch_add(1, std::memory_order_relaxed);
+			poco_debug(_logger, Poco::format("sink queue is full, result of job#%Lu dropped", (Poco::UInt64)header.sequence));
+		}
+	}
+
+	void runKernels(const JobView& job, PointStats& result)
+	{
+		const PointKernels& kernels = *_settings.kernels;
+		const PointsView& points = job.points();
+		// lanes received as such are used in place, interleaved points are transposed first
+		if (points.interleaved())
+			_lanes.assign(kernels, points.data(), points.size());
+		else
+			_lanes.wrap(PointLanesView{ points.xs(), points.ys(), points.zs(), points.size() });
+		result = computePointStats(kernels, _lanes, _settings.radius);
+	}
+
+	void publishStats(const PointStats& result)
+	{
+		poco_debug(_logger, Poco::format(">>> %u points, centroid [ %f, %f, %f ], %u within %f",
+			result.count, result.centroid.x, result.centroid.y, result.centroid.z, result.withinRadius, _settings.radius));
+
+		if (_publisher)
+			_publisher->send(&result, sizeof(result), ZMQ_DONTWAIT);
+	}
+
+	// returns the size of the chunk in bytes, completed is set if it was the last chunk of its job
+	std::size_t processChunk(const zmq::message_t& frame, bool& completed)
+	{
+		JobStreamReader::Result result = JobStreamReader::Dropped;
+		try
+		{
+			result = _streams.receive(frame);
+		}
+		catch (...)
+		{
+			// an invalid chunk gives up its stream
+			_stats.streamsDropped.store(_streams.givenUp() + _streams.rejected(), std::memory_order_relaxed);
+			_stats.streamBytes.store(_streams.held(), std::memory_order_relaxed);
+			throw;
+		}
+		completed = (result == JobStreamReader::Completed);
+		if (result == JobStreamReader::Dropped)
+		{
+			poco_debug(_logger, "chunk of a stream that was given up, rejected or started elsewhere dropped");
+		}
+		_stats.chunks.fetch_add(1, std::memory_order_relaxed);
+		_stats.streamsDropped.store(_streams.givenUp() + _streams.rejected(), std::memory_order_relaxed);
+		_stats.streamBytes.store(_streams.held(), std::memory_order_relaxed);
+		return frame.size();
+	}
+
+	// the jobs of a batch are processed one after the other in place, an invalid one does not
+	// affect the others; jobs is set to the number of jobs, returns the size of the valid ones in bytes
+	std::size_t processBatch(const zmq::message_t& frame, std::size_t& jobs)
+	{
+		JobBatchReader batch(frame);
+		jobs = batch.count();
+		_stats.batches.fetch_add(1, std::memory_order_relaxed);
+		std::size_t bytes = 0;
+		for (std::size_t i = 0; i < batch.count(); ++i)
+		{
+			try
+			{
+				zmq::multipart_t msgJob;
+				msgJob.add(batch.job(i));
+				bytes += processJob(std::move(msgJob));
+			}
+			catch (std::exception &e)
+			{
+				_stats.errors.fetch_add(1, std::memory_order_relaxed);
+				poco_debug(_logger, "invalid job in batch: " + std::string(e.what()));
+			}
+		}
+		return bytes;
+	}
+
+	// returns the size of the processed job in bytes, a job in the shared memory ring of the pusher
+	// is processed in place; handoff is set only for a message received from the pusher of this process
+	std::size_t processJob(zmq::multipart_t&& msgIncoming, bool handoff = false)
+	{
+		//std::string strdata = msgIncoming.popstr();
+		uint64_t received = jobClock();
+		uint64_t decoded = 0;
+		JobHeader header;
+		std::size_t bytes = 0;
+		PointStats result;
+		try
+		{
+			_reader.read(std::move(msgIncoming), handoff, [&](const JobView& job)
+			{
+				decoded = jobClock();
+				_stats.decode.record(decoded - received);
+				if (job.header().sendTime && job.header().sendTime < received)
+					_stats.queueWait.record(received - job.header().sendTime);
+				// the macros skip the formatting when the level is disabled
+				poco_debug(_logger, Poco::format("### New job: %z points, %z doubles, scalar %f",
+					job.points().size(), job.doubles().size(), job.scalar()));
+
+				// dump the first points and doubles, the whole job may be far too large for the log
+				if (_logger.trace())
+				{
+					std::string& text = dumpBuffer();
+					text += ">>> Point3d array:\n";
+					dumpPoints(text, job.points(), _settings.dumpItems);
+					text += ">>> double array:\n";
+					dumpDoubles(text, job.doubles().data(), job.doubles().size(), _settings.dumpItems);
+					dumpAppend(text, ">>> double scalar: %f", job.scalar());
+					poco_trace(_logger, text);
+				}
+
+				if (_settings.kernels)
+					runKernels(job, result);
+/*
+				// mapping to Eigen::MatrixX3d works on the wire buffer as well, as long as the points are interleaved
+				Eigen::Map<const Eigen::Matrix<double, -1, 3, Eigen::RowMajor>> p3d2matrix((const double *)job.points().data(), job.points().size(), 3);
+				Eigen::MatrixX3d matrixdata = p3d2matrix;
+				// dump the matrix
+				std::ostringstream matrixstr;
+				matrixstr << matrixdata << std::endl;
+				poco_trace(_logger, Poco::format(">>> matrix dump:\n%s", matrixstr.str()));
+*/
+				header = job.header();
+				bytes = job.bytes();
+			});
+		}
+		catch (...)
+		{
+			// a job lost to an expired lease is not counted as shared
+			_stats.sharedLost.store(_reader.lost(), std::memory_order_relaxed);
+			throw;
+		}
+		_stats.shared.store(_reader.shared(), std::memory_order_relaxed);
+		_stats.copied.store(_reader.copied(), std::memory_order_relaxed);
+		// a job of the ring is only published once its lease is known to have held
+		if (_settings.kernels)
+			publishStats(result);
+		if (_sink)
+			sendResult(header, _settings.kernels ? &result : nullptr);
+		_stats.process.record(jobClock() - decoded);
+		return bytes;
+	}
 
 public:
 
-	TaskPull(string pullfrom)
-		: Task("Puller")
+	TaskPull(zmq::context_t& context, const PullSettings& settings, int id)
+		: Task("Puller#" + std::to_string(id))
 		, _logger(Poco::Logger::get("Puller"))
-		, _pullfrom(pullfrom)
+		, _context(context)
+		, _settings(settings)
+		, _id(id)
+		, _identity(settings.name + "#" + std::to_string(id))
+		, _wakeup("inproc://puller-wakeup-" + std::to_string(id))
+		, _handoff(settings.handoff && settings.pullfrom.compare(0, 9, "inproc://") == 0)
+		, _creditEpoch(0)
+		, _taken(0)
+		, _streams([this](const JobHeader& header) { return openStream(header); }, settings.streamMemory)
+	{
+	}
+
+	int id() const
+	{
+		return _id;
+	}
+
+	const PullStats& stats() const
+	{
+		return _stats;
+	}
+
+	void cancel()
 	{
+		Task::cancel();
+		// runTask() may be blocked in poll, wake it up right away
+		try
+		{
+			zmq::socket_t signal(_context, zmq::socket_type::push);
+			// do not hold the context open if runTask() has already gone
+			int linger = 100;
+			signal.setsockopt(ZMQ_LINGER, &linger, sizeof(linger));
+			signal.connect(_wakeup);
+			signal.send("", 0, ZMQ_DONTWAIT);
+		}
+		catch (std::exception &e)
+		{
+			poco_debug(_logger, "Failed to signal cancellation - " + std::string(e.what()));
+		}
 	}
 
 	void runTask()
 	{
-		zmq::context_t context(1);
-		zmq::socket_t puller(context, zmq::socket_type::pull);
+		zmq::socket_t puller(_context, addressed() ? zmq::socket_type::dealer : zmq::socket_type::pull);
+		zmq::socket_t wakeup(_context, zmq::socket_type::pull);
 		try
 		{
-			puller.connect(_pullfrom);
+			wakeup.bind(_wakeup);
+			if (_settings.rcvhwm >= 0)
+				puller.setsockopt(ZMQ_RCVHWM, &_settings.rcvhwm, sizeof(_settings.rcvhwm));
+			if (addressed())
+			{
+				// the same identity after a restart gets back the same keys
+				puller.setsockopt(ZMQ_IDENTITY, _identity.c_str(), _identity.size());
+				int linger = 0;
+				puller.setsockopt(ZMQ_LINGER, &linger, sizeof(linger));
+			}
+			puller.connect(_settings.pullfrom);
+			if (!_settings.creditTo.empty())
+			{
+				_credit.reset(new zmq::socket_t(_context, zmq::socket_type::push));
+				int linger = 0;
+				_credit->setsockopt(ZMQ_LINGER, &linger, sizeof(linger));
+				_credit->connect(_settings.creditTo);
+			}
+			if (!_settings.sinkTo.empty())
+			{
+				_sink.reset(new zmq::socket_t(_context, zmq::socket_type::push));
+				int linger = 0;
+				_sink->setsockopt(ZMQ_LINGER, &linger, sizeof(linger));
+				_sink->connect(_settings.sinkTo);
+			}
+			if (_settings.kernels && !_settings.publish.empty())
+			{
+				_publisher.reset(new zmq::socket_t(_context, zmq::socket_type::pub));
+				_publisher->connect(_settings.publish);
+			}
 		}
 		catch (std::exception &e)
 		{
-			poco_debug(_logger, "Failed to connect to " + _pullfrom + " - " + std::string(e.what()));
+			poco_debug(_logger, "Failed to connect to " + _settings.pullfrom + " - " + std::string(e.what()));
 			return;
 		}
 
-		// try one receive and one send for every 10 msec.
-		while (!sleep(1000))
+		zmq::pollitem_t items[] = {
+			{ puller, 0, ZMQ_POLLIN, 0 },
+			{ wakeup, 0, ZMQ_POLLIN, 0 }
+		};
+		// without flow control or keyed routing there is nothing to do until a job arrives
+		long timeout = addressed() ? std::max(1L, _settings.creditRefresh) : -1;
+		announce(puller, JOB_ROUTE_HELLO);
+		// a pusher that still counts jobs sent to the previous run of this worker starts over
+		_creditEpoch = (uint64_t)Poco::Timestamp().epochMicroseconds();
+		_taken = 0;
+		grantCredit(0);
+
+		while (!isCancelled())
 		{
-			// try receive an incoming message
 			try
 			{
-				zmq::multipart_t msgIncoming;
-				if (msgIncoming.recv(puller, ZMQ_DONTWAIT))
+				// block until jobs are queued or the task gets cancelled, or the mapped ring has been idle
+				if (zmq::poll(items, 2, (timeout < 0 && _reader.ring().mapped()) ? std::max(1L, _settings.creditRefresh) : timeout) == 0)
 				{
-					//std::string strdata = msgIncoming.popstr();
-					poco_information(_logger, "### New job:");
-					// 1st frame is an integer to indicate the number of point
-					int numOfPoints = msgIncoming.poptyp<int>();
-
-					// 2nd frame is 3D points array
-					zmq::message_t framePoint3d = msgIncoming.pop();
-					std::unique_ptr<Point3d[]> p3data{ new Point3d[numOfPoints] };
-					// memory copy to sequential buffer and mapping back to Point3d array is known to work
-					std::memcpy(p3data.get(), framePoint3d.data(), framePoint3d.size());
-					
-					// 3rd frame is the size of double array
-					uint32_t sizeOfDoubleArray = msgIncoming.poptyp<uint32_t>();
-
-					// 4th frame is double array
-					zmq::message_t frameDoubleArray = msgIncoming.pop();
-					double* pdouble = (double *)frameDoubleArray.data();
-					vector<double> dvector(pdouble, pdouble + sizeOfDoubleArray);
-
-					// 5th frame is a double scalar
-					double dscalar = msgIncoming.poptyp<double>();
-
-					// dump the Point3d array
-					ostringstream p3datastr;
-					for (int i = 0; i < numOfPoints; ++i)
-						p3datastr << "\t[ " << p3data[i].x << ", " << p3data[i].y << ", " << p3data[i].z << " ]\n";
-					poco_information(_logger, Poco::format(">>> Point3d array:\n%s", p3datastr.str()));
-
-					// dump the double array
-					ostringstream dvecstr;
-					dvecstr << "\t[ ";
-					for (const auto & d : dvector)
-						dvecstr << d << ", ";
-					dvecstr << " ]\n";
-
-					poco_information(_logger, Poco::format(">>> double array:\n%s", dvecstr.str()));
-					poco_information(_logger, Poco::format(">>> double scalar: %f\n", dscalar));
-/*
-					// mapping to Eigen::MatrixX3d is also work
-					Eigen::Map<Eigen::Matrix<double, -1, 3, Eigen::RowMajor>> p3d2matrix((double *)framePoint3d.data(), numOfPoints, 3);
-					Eigen::MatrixX3d matrixdata = p3d2matrix;
-					// dump the matrix
-					p3datastr.str("");
-					p3datastr << matrixdata << std::endl;
-					poco_information(_logger, Poco::format(">>> matrix dump:\n%s", p3datastr.str()));
-*/
+					// a pusher that restarted knows neither this worker nor its credit, the same grant again tells it
+					announce(puller, JOB_ROUTE_HELLO);
+					grantCredit(0);
+					// an idle worker does not keep the ring of a pusher that is gone, it is mapped again with the next job
+					_reader.ring().close();
+					continue;
+				}
+				if (items[1].revents & ZMQ_POLLIN)
+					break;
+				if (!(items[0].revents & ZMQ_POLLIN))
+					continue;
+
+				// drain the queued jobs, one batch at a time
+				uint32_t received = 0;
+				for (int n = 0; n < _settings.batch && !isCancelled(); ++n)
+				{
+					zmq::multipart_t msgIncoming;
+					if (!msgIncoming.recv(puller, ZMQ_DONTWAIT))
+						break;
+					++received;
+					// every job of a batch took a credit of its own
+					std::size_t jobs = 1;
+
+					try
+					{
+						auto start = std::chrono::steady_clock::now();
+						// a chunk of a streamed job is processed as it arrives, the job completes with its last chunk
+						bool completed = true;
+						std::size_t bytes = 0;
+						if (msgIncoming.size() == 1 && isJobChunk(msgIncoming.peek(0)->data(), msgIncoming.peek(0)->size()))
+							bytes = processChunk(*msgIncoming.peek(0), completed);
+						else if (msgIncoming.size() == 1 && isJobBatch(msgIncoming.peek(0)->data(), msgIncoming.peek(0)->size()))
+							bytes = processBatch(*msgIncoming.peek(0), jobs);
+						else
+							bytes = processJob(std::move(msgIncoming), _handoff);
+						auto busy = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+						if (completed)
+							_stats.jobs.fetch_add(jobs, std::memory_order_relaxed);
+						_stats.bytes.fetch_add(bytes, std::memory_order_relaxed);
+						_stats.busyMicroseconds.fetch_add((uint64_t)busy.count(), std::memory_order_relaxed);
+					}
+					catch (std::exception &e)
+					{
+						_stats.errors.fetch_add(1, std::memory_order_relaxed);
+						poco_debug(_logger, "invalid job: " + std::string(e.what()));
+					}
+					received += (uint32_t)(jobs - 1);
 				}
+				// every job taken off the queue, valid or not, makes room for another one
+				grantCredit(received);
 			}
 			catch (std::exception &e)
 			{
+				_stats.errors.fetch_add(1, std::memory_order_relaxed);
 				poco_debug(_logger, "incoming error: " + std::string(e.what()));
 			}
 		}
 
-		puller.disconnect(_pullfrom);
+		announce(puller, JOB_ROUTE_BYE);
+		puller.disconnect(_settings.pullfrom);
+		_publisher.reset();
+		_sink.reset();
 	}
 
 };
@@ -0,0 +1,497 @@
+﻿#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <Poco/Util/Option.h>
+#include <Poco/Util/HelpFormatter.h>
+#include <Poco/ErrorHandler.h>
+#include <Poco/AutoPtr.h>
+#include <Poco/AsyncChannel.h>
+#include <Poco/ConsoleChannel.h>
+#include <Poco/TaskManager.h>
+#include <Poco/ThreadPool.h>
+#include <Poco/Format.h>
+#include <Poco/String.h>
+#include <Poco/File.h>
+#include <Poco/Timestamp.h>
+#include <Poco/DateTimeFormat.h>
+#include <Poco/DateTimeFormatter.h>
+#include <Poco/Notification.h>
+#include <Poco/NotificationQueue.h>
+#include "Poco/Util/AbstractConfiguration.h"
+#include "AppPushPullBench.h"
+#include "TaskBench.hpp"
+
+using std::string;
+using std::vector;
+using Poco::Util::Application;
+using Poco::Util::Option;
+using Poco::Util::OptionSet;
+using Poco::Util::OptionCallback;
+using Poco::Util::HelpFormatter;
+using Poco::Util::AbstractConfiguration;
+using Poco::TaskManager;
+using Poco::ThreadPool;
+using Poco::Notification;
+
+#define DEFAULT_BENCH_TRANSPORT "tcp"
+#define DEFAULT_BENCH_POINTS 1024
+#define DEFAULT_BENCH_DOUBLES 0
+#define DEFAULT_BENCH_MESSAGES 100000
+#define DEFAULT_BENCH_BATCH 64
+#define DEFAULT_BENCH_WORKERS 1
+#define DEFAULT_BENCH_TIMEOUT 60000
+#define DEFAULT_BENCH_SHM_SIZE 256
+#define DEFAULT_BENCH_CSV "PushPullBench.csv"
+#define DEFAULT_BENCH_JSON "PushPullBench.json"
+#define DEFAULT_CODEC_ITERATIONS 1000
+#define DEFAULT_CODEC_CSV "PushPullBench-codec.csv"
+
+class TaskErrorHandler : public Poco::ErrorHandler
+{
+public:
+	void exception(const Poco::Exception& e)
+	{
+		std::cerr << "Unhandled task exception: " <<  e.displayText() << std::endl;
+	}
+
+	void exception(const std::exception& e)
+	{
+		std::cerr << "Unhandled task exception: " << e.what() << std::endl;
+	}
+
+	void exception()
+	{
+		std::cerr << "unHandled task exception: unknown exception" << std::endl;
+	}
+};
+
+// endpoint of each transport, all on the local host
+static string benchEndpoint(const string& transport)
+{
+	if (transport == "inproc" || transport == "handoff")
+		return "inproc://pushpull-bench";
+	if (transport == "ipc")
+		return "ipc://pushpull-bench.ipc";
+	return "tcp://127.0.0.1:6877";
+}
+
+// nearest-rank percentile of sorted latencies, in microseconds
+static double percentile(const vector<uint64_t>& sorted, double p)
+{
+	if (sorted.empty())
+		return 0.0;
+	std::size_t rank = (std::size_t)std::ceil(p / 100.0 * sorted.size());
+	return sorted[std::min(sorted.size(), std::max<std::size_t>(rank, 1)) - 1] / 1000.0;
+}
+
+// static members initialize
+Poco::Event AppPushPullBench::_eventTerminated;
+Poco::NotificationQueue AppPushPullBench::_stateQueue;
+
+BOOL AppPushPullBench::ConsoleCtrlHandler(DWORD ctrlType)
+{
+	switch (ctrlType)
+	{
+	case CTRL_C_EVENT:
+	case CTRL_CLOSE_EVENT:
+	case CTRL_BREAK_EVENT:
+		terminate();
+		return _eventTerminated.tryWait(3000) ? TRUE : FALSE;
+	default:
+		return FALSE;
+	}
+}
+
+void AppPushPullBench::handleHelp(const string & name, const string & value)
+{
+	_helpRequested = true;
+	// display help
+	HelpFormatter helpFormatter(options());
+	helpFormatter.setCommand(commandName());
+	helpFormatter.setUsage("Options");
+	helpFormatter.setHeader("End-to-end push/pull throughput and latency benchmark.");
+	helpFormatter.format(std::cout);
+	// stop further processing
+	stopOptionsProcessing();
+}
+
+void AppPushPullBench::handleDefine(const string & name, const string & value)
+{
+	// properties set here take precedence over the configuration file loaded later
+	string::size_type pos = value.find('=');
+	if (pos == string::npos)
+		config().setString("application." + value, "");
+	else
+		config().setString("application." + value.substr(0, pos), value.substr(pos + 1));
+}
+
+void AppPushPullBench::initialize(Application & self)
+{
+	poco_information(logger(), config().getString("application.baseName", name()) + " initialize");
+	// load default configuration file
+	loadConfiguration();
+	// all registered subsystems are initialized in ancestor's initialize procedure
+	Application::initialize(self);
+	// catch the termination request
+	SetConsoleCtrlHandler(ConsoleCtrlHandler, TRUE);
+}
+
+void AppPushPullBench::uninitialize()
+{
+	poco_information(logger(), config().getString("application.baseName", name()) + " uninitialize");
+	// ancestor uninitialization
+	Application::uninitialize();
+}
+
+void AppPushPullBench::defineOptions(Poco::Util::OptionSet & options)
+{
+	Application::defineOptions(options);
+
+	options.addOption(
+		Option("help", "h", "display help information on command line arguments")
+		.required(false)
+		.repeatable(false)
+		.callback(OptionCallback<AppPushPullBench>(this, &AppPushPullBench::handleHelp)));
+
+	options.addOption(
+		Option("define", "D", "override a bench setting, e.g. -D bench.transport=inproc")
+		.required(false)
+		.repeatable(true)
+		.argument("name=value")
+		.callback(OptionCallback<AppPushPullBench>(this, &AppPushPullBench::handleDefine)));
+}
+
+int AppPushPullBench::main(const ArgVec & args)
+{
+	if (!_helpRequested)
+	{
+
+		// install the unhandled error catcher for threads
+		TaskErrorHandler newEH;
+		Poco::ErrorHandler* pOldEH = Poco::ErrorHandler::set(&newEH);
+
+		BenchSettings settings;
+		settings.transport = config().getString("application.bench.transport", DEFAULT_BENCH_TRANSPORT);
+		settings.endpoint = config().getString("application.bench.endpoint", benchEndpoint(settings.transport));
+		settings.points = (uint32_t)std::max(0, config().getInt("application.bench.points", DEFAULT_BENCH_POINTS));
+		settings.doubles = (uint32_t)std::max(0, config().getInt("application.bench.doubles", DEFAULT_BENCH_DOUBLES));
+		settings.flags = (config().getString("application.bench.layout", "aos") == "soa") ? JOB_FLAG_SOA : 0;
+		try
+		{
+			settings.codec = jobCodecFromName(config().getString("application.bench.codec", "identity"));
+		}
+		catch (Poco::Exception& e)
+		{
+			poco_error(logger(), e.displayText());
+			Poco::ErrorHandler::set(pOldEH);
+			return Application::EXIT_CONFIG;
+		}
+		if (settings.transport == "handoff" && settings.endpoint.compare(0, 9, "inproc://") != 0)
+		{
+			// the sender frees an object once its bytes are copied to any other transport
+			poco_warning(logger(), "jobs can only be handed over inproc, bench.endpoint is ignored");
+			settings.endpoint = benchEndpoint(settings.transport);
+		}
+		settings.shmSize = (std::size_t)std::max(1, config().getInt("application.bench.shm.size", DEFAULT_BENCH_SHM_SIZE)) << 20;
+		if (settings.transport == "shm" && settings.codec != JobCodec::Identity)
+		{
+			poco_warning(logger(), "jobs in shared memory are used in place, bench.codec is ignored");
+			settings.codec = JobCodec::Identity;
+		}
+		if (settings.transport == "handoff" && (settings.flags != 0 || settings.codec != JobCodec::Identity))
+		{
+			poco_warning(logger(), "handed over jobs have interleaved points and no codec, bench.layout and bench.codec are ignored");
+			settings.flags = 0;
+			settings.codec = JobCodec::Identity;
+		}
+		settings.messages = std::max(1, config().getInt("application.bench.messages", DEFAULT_BENCH_MESSAGES));
+		settings.batch = std::max(1, config().getInt("application.bench.batch", DEFAULT_BENCH_BATCH));
+		settings.workers = std::max(1, config().getInt("application.bench.workers", DEFAULT_BENCH_WORKERS));
+		int iothreads = std::max(1, config().getInt("application.bench.iothreads", 1 + settings.workers / 8));
+		long timeout = config().getInt("application.bench.timeout", DEFAULT_BENCH_TIMEOUT);
+
+		string mode = config().getString("application.bench.mode", "transport");
+		if (mode == "codec")
+			runCodecBench(settings);
+		else
+			runTransportBench(settings, iothreads, timeout);
+
+		_eventTerminated.set();
+
+		// put back the original error handler
+		Poco::ErrorHandler::set(pOldEH);
+	}
+
+	return Application::EXIT_OK;
+}
+
+void AppPushPullBench::runTransportBench(const BenchSettings& settings, int iothreads, long timeout)
+{
+	JobLayout layout(settings.points, settings.doubles, settings.flags);
+	poco_information(logger(), Poco::format("%d jobs of %z bytes over %s to %d workers",
+		settings.messages, layout.size(), settings.endpoint, settings.workers));
+
+	BenchProgress progress;
+	vector<Poco::AutoPtr<TaskBenchPull>> pullers;
+	{
+		// the pool must outlive the context, ZeroMQ may still hold its buffers until the context terminates
+		BufferPool pool(layout.size(), 64);
+		zmq::context_t context(iothreads);
+		// one thread for the sender and one for every receiver
+		ThreadPool threadpool(settings.workers + 1, settings.workers + 1);
+		TaskManager taskmanager(threadpool);
+		for (int id = 1; id <= settings.workers; ++id)
+		{
+			pullers.push_back(new TaskBenchPull(context, settings, progress, id));
+			// the task manager takes one reference, the results are collected after it lets go
+			taskmanager.start(pullers.back().duplicate());
+		}
+		taskmanager.start(new TaskBenchPush(context, pool, settings, progress));
+
+		Poco::Timestamp started;
+		while (!progress.done.tryWait(100))
+		{
+			Notification::Ptr pNotify(_stateQueue.dequeueNotification());
+			if (pNotify && pNotify.cast<Event_TerminateRequest>())
+			{
+				poco_information(logger(), "termination request -> stop the run");
+				break;
+			}
+			if (started.isElapsed(timeout * 1000))
+			{
+				poco_warning(logger(), Poco::format("timeout after %ld ms, %d of %d jobs received",
+					timeout, progress.received.load(), settings.messages));
+				break;
+			}
+		}
+
+		taskmanager.cancelAll();
+
+		// Note: Close the AsyncChannel before taskManager joinAll() get called.
+		//       otherwise, default thread pool can be spin-locked on waiting to join. 
+		Poco::AsyncChannel* pAsyncChannel = dynamic_cast<Poco::AsyncChannel*>(logger().getChannel());
+		if (pAsyncChannel)
+		{
+			pAsyncChannel->close();
+			Poco::AutoPtr<Poco::ConsoleChannel> pCC = new Poco::ConsoleChannel;
+			logger().setChannel("", pCC);
+		}
+
+		taskmanager.joinAll();
+	}
+
+	if (progress.failed)
+	{
+		poco_error(logger(), "benchmark failed, no results written");
+	}
+	else
+	{
+		vector<uint64_t> latencies;
+		uint64_t bytes = 0;
+		for (const auto& pPull : pullers)
+		{
+			latencies.insert(latencies.end(), pPull->latencies().begin(), pPull->latencies().end());
+			bytes += pPull->bytes();
+		}
+		std::sort(latencies.begin(), latencies.end());
+
+		BenchResult result;
+		result.sent = settings.messages;
+		result.received = progress.received.load();
+		result.jobBytes = layout.size();
+		uint64_t last = progress.lastReceive.load() ? progress.lastReceive.load() : jobClock();
+		result.seconds = result.received > 0 ? (last - progress.firstSend.load()) / 1e9 : 0.0;
+		result.messagesPerSecond = result.seconds > 0 ? result.received / result.seconds : 0.0;
+		result.megabytesPerSecond = result.seconds > 0 ? bytes / result.seconds / (1024.0 * 1024.0) : 0.0;
+		result.p50 = percentile(latencies, 50.0);
+		result.p99 = percentile(latencies, 99.0);
+		result.p999 = percentile(latencies, 99.9);
+		result.max = latencies.empty() ? 0.0 : latencies.back() / 1000.0;
+
+		poco_information(logger(), Poco::format("%d/%d jobs in %.3f s: %.1f msgs/s, %.2f MB/s",
+			result.received, result.sent, result.seconds, result.messagesPerSecond, result.megabytesPerSecond));
+		poco_information(logger(), Poco::format("latency us: p50 %.1f, p99 %.1f, p99.9 %.1f, max %.1f",
+			result.p50, result.p99, result.p999, result.max));
+
+		writeCsv(config().getString("application.bench.output.csv", DEFAULT_BENCH_CSV), settings, result);
+		writeJson(config().getString("application.bench.output.json", DEFAULT_BENCH_JSON), settings, result);
+	}
+}
+
+void AppPushPullBench::runCodecBench(const BenchSettings& settings)
+{
+	int iterations = std::max(1, config().getInt("application.bench.codec.iterations", DEFAULT_CODEC_ITERATIONS));
+
+	// a random walk stands in for a scanned surface, neighbouring points are close to each other
+	JobLayout layout(settings.points, settings.doubles, settings.flags);
+	vector<double> plain((layout.size() + sizeof(double) - 1) / sizeof(double));
+	void* frame = plain.data();
+	JobHeader* header = layout.writeHeader(frame);
+	std::mt19937 random(42);
+	std::normal_distribution<double> step(0.0, 0.001);
+	Point3d p{ 1.0, 2.0, 3.0 };
+	DoubleStream streams[3];
+	pointStreams(static_cast<double*>(frame) + header->points.offset / sizeof(double), settings.points, settings.flags, streams);
+	for (uint32_t i = 0; i < settings.points; ++i)
+	{
+		p.x += step(random);
+		p.y += step(random);
+		p.z += step(random);
+		streams[0].data[i * streams[0].stride] = p.x;
+		streams[1].data[i * streams[1].stride] = p.y;
+		streams[2].data[i * streams[2].stride] = p.z;
+	}
+	double* dvector = layout.doubles(frame);
+	for (uint32_t i = 0; i < settings.doubles; ++i)
+		dvector[i] = 0.5 * i + step(random);
+
+	const JobCodec codecs[] = { JobCodec::Identity, JobCodec::XorDelta, JobCodec::Deflate };
+	for (JobCodec codec : codecs)
+	{
+		if (!_stateQueue.empty())
+			break;
+
+		std::vector<unsigned char> encoded;
+		Poco::Timestamp started;
+		for (int i = 0; i < iterations; ++i)
+			encodeJob(frame, codec, encoded);
+		double encodeSeconds = started.elapsed() / 1e6;
+
+		// decode through JobView like a receiver does, the frame refers to the encoded bytes without copying them
+		vector<double> decoded;
+		started.update();
+		for (int i = 0; i < iterations; ++i)
+		{
+			zmq::multipart_t msgIncoming;
+			msgIncoming.add(zmq::message_t(encoded.data(), encoded.size(), nullptr, nullptr));
+			JobView job(std::move(msgIncoming), &decoded);
+			if (job.points().size() != settings.points)
+				throw Poco::DataFormatException("codec bench", "decoded a different job");
+		}
+		double decodeSeconds = started.elapsed() / 1e6;
+
+		CodecResult result;
+		result.codec = jobCodecName(codec);
+		result.plainBytes = layout.size();
+		result.encodedBytes = encoded.size();
+		result.ratio = (double)layout.size() / encoded.size();
+		result.encodeGigabytesPerSecond = encodeSeconds > 0 ? (double)layout.size() * iterations / encodeSeconds / 1e9 : 0.0;
+		result.decodeGigabytesPerSecond = decodeSeconds > 0 ? (double)layout.size() * iterations / decodeSeconds / 1e9 : 0.0;
+		poco_information(logger(), Poco::format("%s: %z -> %z bytes, ratio %.2f, encode %.3f GB/s, decode %.3f GB/s",
+			string(result.codec), result.plainBytes, result.encodedBytes, result.ratio,
+			result.encodeGigabytesPerSecond, result.decodeGigabytesPerSecond));
+		writeCodecCsv(config().getString("application.bench.output.codec", DEFAULT_CODEC_CSV), settings, result);
+	}
+}
+
+void AppPushPullBench::writeCodecCsv(const string& path, const BenchSettings& settings, const CodecResult& result)
+{
+	if (path.empty())
+		return;
+
+	bool header = !Poco::File(path).exists();
+	std::ofstream csv(path, std::ios::app);
+	if (!csv)
+	{
+		poco_error(logger(), "Failed to open " + path);
+		return;
+	}
+	if (header)
+		csv << "time,label,codec,layout,points,doubles,plain_bytes,encoded_bytes,ratio,encode_gb_per_s,decode_gb_per_s\n";
+	csv << Poco::DateTimeFormatter::format(Poco::Timestamp(), Poco::DateTimeFormat::ISO8601_FORMAT) << ','
+		<< '"' << Poco::replace(config().getString("application.bench.label", ""), "\"", "\"\"") << "\","
+		<< result.codec << ','
+		<< ((settings.flags & JOB_FLAG_SOA) ? "soa" : "aos") << ','
+		<< settings.points << ',' << settings.doubles << ','
+		<< result.plainBytes << ',' << result.encodedBytes << ',' << result.ratio << ','
+		<< result.encodeGigabytesPerSecond << ',' << result.decodeGigabytesPerSecond << '\n';
+}
+
+void AppPushPullBench::writeCsv(const string& path, const BenchSettings& settings, const BenchResult& result)
+{
+	if (path.empty())
+		return;
+
+	// runs are appended, so results of different builds end up side by side
+	bool header = !Poco::File(path).exists();
+	std::ofstream csv(path, std::ios::app);
+	if (!csv)
+	{
+		poco_error(logger(), "Failed to open " + path);
+		return;
+	}
+	if (header)
+		csv << "time,label,transport,codec,layout,points,doubles,job_bytes,workers,batch,sent,received,seconds,msgs_per_s,mb_per_s,p50_us,p99_us,p999_us,max_us\n";
+	csv << Poco::DateTimeFormatter::format(Poco::Timestamp(), Poco::DateTimeFormat::ISO8601_FORMAT) << ','
+		<< '"' << Poco::replace(config().getString("application.bench.label", ""), "\"", "\"\"") << "\","
+		<< settings.transport << ','
+		<< jobCodecName(settings.codec) << ','
+		<< ((settings.flags & JOB_FLAG_SOA) ? "soa" : "aos") << ','
+		<< settings.points << ',' << settings.doubles << ',' << result.jobBytes << ','
+		<< settings.workers << ',' << settings.batch << ','
+		<< result.sent << ',' << result.received << ',' << result.seconds << ','
+		<< result.messagesPerSecond << ',' << result.megabytesPerSecond << ','
+		<< result.p50 << ',' << result.p99 << ',' << result.p999 << ',' << result.max << '\n';
+	poco_information(logger(), "results appended to " + path);
+}
+
+void AppPushPullBench::writeJson(const string& path, const BenchSettings& settings, const BenchResult& result)
+{
+	if (path.empty())
+		return;
+
+	std::ofstream json(path, std::ios::trunc);
+	if (!json)
+	{
+		poco_error(logger(), "Failed to open " + path);
+		return;
+	}
+	// the label is free text, keep the JSON valid whatever it holds
+	string label;
+	for (char c : config().getString("application.bench.label", ""))
+	{
+		if (c == '"' || c == '\\')
+			label += '\\';
+		if ((unsigned char)c >= 0x20)
+			label += c;
+	}
+	json << "{\n"
+		<< "  \"time\": \"" << Poco::DateTimeFormatter::format(Poco::Timestamp(), Poco::DateTimeFormat::ISO8601_FORMAT) << "\",\n"
+		<< "  \"label\": \"" << label << "\",\n"
+		<< "  \"settings\": {\n"
+		<< "    \"transport\": \"" << settings.transport << "\",\n"
+		<< "    \"endpoint\": \"" << settings.endpoint << "\",\n"
+		<< "    \"codec\": \"" << jobCodecName(settings.codec) << "\",\n"
+		<< "    \"layout\": \"" << ((settings.flags & JOB_FLAG_SOA) ? "soa" : "aos") << "\",\n"
+		<< "    \"points\": " << settings.points << ",\n"
+		<< "    \"doubles\": " << settings.doubles << ",\n"
+		<< "    \"workers\": " << settings.workers << ",\n"
+		<< "    \"batch\": " << settings.batch << ",\n"
+		<< "    \"messages\": " << settings.messages << "\n"
+		<< "  },\n"
+		<< "  \"results\": {\n"
+		<< "    \"job_bytes\": " << result.jobBytes << ",\n"
+		<< "    \"received\": " << result.received << ",\n"
+		<< "    \"seconds\": " << result.seconds << ",\n"
+		<< "    \"msgs_per_s\": " << result.messagesPerSecond << ",\n"
+		<< "    \"mb_per_s\": " << result.megabytesPerSecond << ",\n"
+		<< "    \"latency_us\": { \"p50\": " << result.p50 << ", \"p99\": " << result.p99
+		<< ", \"p99.9\": " << result.p999 << ", \"max\": " << result.max << " }\n"
+		<< "  }\n"
+		<< "}\n";
+	poco_information(logger(), "results written to " + path);
+}
+
+bool AppPushPullBench::helpRequested()
+{
+	return _helpRequested;
+}
+
+void AppPushPullBench::terminate()
+{
+	_stateQueue.enqueueUrgentNotification(new Event_TerminateRequest);
+}
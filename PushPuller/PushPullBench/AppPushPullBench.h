@@ -0,0 +1,78 @@
+﻿#pragma once
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <Poco/Util/Application.h>
+#include <Poco/Util/OptionSet.h>
+#include <Poco/Event.h>
+#include <Poco/Notification.h>
+#include <Poco/NotificationQueue.h>
+
+struct BenchSettings;
+
+// outcome of one benchmark run, latencies are in microseconds
+struct BenchResult
+{
+	int sent;
+	int received;
+	uint64_t jobBytes;
+	double seconds;
+	double messagesPerSecond;
+	double megabytesPerSecond;
+	double p50;
+	double p99;
+	double p999;
+	double max;
+};
+
+// outcome of one codec in the codec benchmark
+struct CodecResult
+{
+	const char* codec;
+	std::size_t plainBytes;
+	std::size_t encodedBytes;
+	double ratio;
+	double encodeGigabytesPerSecond;
+	double decodeGigabytesPerSecond;
+};
+
+class AppPushPullBench: public Poco::Util::Application
+{
+private:
+	// for handling Ctrl+C and terminate request
+	static Poco::Event _eventTerminated;
+	static BOOL __stdcall ConsoleCtrlHandler(DWORD ctrlType);
+	// for the help request by user
+	bool _helpRequested{ false };
+	void handleHelp(const std::string& name, const std::string& value);
+	// -D name=value overrides application.name from the configuration file
+	void handleDefine(const std::string& name, const std::string& value);
+	// for events handle by state machine
+	static Poco::NotificationQueue _stateQueue;
+	// send jobs from one task to a pool of receivers and measure throughput and latency
+	void runTransportBench(const BenchSettings& settings, int iothreads, long timeout);
+	// encode and decode one synthetic job with every codec, no transport involved
+	void runCodecBench(const BenchSettings& settings);
+	void writeCodecCsv(const std::string& path, const BenchSettings& settings, const CodecResult& result);
+	// append the run to the CSV file and write it as the JSON file, an empty path skips the file
+	void writeCsv(const std::string& path, const BenchSettings& settings, const BenchResult& result);
+	void writeJson(const std::string& path, const BenchSettings& settings, const BenchResult& result);
+
+protected:
+	void initialize(Poco::Util::Application& self);
+	void uninitialize();
+	void defineOptions(Poco::Util::OptionSet& options);
+	int main(const ArgVec& args);
+
+public:
+	AppPushPullBench() {};
+	bool helpRequested();
+	static void terminate();
+};
+
+class Event_TerminateRequest : public Poco::Notification
+{
+public:
+	Event_TerminateRequest() {}
+};
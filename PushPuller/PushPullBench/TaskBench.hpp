@@ -0,0 +1,279 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <Poco/Task.h>
+#include <Poco/Logger.h>
+#include <Poco/Event.h>
+#include <Poco/Format.h>
+#include <zmq_addon.hpp>
+#include "JobTypes.h"
+#include "JobFormat.hpp"
+#include "JobCodec.hpp"
+#include "JobView.hpp"
+#include "JobReader.hpp"
+#include "JobBuilder.hpp"
+#include "JobHandoff.hpp"
+#include "JobRing.hpp"
+#include "BufferPool.hpp"
+
+using std::string;
+using std::vector;
+
+// settings of one benchmark run
+struct BenchSettings
+{
+	// inproc, ipc or tcp, handoff to pass job objects by pointer over inproc,
+	// or shm to write the jobs to a shared memory ring and send descriptors over tcp
+	string transport;
+	string endpoint;
+	uint32_t points;
+	uint32_t doubles;
+	// JOB_FLAG_SOA to send the points as lanes
+	uint32_t flags;
+	// codec of the payload sections, the encoding is part of the measured latency
+	JobCodec codec;
+	int messages;
+	// maximum number of jobs a receiver drains per wakeup
+	int batch;
+	int workers;
+	// bytes of the shared memory ring of the shm transport
+	std::size_t shmSize;
+};
+
+// progress of a run shared by the sender and all receivers
+struct BenchProgress
+{
+	std::atomic<uint64_t> firstSend{ 0 };
+	// when the last job was received
+	std::atomic<uint64_t> lastReceive{ 0 };
+	std::atomic<int> received{ 0 };
+	std::atomic<bool> failed{ false };
+	// manual reset, set once every job arrived or a task failed
+	Poco::Event done{ false };
+};
+
+// sends settings.messages single-frame jobs as fast as the socket takes them,
+// every job is stamped with jobClock() right before it is sent, with the shm
+// transport it waits for the receivers to release a region when the ring is full
+class TaskBenchPush : public Poco::Task
+{
+private:
+	Poco::Logger& _logger;
+	zmq::context_t& _context;
+	// owned by the caller and declared before the context
+	BufferPool& _pool;
+	const BenchSettings& _settings;
+	BenchProgress& _progress;
+	// lays out every job like PushWorker does, in the transport of the run
+	JobBuilder _builder;
+
+	// the same values in every layout, x is the job number and y the index of the point
+	void fill(int job)
+	{
+		double* x = _builder.x();
+		double* y = _builder.y();
+		double* z = _builder.z();
+		const std::size_t step = _builder.step();
+		for (uint32_t i = 0; i < _settings.points; ++i)
+		{
+			x[i * step] = job;
+			y[i * step] = i;
+			z[i * step] = -job;
+		}
+		double* dvector = _builder.doubles();
+		for (uint32_t i = 0; i < _settings.doubles; ++i)
+			dvector[i] = i;
+	}
+
+public:
+
+	TaskBenchPush(zmq::context_t& context, BufferPool& pool, const BenchSettings& settings, BenchProgress& progress)
+		: Task("BenchPusher")
+		, _logger(Poco::Logger::get("BenchPusher"))
+		, _context(context)
+		, _pool(pool)
+		, _settings(settings)
+		, _progress(progress)
+		, _builder(settings.transport == "handoff" ? JobFormat::Handoff : JobFormat::SingleFrame, (settings.flags & JOB_FLAG_SOA) != 0, settings.codec)
+	{
+	}
+
+	void runTask()
+	{
+		zmq::socket_t pusher(_context, zmq::socket_type::push);
+		// a blocked send gives up now and then to check for cancellation
+		int timeout = 100;
+		pusher.setsockopt(ZMQ_SNDTIMEO, &timeout, sizeof(timeout));
+		std::unique_ptr<JobRingWriter> ring;
+		try
+		{
+			pusher.bind(_settings.endpoint);
+			// the receivers of a run release every job, the lease only matters when one fails
+			if (_settings.transport == "shm")
+				ring.reset(new JobRingWriter("pushpull-bench", _settings.shmSize, 60000));
+		}
+		catch (std::exception &e)
+		{
+			poco_error(_logger, "Failed to bind to " + _settings.endpoint + ": " + std::string(e.what()));
+			_progress.failed = true;
+			_progress.done.set();
+			return;
+		}
+
+		const std::size_t size = _builder.layout(_settings.points, _settings.doubles).size();
+		for (int job = 0; job < _settings.messages && !isCancelled(); ++job)
+		{
+			try
+			{
+				JobRingDescriptor shared;
+				if (ring)
+				{
+					void* data = nullptr;
+					while (!(data = ring->allocate(size, shared)) && !isCancelled())
+						std::this_thread::yield();
+					if (!data)
+						break;
+					_builder.begin(*ring, data, shared, _settings.points, _settings.doubles);
+				}
+				else
+					_builder.begin(_pool, _settings.points, _settings.doubles);
+				fill(job);
+				// the encoding in finish() is part of the measured latency
+				JobHeader* header = _builder.header();
+				header->sendTime = jobClock();
+				if (job == 0)
+					_progress.firstSend = header->sendTime;
+				zmq::multipart_t msgJob = _builder.finish(_pool, job);
+
+				// blocks while the receivers are at their high water mark; every job of the bench is a
+				// single frame, and a send that timed out leaves it as it was to be sent again
+				zmq::message_t frameJob = msgJob.pop();
+				bool sent = false;
+				while (!(sent = pusher.send(frameJob)) && !isCancelled())
+					continue;
+				// a job given up on cancellation hands its region of the ring back
+				if (!sent && ring)
+					ring->discard(shared);
+			}
+			catch (std::exception &e)
+			{
+				poco_error(_logger, "outgoing error: " + std::string(e.what()));
+				_progress.failed = true;
+				_progress.done.set();
+				return;
+			}
+
+			if ((job + 1) % 1024 == 0)
+				setProgress((float)(job + 1) / _settings.messages);
+		}
+
+		// keep the socket until the jobs in flight are received
+		while (!_progress.done.tryWait(100) && !isCancelled())
+			continue;
+	}
+};
+
+// receives jobs, decodes them in place and records the latency of every job
+class TaskBenchPull : public Poco::Task
+{
+private:
+	Poco::Logger& _logger;
+	zmq::context_t& _context;
+	const BenchSettings& _settings;
+	BenchProgress& _progress;
+	// nanoseconds from send to decoded, reserved up front to keep the loop free of allocations
+	vector<uint64_t> _latencies;
+	uint64_t _bytes;
+	// reads every job like PullWorker does, from the ring as well with the shm transport
+	JobReader _reader;
+
+	void record(const JobView& job)
+	{
+		uint64_t now = jobClock();
+		if (_latencies.size() < _latencies.capacity())
+			_latencies.push_back(now - job.header().sendTime);
+		_bytes += job.bytes();
+	}
+
+public:
+
+	TaskBenchPull(zmq::context_t& context, const BenchSettings& settings, BenchProgress& progress, int id)
+		: Task("BenchPuller#" + std::to_string(id))
+		, _logger(Poco::Logger::get("BenchPuller"))
+		, _context(context)
+		, _settings(settings)
+		, _progress(progress)
+		, _bytes(0)
+	{
+		_latencies.reserve(settings.messages);
+	}
+
+	const vector<uint64_t>& latencies() const
+	{
+		return _latencies;
+	}
+
+	uint64_t bytes() const
+	{
+		return _bytes;
+	}
+
+	void runTask()
+	{
+		zmq::socket_t puller(_context, zmq::socket_type::pull);
+		try
+		{
+			puller.connect(_settings.endpoint);
+		}
+		catch (std::exception &e)
+		{
+			poco_error(_logger, "Failed to connect to " + _settings.endpoint + ": " + std::string(e.what()));
+			_progress.failed = true;
+			_progress.done.set();
+			return;
+		}
+
+		zmq::pollitem_t items[] = { { puller, 0, ZMQ_POLLIN, 0 } };
+		while (!isCancelled())
+		{
+			try
+			{
+				zmq::poll(items, 1, 100);
+				if (!(items[0].revents & ZMQ_POLLIN))
+					continue;
+
+				for (int n = 0; n < _settings.batch; ++n)
+				{
+					zmq::multipart_t msgIncoming;
+					if (!msgIncoming.recv(puller, ZMQ_DONTWAIT))
+						break;
+
+					try
+					{
+						// only the pusher of this process hands objects over, on an inproc endpoint
+						_reader.read(std::move(msgIncoming), _settings.transport == "handoff", [this](const JobView& job) { record(job); });
+					}
+					catch (std::exception &e)
+					{
+						poco_debug(_logger, "invalid job: " + std::string(e.what()));
+					}
+
+					if (++_progress.received == _settings.messages)
+					{
+						_progress.lastReceive = jobClock();
+						_progress.done.set();
+					}
+				}
+			}
+			catch (std::exception &e)
+			{
+				poco_debug(_logger, "incoming error: " + std::string(e.what()));
+			}
+		}
+	}
+};
@@ -1,5 +1,7 @@
 ﻿#include <iostream>
 #include <string>
+#include <vector>
+#include <algorithm>
 #include <Poco/Util/Option.h>
 #include <Poco/Util/HelpFormatter.h>
 #include <Poco/ErrorHandler.h>
@@ -7,11 +9,14 @@
 #include <Poco/AsyncChannel.h>
 #include <Poco/ConsoleChannel.h>
 #include <Poco/TaskManager.h>
+#include <Poco/NObserver.h>
+#include <Poco/Format.h>
 #include <Poco/Notification.h>
 #include <Poco/NotificationQueue.h>
 #include "Poco/Util/AbstractConfiguration.h"
 #include "AppPushWorker.h"
 #include "TaskPush.hpp"
+#include "PushConfig.hpp"
 
 using std::string;
 using Poco::Util::Application;
@@ -23,7 +28,7 @@ using Poco::Util::AbstractConfiguration;
 using Poco::TaskManager;
 using Poco::Notification;
 
-#define DEFAULT_PUSHTO_ADDRESS "tcp://127.0.0.1:6866"
+#define DEFAULT_REPORT_INTERVAL 10000
 
 class TaskErrorHandler : public Poco::ErrorHandler
 {
@@ -113,13 +118,21 @@ int AppPushWorker::main(const ArgVec & args)
 		TaskErrorHandler newEH;
 		Poco::ErrorHandler* pOldEH = Poco::ErrorHandler::set(&newEH);
 
-		string pushto = config().getString("application.push.to", DEFAULT_PUSHTO_ADDRESS);
+		PushSettings settings = readPushSettings(config(), logger());
+		long reportInterval = config().getInt("application.push.report.interval", DEFAULT_REPORT_INTERVAL);
+
 		TaskManager taskmanager;
-		taskmanager.start(new TaskPush(pushto));
+		taskmanager.addObserver(Poco::NObserver<AppPushWorker, Poco::TaskFinishedNotification>(*this, &AppPushWorker::onTaskFinished));
+		// the task manager takes one reference, the other one keeps the counters readable
+		Poco::AutoPtr<TaskPush> pPush = new TaskPush(settings);
+		taskmanager.start(pPush.duplicate());
 
+		PushStatsSnapshot lastStats{ 0, 0, 0, 0, 0, 0, 0, 0 };
 		for (;;)
 		{
-			Notification::Ptr pNotify(_stateQueue.waitDequeueNotification());
+			Notification::Ptr pNotify(reportInterval > 0
+				? _stateQueue.waitDequeueNotification(reportInterval)
+				: _stateQueue.waitDequeueNotification());
 			if (pNotify)
 			{
 				// no terminating state, check the event here and exist right away
@@ -129,6 +142,12 @@ int AppPushWorker::main(const ArgVec & args)
 					break;
 				}
 			}
+			else if (reportInterval > 0)
+			{
+				reportStats(pPush->stats(), settings.load, lastStats, reportInterval);
+				if (settings.keyed)
+					reportLoad(pPush->takeLoad(), reportInterval);
+			}
 			else
 				break;
 		}
@@ -156,6 +175,98 @@ int AppPushWorker::main(const ArgVec & args)
 	return Application::EXIT_OK;
 }
 
+void AppPushWorker::reportStats(const PushStats& stats, const LoadSettings& load, PushStatsSnapshot& last, long interval)
+{
+	PushStatsSnapshot now{ stats.sent.load(), stats.stallMicroseconds.load(), stats.chunks.load(), stats.generated.load(), stats.late.load(),
+		stats.bytes.load(), stats.batches.load(), stats.batched.load(), stats.make.snapshot(), stats.queueWait.snapshot() };
+	double seconds = interval / 1000.0;
+	poco_information(logger(), Poco::format("%.1f jobs/s, %.2f MB/s, %Lu queued, %Ld credits, %.1f%% stalled, %Lu sent, %Lu dropped, %Lu errors",
+		(now.sent - last.sent) / seconds,
+		(now.bytes - last.bytes) / seconds / (1024.0 * 1024.0),
+		(Poco::UInt64)stats.queued.load(),
+		(Poco::Int64)stats.credits.load(),
+		(now.stallMicroseconds - last.stallMicroseconds) / (interval * 10.0),
+		(Poco::UInt64)now.sent,
+		(Poco::UInt64)stats.dropped.load(),
+		(Poco::UInt64)stats.errors.load()));
+	if (now.batches > last.batches)
+	{
+		poco_information(logger(), Poco::format("%.1f batches/s of %.1f jobs on average, %.1f%% of the jobs batched",
+			(now.batches - last.batches) / seconds,
+			(double)(now.batched - last.batched) / (now.batches - last.batches),
+			(now.sent > last.sent) ? (now.batched - last.batched) * 100.0 / (now.sent - last.sent) : 0.0));
+	}
+	// latencies of the jobs since the last report, the histograms only count jobs that were made or queued
+	LatencySnapshot make = now.make.since(last.make);
+	if (make.count > 0)
+	{
+		poco_information(logger(), "make: " + latencyText(make));
+	}
+	LatencySnapshot queueWait = now.queueWait.since(last.queueWait);
+	if (queueWait.count > 0)
+	{
+		poco_information(logger(), "queue wait: " + latencyText(queueWait));
+	}
+	if (load.rate > 0)
+	{
+		// the schedule does not wait for the pullers, a growing lag is the saturation point
+		double lag = stats.lagMicroseconds.load() / 1000.0;
+		string text = Poco::format("load: %.1f jobs/s made, last job %.1f ms behind schedule, %Lu late jobs since the last report, %Lu in total",
+			(now.generated - last.generated) / seconds,
+			lag,
+			(Poco::UInt64)(now.late - last.late),
+			(Poco::UInt64)now.late);
+		if (lag > load.lagThreshold)
+		{
+			poco_warning(logger(), text);
+		}
+		else
+		{
+			poco_information(logger(), text);
+		}
+	}
+	if (stats.shared.load() > 0 || stats.sharedFull.load() > 0)
+	{
+		poco_information(logger(), Poco::format("%Lu jobs in shared memory, %Lu sent inline with the ring full, %.2f MB held by pullers, %Lu leases expired",
+			(Poco::UInt64)stats.shared.load(),
+			(Poco::UInt64)stats.sharedFull.load(),
+			stats.sharedUsed.load() / (1024.0 * 1024.0),
+			(Poco::UInt64)stats.sharedExpired.load()));
+	}
+	if (now.chunks > 0)
+	{
+		poco_information(logger(), Poco::format("%.1f chunks/s of streamed jobs, %Lu chunks sent, %Lu sent again after a full pipe",
+			(now.chunks - last.chunks) / seconds,
+			(Poco::UInt64)now.chunks,
+			(Poco::UInt64)stats.retried.load()));
+	}
+	last = now;
+}
+
+void AppPushWorker::reportLoad(const std::vector<WorkerLoad>& load, long interval)
+{
+	uint64_t total = 0;
+	for (const WorkerLoad& worker : load)
+		total += worker.jobs;
+	double seconds = interval / 1000.0;
+	for (const WorkerLoad& worker : load)
+	{
+		poco_information(logger(), Poco::format("worker %s: %.1f jobs/s, %.1f%% of all jobs, %Lu keys, hottest key %Lu with %.1f%% of its jobs",
+			worker.identity,
+			worker.jobs / seconds,
+			total ? 100.0 * worker.jobs / total : 0.0,
+			(Poco::UInt64)worker.keys,
+			(Poco::UInt64)worker.hotKey,
+			worker.jobs ? 100.0 * worker.hotKeyJobs / worker.jobs : 0.0));
+	}
+}
+
+void AppPushWorker::onTaskFinished(const Poco::AutoPtr<Poco::TaskFinishedNotification>& pNotify)
+{
+	poco_information(logger(), "pusher finished -> terminate");
+	terminate();
+}
+
 bool AppPushWorker::helpRequested()
 {
 	return _helpRequested;
@@ -1,10 +1,33 @@
 ﻿#pragma once
 #include <string>
+#include <vector>
+#include <cstdint>
 #include <Poco/Util/Application.h>
 #include <Poco/Util/OptionSet.h>
 #include <Poco/Event.h>
 #include <Poco/Notification.h>
 #include <Poco/NotificationQueue.h>
+#include <Poco/TaskNotification.h>
+#include "LatencyHistogram.hpp"
+
+struct PushStats;
+struct WorkerLoad;
+struct LoadSettings;
+
+// counters of the pusher as seen at the last report
+struct PushStatsSnapshot
+{
+	uint64_t sent;
+	uint64_t stallMicroseconds;
+	uint64_t chunks;
+	uint64_t generated;
+	uint64_t late;
+	uint64_t bytes;
+	uint64_t batches;
+	uint64_t batched;
+	LatencySnapshot make;
+	LatencySnapshot queueWait;
+};
 
 class AppPushWorker: public Poco::Util::Application
 {
@@ -17,6 +40,12 @@ private:
 	void handleHelp(const std::string& name, const std::string& value);
 	// for events handle by state machine
 	static Poco::NotificationQueue _stateQueue;
+	// log the send rate, queue depth, stall time and latencies since the last report, and how far an open-loop load is behind
+	void reportStats(const PushStats& stats, const LoadSettings& load, PushStatsSnapshot& last, long interval);
+	// log the share of the jobs and the hottest key of every worker since the last report
+	void reportLoad(const std::vector<WorkerLoad>& load, long interval);
+	// a load with a duration ends the application when it is done
+	void onTaskFinished(const Poco::AutoPtr<Poco::TaskFinishedNotification>& pNotify);
 
 protected:
 	void initialize(Poco::Util::Application& self);
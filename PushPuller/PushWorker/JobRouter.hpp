@@ -0,0 +1,329 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <Poco/Logger.h>
+#include <Poco/Format.h>
+#include <Poco/Mutex.h>
+#include <zmq_addon.hpp>
+#include "JobFormat.hpp"
+#include "JobStream.hpp"
+#include "JobHandoff.hpp"
+#include "JobRing.hpp"
+#include "JobBatch.hpp"
+#include "JobCredit.hpp"
+#include "HashRing.hpp"
+
+// jobs a worker received since the last report and the key it received most of them for
+struct WorkerLoad
+{
+	std::string identity;
+	uint64_t jobs;
+	uint64_t keys;
+	uint64_t hotKey;
+	uint64_t hotKeyJobs;
+};
+
+// Sends jobs either round-robin over a PUSH socket, or with keyed routing over
+// a ROUTER socket to the worker that owns the key of the job on a consistent
+// hash ring. Workers join the ring with JOB_ROUTE_HELLO from their DEALER socket
+// and leave it with JOB_ROUTE_BYE, or when the router finds them unreachable.
+// With credit-based flow control the jobs go over a ROUTER socket as well, every
+// worker is sent only as many jobs as it granted credit for; without keyed routing
+// the next job goes to the worker with the most credit left.
+class JobRouter
+{
+private:
+	struct LoadCounters
+	{
+		uint64_t jobs;
+		std::unordered_map<uint64_t, uint64_t> keys;
+	};
+
+	// see JobCredit.hpp, the credit left is limit - sent
+	struct WorkerCredit
+	{
+		uint64_t epoch;
+		uint64_t limit;
+		uint64_t sent;
+	};
+
+	Poco::Logger& _logger;
+	const bool _keyed;
+	const bool _credited;
+	// credit of a worker is capped at this, whatever window it grants
+	const int64_t _creditMax;
+	HashRing _ring;
+	std::unordered_map<std::string, WorkerCredit> _credit;
+	// written by the pushing task, taken by the reporter
+	Poco::FastMutex _mutex;
+	std::map<std::string, LoadCounters> _load;
+
+	void count(const std::string& identity, uint64_t key)
+	{
+		Poco::FastMutex::ScopedLock lock(_mutex);
+		LoadCounters& load = _load[identity];
+		++load.jobs;
+		++load.keys[key];
+	}
+
+	void join(const std::string& identity)
+	{
+		if (_ring.add(identity))
+		{
+			poco_information(_logger, Poco::format("worker %s joined, %z workers", identity, _ring.size()));
+		}
+	}
+
+	void leave(const std::string& identity, const char* reason)
+	{
+		if (_ring.remove(identity))
+		{
+			poco_information(_logger, Poco::format("worker %s left (%s), %z workers", identity, std::string(reason), _ring.size()));
+		}
+		// its jobs in flight are lost with it, a worker that comes back grants its window again
+		if (_credit.erase(identity) && !_keyed)
+		{
+			poco_information(_logger, Poco::format("worker %s left (%s), %z workers", identity, std::string(reason), _credit.size()));
+		}
+	}
+
+	int64_t creditOf(const WorkerCredit& worker) const
+	{
+		return std::min<int64_t>((int64_t)(worker.limit - worker.sent), _creditMax);
+	}
+
+	// the worker with the most credit left, empty if there is none
+	std::string richest() const
+	{
+		std::string identity;
+		int64_t most = 0;
+		for (const auto& worker : _credit)
+		{
+			int64_t credit = creditOf(worker.second);
+			if (credit > most)
+			{
+				most = credit;
+				identity = worker.first;
+			}
+		}
+		return identity;
+	}
+
+public:
+
+	JobRouter(bool keyed, int replicas, bool credited = false, int creditMax = 0)
+		: _logger(Poco::Logger::get("Router"))
+		, _keyed(keyed)
+		, _credited(credited)
+		, _creditMax(std::max(1, creditMax))
+		, _ring(replicas)
+	{
+	}
+
+	bool keyed() const
+	{
+		return _keyed;
+	}
+
+	// true if the jobs are addressed to the workers over a ROUTER socket, the workers may send commands on it
+	bool addressed() const
+	{
+		return _keyed || _credited;
+	}
+
+	zmq::socket_type socketType() const
+	{
+		return addressed() ? zmq::socket_type::router : zmq::socket_type::push;
+	}
+
+	// call before binding the socket
+	void configure(zmq::socket_t& socket)
+	{
+		if (addressed())
+		{
+			// a job for a worker that is gone raises EHOSTUNREACH instead of being dropped silently
+			int raiseIfUnroutable = 1;
+			socket.setsockopt(ZMQ_ROUTER_MANDATORY, &raiseIfUnroutable, sizeof(raiseIfUnroutable));
+		}
+	}
+
+	// handle the commands of the workers queued on the socket, nothing to do over a PUSH socket
+	void receive(zmq::socket_t& socket)
+	{
+		if (!addressed())
+			return;
+
+		zmq::multipart_t msgIncoming;
+		while (msgIncoming.recv(socket, ZMQ_DONTWAIT))
+		{
+			// the first frame is the worker identity appended by the router socket
+			std::string identity = msgIncoming.popstr();
+			std::string command = msgIncoming.empty() ? std::string() : msgIncoming.popstr();
+			if (command == JOB_ROUTE_HELLO && _keyed)
+				join(identity);
+			else if (command == JOB_ROUTE_BYE)
+				leave(identity, "bye");
+			else
+				poco_debug(_logger, "unknown command from worker " + identity);
+			msgIncoming.clear();
+		}
+	}
+
+	// take a credit grant received on the back channel
+	void grant(const zmq::message_t& frame)
+	{
+		JobCreditGrant grant;
+		std::string identity;
+		if (!readCreditGrant(frame, grant, identity))
+		{
+			poco_debug(_logger, "invalid credit grant");
+			return;
+		}
+		auto known = _credit.find(identity);
+		if (known == _credit.end() || known->second.epoch != grant.epoch)
+		{
+			// a worker new to this pusher, or restarted, may be sent its window
+			bool joined = (known == _credit.end());
+			_credit[identity] = WorkerCredit{ grant.epoch, grant.limit, grant.limit - grant.window };
+			if (joined && !_keyed)
+			{
+				poco_information(_logger, Poco::format("worker %s joined, %z workers", identity, _credit.size()));
+			}
+		}
+		else
+			known->second.limit = std::max(known->second.limit, grant.limit);
+	}
+
+	// the most credit a single worker has left, the most jobs the next message may carry
+	int64_t credit() const
+	{
+		int64_t most = 0;
+		for (const auto& worker : _credit)
+			most = std::max(most, creditOf(worker.second));
+		return most;
+	}
+
+	// the credit left over all workers
+	int64_t credits() const
+	{
+		int64_t total = 0;
+		for (const auto& worker : _credit)
+			total += creditOf(worker.second);
+		return total;
+	}
+
+	// true if a job can be routed at all
+	bool ready() const
+	{
+		if (_keyed)
+			return !_ring.empty();
+		return !_credited || !_credit.empty();
+	}
+
+	// send the frames of msg without blocking, behind the identity of a worker if there is one;
+	// multipart_t::send destroys a frame the socket refused, so the first frame is sent here and put
+	// back if it is refused, msg is then as it was. A socket that took the first frame of a message
+	// takes the others as well
+	static bool sendFrames(zmq::socket_t& socket, zmq::multipart_t& msg, const std::string* identity)
+	{
+		if (identity && !socket.send(zmq::message_t(identity->data(), identity->size()), ZMQ_SNDMORE | ZMQ_DONTWAIT))
+			return false;
+		zmq::message_t first = msg.pop();
+		if (!socket.send(first, (msg.empty() ? 0 : ZMQ_SNDMORE) | ZMQ_DONTWAIT))
+		{
+			// the router does not refuse a frame after the identity, a message cannot be taken back halfway
+			if (identity)
+				throw zmq::error_t();
+			msg.push(std::move(first));
+			return false;
+		}
+		return msg.send(socket, ZMQ_DONTWAIT);
+	}
+
+	// send a job without blocking, false if no worker took it, the job frames are then still in msg;
+	// with flow control it is sent only to a worker with credit for all of its jobs
+	bool send(zmq::socket_t& socket, zmq::multipart_t& msg)
+	{
+		if (!addressed())
+			return sendFrames(socket, msg, nullptr);
+
+		// the chunks of a streamed job count as one job, the last one
+		bool complete = true;
+		uint64_t key = 0;
+		if (msg.size() == 1 && isJobObject(msg.peek(0)->data(), msg.peek(0)->size()))
+			key = jobObject(*msg.peek(0)).header.key;
+		else if (msg.size() == 1 && isRingDescriptor(msg.peek(0)->data(), msg.peek(0)->size()))
+		{
+			JobRingDescriptor shared;
+			std::memcpy(&shared, msg.peek(0)->data(), sizeof(shared));
+			key = shared.key;
+		}
+		else if (_keyed && msg.size() == 1)
+			key = routingKey(msg.peek(0)->data(), msg.peek(0)->size(), complete);
+		// a chunk of a streamed job costs one credit as well
+		const std::size_t jobs = batchedJobs(msg);
+		for (;;)
+		{
+			std::string identity = _keyed ? (_ring.empty() ? std::string() : _ring.lookup(key)) : richest();
+			if (identity.empty())
+				return false;
+			WorkerCredit* credit = nullptr;
+			if (_credited)
+			{
+				auto worker = _credit.find(identity);
+				if (worker == _credit.end() || creditOf(worker->second) < (int64_t)jobs)
+					return false;
+				credit = &worker->second;
+			}
+			try
+			{
+				// a worker whose pipe is full refuses the identity frame, the job stays in msg
+				if (!sendFrames(socket, msg, &identity))
+					return false;
+				if (credit)
+					credit->sent += jobs;
+				if (_keyed && complete)
+					count(identity, key);
+				return true;
+			}
+			catch (zmq::error_t &e)
+			{
+				if (e.num() != EHOSTUNREACH)
+					throw;
+				// the keys of the worker move to the next points on the ring, try the new owner
+				leave(identity, "unreachable");
+			}
+		}
+	}
+
+	// the load of every worker since the last call
+	std::vector<WorkerLoad> takeLoad()
+	{
+		std::map<std::string, LoadCounters> load;
+		{
+			Poco::FastMutex::ScopedLock lock(_mutex);
+			load.swap(_load);
+		}
+
+		std::vector<WorkerLoad> result;
+		for (const auto& worker : load)
+		{
+			WorkerLoad w{ worker.first, worker.second.jobs, worker.second.keys.size(), 0, 0 };
+			for (const auto& key : worker.second.keys)
+			{
+				if (key.second > w.hotKeyJobs)
+				{
+					w.hotKey = key.first;
+					w.hotKeyJobs = key.second;
+				}
+			}
+			result.push_back(w);
+		}
+		return result;
+	}
+};
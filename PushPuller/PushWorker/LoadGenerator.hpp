@@ -0,0 +1,136 @@
+#pragma once
+#include <string>
+#include <random>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <Poco/Exception.h>
+#include <Poco/Timestamp.h>
+
+enum class LoadArrivals : uint8_t
+{
+	// one job every 1 / rate seconds
+	Constant,
+	// exponential gaps with a mean of 1 / rate seconds
+	Poisson
+};
+
+enum class LoadSizes : uint8_t
+{
+	// every job has PushSettings::points points
+	Fixed,
+	// uniform between the minimum and the maximum
+	Uniform,
+	// log-normal around a median of PushSettings::points, clamped to the minimum and the maximum
+	LogNormal
+};
+
+// open-loop load: jobs are due at times drawn up front, whether or not the pullers keep up
+struct LoadSettings
+{
+	// jobs per second, 0 to send one job every PushSettings::interval
+	double rate;
+	LoadArrivals arrivals;
+	LoadSizes sizes;
+	uint32_t pointsMin;
+	uint32_t pointsMax;
+	// standard deviation of the logarithm of the points of log-normal sizes
+	double sigma;
+	// jobs per second during a burst, bursts of burstLength msec start every burstEvery msec, any of them 0 for no bursts
+	double burstRate;
+	long burstLength;
+	long burstEvery;
+	// milliseconds the load runs, 0 to run until terminated
+	long duration;
+	// a job made later than this many milliseconds after it was due counts as late
+	long lagThreshold;
+};
+
+// draws the arrival times and sizes of an open-loop load
+class LoadGenerator
+{
+private:
+	const LoadSettings _settings;
+	std::mt19937_64 _random;
+
+	// the rate at offset microseconds after the start
+	double rateAt(Poco::Timestamp::TimeDiff offset) const
+	{
+		if (_settings.burstRate > 0 && _settings.burstEvery > 0 && _settings.burstLength > 0
+			&& (offset / 1000) % _settings.burstEvery < _settings.burstLength)
+			return _settings.burstRate;
+		return _settings.rate;
+	}
+
+public:
+	explicit LoadGenerator(const LoadSettings& settings)
+		: _settings(settings)
+		, _random(std::random_device()())
+	{
+	}
+
+	bool active() const
+	{
+		return _settings.rate > 0;
+	}
+
+	const LoadSettings& settings() const
+	{
+		return _settings;
+	}
+
+	// microseconds from the arrival offset microseconds after the start to the next one
+	Poco::Timestamp::TimeDiff next(Poco::Timestamp::TimeDiff offset)
+	{
+		double rate = std::max(rateAt(offset), 1e-3);
+		double seconds = (_settings.arrivals == LoadArrivals::Poisson)
+			? std::exponential_distribution<double>(rate)(_random)
+			: 1.0 / rate;
+		// a gap of 0 would make the schedule stand still
+		return std::max<Poco::Timestamp::TimeDiff>(1, (Poco::Timestamp::TimeDiff)(seconds * 1e6));
+	}
+
+	// points of the next job, nominal is the fixed size and the median of log-normal sizes
+	uint32_t points(uint32_t nominal)
+	{
+		switch (_settings.sizes)
+		{
+		case LoadSizes::Uniform:
+			return std::uniform_int_distribution<uint32_t>(_settings.pointsMin, _settings.pointsMax)(_random);
+		case LoadSizes::LogNormal:
+		{
+			double drawn = std::lognormal_distribution<double>(std::log((double)nominal), _settings.sigma)(_random);
+			return (uint32_t)std::min<double>(std::max<double>(drawn, _settings.pointsMin), _settings.pointsMax);
+		}
+		default:
+			return nominal;
+		}
+	}
+
+	// true once the load ran for its duration
+	bool finished(const Poco::Timestamp& started) const
+	{
+		return _settings.duration > 0 && started.isElapsed((Poco::Timestamp::TimeDiff)_settings.duration * 1000);
+	}
+};
+
+// the arrivals and sizes by their names in the configuration, an unknown name is an error
+inline LoadArrivals loadArrivalsFromName(const std::string& name)
+{
+	if (name == "constant")
+		return LoadArrivals::Constant;
+	if (name == "poisson")
+		return LoadArrivals::Poisson;
+	throw Poco::InvalidArgumentException("load arrivals", name);
+}
+
+inline LoadSizes loadSizesFromName(const std::string& name)
+{
+	if (name == "fixed")
+		return LoadSizes::Fixed;
+	if (name == "uniform")
+		return LoadSizes::Uniform;
+	if (name == "lognormal")
+		return LoadSizes::LogNormal;
+	throw Poco::InvalidArgumentException("load sizes", name);
+}
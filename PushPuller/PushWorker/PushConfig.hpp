@@ -0,0 +1,212 @@
+#pragma once
+#include <string>
+#include <algorithm>
+#include <cmath>
+#include <climits>
+#include <Poco/Logger.h>
+#include <Poco/Format.h>
+#include <Poco/Exception.h>
+#include <Poco/Util/AbstractConfiguration.h>
+#include "TaskPush.hpp"
+
+#define DEFAULT_PUSHTO_ADDRESS "tcp://127.0.0.1:6866"
+#define DEFAULT_POOL_BUFFERS 16
+#define DEFAULT_PUSH_INTERVAL 1000
+#define DEFAULT_CREDIT_MAX 128
+#define DEFAULT_QUEUE_MAX 64
+#define DEFAULT_SPOOL_SIZE 64
+#define DEFAULT_ROUTING_REPLICAS 100
+#define DEFAULT_KEYS 64
+#define DEFAULT_POINTS 4
+#define DEFAULT_SHM_SIZE 256
+#define DEFAULT_SHM_MIN 64
+#define DEFAULT_SHM_LEASE 10000
+#define DEFAULT_LOAD_LAG 100
+#define DEFAULT_BATCH_MAX 1
+#define DEFAULT_BATCH_BYTES 64
+#define DEFAULT_BATCH_DELAY 200
+
+// read the push.* keys of the application section, shared by PushWorker and the in-process mode of PullWorker,
+// settings that do not go together are corrected with a warning
+inline PushSettings readPushSettings(const Poco::Util::AbstractConfiguration& config, Poco::Logger& logger)
+{
+	PushSettings settings;
+	settings.pushto = config.getString("application.push.to", DEFAULT_PUSHTO_ADDRESS);
+	settings.poolBuffers = config.getInt("application.push.pool.buffers", DEFAULT_POOL_BUFFERS);
+	// the multipart format is what PullWorkerCSharp understands
+	std::string format = config.getString("application.push.format", "multipart");
+	settings.format = (format == "single") ? JobFormat::SingleFrame : JobFormat::Multipart;
+	// point layout of single-frame jobs: aos (interleaved Point3d) or soa (x, y, z lanes)
+	bool soa = config.getString("application.push.layout", "aos") == "soa";
+	if (soa && settings.format != JobFormat::SingleFrame)
+	{
+		poco_warning(logger, "push.layout = soa requires push.format = single, sending interleaved points");
+	}
+	settings.soa = soa && settings.format == JobFormat::SingleFrame;
+	// codecs work on single-frame jobs, the header tells the receiver which one was used
+	settings.codec = JobCodec::Identity;
+	try
+	{
+		settings.codec = jobCodecFromName(config.getString("application.push.codec", "identity"));
+	}
+	catch (Poco::Exception& e)
+	{
+		poco_warning(logger, e.displayText() + ", sending jobs unencoded");
+	}
+	if (settings.codec != JobCodec::Identity && settings.format != JobFormat::SingleFrame)
+	{
+		poco_warning(logger, "push.codec requires push.format = single, sending jobs unencoded");
+		settings.codec = JobCodec::Identity;
+	}
+	settings.points = (uint32_t)std::max(1, config.getInt("application.push.points", DEFAULT_POINTS));
+	// chunks are a multiple of the job alignment, so the first one always holds the whole job header
+	std::size_t chunk = (std::size_t)std::max(0, config.getInt("application.push.stream.chunk", 0)) << 10;
+	settings.streamChunk = alignJob(chunk);
+	settings.interval = std::max(1, config.getInt("application.push.interval", DEFAULT_PUSH_INTERVAL));
+	// an open-loop load replaces push.interval, and push.points with a size distribution
+	LoadSettings& load = settings.load;
+	load.rate = std::max(0.0, config.getDouble("application.push.load.rate", 0.0));
+	load.arrivals = LoadArrivals::Constant;
+	load.sizes = LoadSizes::Fixed;
+	try
+	{
+		load.arrivals = loadArrivalsFromName(config.getString("application.push.load.arrivals", "constant"));
+		load.sizes = loadSizesFromName(config.getString("application.push.load.sizes", "fixed"));
+	}
+	catch (Poco::Exception& e)
+	{
+		poco_warning(logger, e.displayText() + ", using constant arrivals and fixed sizes");
+		load.arrivals = LoadArrivals::Constant;
+		load.sizes = LoadSizes::Fixed;
+	}
+	load.pointsMin = (uint32_t)std::max(1, config.getInt("application.push.load.points.min", 1));
+	load.sigma = std::max(0.0, config.getDouble("application.push.load.points.sigma", 1.0));
+	// the median of lognormal sizes is push.points, by default they are clamped only beyond the 99.9th percentile
+	int pointsMax = (int)settings.points;
+	if (load.sizes == LoadSizes::LogNormal)
+		pointsMax = (int)std::min<double>(INT_MAX, settings.points * std::exp(3.0 * load.sigma));
+	load.pointsMax = (uint32_t)std::max((int)load.pointsMin, config.getInt("application.push.load.points.max", pointsMax));
+	load.burstRate = std::max(0.0, config.getDouble("application.push.load.burst.rate", load.rate));
+	load.burstLength = std::max(0, config.getInt("application.push.load.burst.length", 0));
+	load.burstEvery = std::max(0, config.getInt("application.push.load.burst.every", 0));
+	load.duration = std::max(0, config.getInt("application.push.load.duration", 0)) * 1000L;
+	load.lagThreshold = std::max(0, config.getInt("application.push.load.lag", DEFAULT_LOAD_LAG));
+	if (load.rate > 0)
+	{
+		poco_information(logger, Poco::format("open-loop load of %.1f jobs/s, bursts of %.1f jobs/s for %ld of every %ld ms, %ld s",
+			load.rate, load.burstRate, load.burstLength, load.burstEvery, load.duration / 1000));
+	}
+	settings.dumpItems = (std::size_t)std::max(0, config.getInt("application.push.dump.items", (int)DEFAULT_DUMP_ITEMS));
+	settings.sndhwm = config.getInt("application.push.sndhwm", -1);
+	settings.creditBind = config.getString("application.push.credit.bind", "");
+	settings.creditMax = std::max(1, config.getInt("application.push.credit.max", DEFAULT_CREDIT_MAX));
+	settings.queueMax = std::max(1, config.getInt("application.push.queue.max", DEFAULT_QUEUE_MAX));
+	settings.spoolPath = config.getString("application.push.spool.file", "");
+	settings.spoolSize = (std::size_t)std::max(1, config.getInt("application.push.spool.size", DEFAULT_SPOOL_SIZE)) << 20;
+	// keyed routing reads the key from the job header, which only single-frame jobs have
+	std::string routing = config.getString("application.push.routing", "roundrobin");
+	settings.keyed = (routing == "keyed");
+	if (settings.keyed && settings.format != JobFormat::SingleFrame)
+	{
+		poco_warning(logger, "push.routing = keyed requires push.format = single, sending round-robin");
+		settings.keyed = false;
+	}
+	settings.replicas = std::max(1, config.getInt("application.push.routing.replicas", DEFAULT_ROUTING_REPLICAS));
+	settings.keys = (uint32_t)std::max(1, config.getInt("application.push.keys", DEFAULT_KEYS));
+	// the shared memory ring carries single-frame jobs to pullers on this host, it is named by push.shm.name
+	settings.shmName = config.getString("application.push.shm.name", "");
+	settings.shmSize = (std::size_t)std::max(1, config.getInt("application.push.shm.size", DEFAULT_SHM_SIZE)) << 20;
+	settings.shmMin = (std::size_t)std::max(0, config.getInt("application.push.shm.min", DEFAULT_SHM_MIN)) << 10;
+	settings.shmLease = std::max(1, config.getInt("application.push.shm.lease", DEFAULT_SHM_LEASE));
+	if (!settings.shmName.empty())
+	{
+		if (settings.format != JobFormat::SingleFrame)
+		{
+			poco_warning(logger, "push.shm.name requires push.format = single, sending jobs inline");
+			settings.shmName.clear();
+		}
+		else
+		{
+			// the job is used in place by the puller, neither encoded nor cut into chunks
+			if (settings.codec != JobCodec::Identity)
+			{
+				poco_warning(logger, "jobs in shared memory are not encoded, push.codec is ignored");
+				settings.codec = JobCodec::Identity;
+			}
+			// a descriptor in the spool outlives the region it refers to
+			if (!settings.spoolPath.empty())
+			{
+				poco_warning(logger, "jobs in shared memory cannot be spooled, push.spool.file is ignored");
+				settings.spoolPath.clear();
+			}
+			settings.streamChunk = 0;
+		}
+	}
+	// small single-frame jobs share a message while more of them are due within the batch delay
+	settings.batchMax = std::max(1, config.getInt("application.push.batch.max", DEFAULT_BATCH_MAX));
+	settings.batchBytes = (std::size_t)std::max(1, config.getInt("application.push.batch.bytes", DEFAULT_BATCH_BYTES)) << 10;
+	settings.batchDelay = std::max(0, config.getInt("application.push.batch.delay", DEFAULT_BATCH_DELAY));
+	if (settings.batchMax > 1)
+	{
+		if (settings.format != JobFormat::SingleFrame)
+		{
+			poco_warning(logger, "push.batch.max requires push.format = single, sending every job on its own");
+			settings.batchMax = 1;
+		}
+		// the jobs of a batch go to one worker, keyed routing may send every job elsewhere
+		else if (settings.keyed)
+		{
+			poco_warning(logger, "batches cannot be routed by key, push.batch.max is ignored");
+			settings.batchMax = 1;
+		}
+		else
+		{
+			poco_information(logger, Poco::format("up to %d jobs of %Lu bytes in total are sent together when due within %ld us",
+				settings.batchMax, (Poco::UInt64)settings.batchBytes, settings.batchDelay));
+		}
+	}
+	if (TaskPush::streamed(settings))
+	{
+		// a push socket spreads the chunks of a job over all workers, keyed routing sends them to one
+		if (!settings.keyed)
+		{
+			poco_warning(logger, "streaming requires push.routing = keyed, sending jobs whole");
+			settings.streamChunk = 0;
+		}
+		else
+		{
+			if (settings.codec != JobCodec::Identity)
+			{
+				poco_warning(logger, "encoded jobs cannot be processed chunk by chunk, streaming jobs unencoded");
+				settings.codec = JobCodec::Identity;
+			}
+			if (!settings.spoolPath.empty())
+			{
+				poco_warning(logger, "streamed jobs are made as the socket takes them, push.spool.file is ignored");
+				settings.spoolPath.clear();
+			}
+			poco_information(logger, Poco::format("jobs of %u points are streamed in chunks of %Lu bytes",
+				settings.points, (Poco::UInt64)settings.streamChunk));
+		}
+	}
+	return settings;
+}
+
+// hand the jobs over to pullers on the same context instead of sending them over the wire,
+// the jobs keep their points, keys and routing, the wire-only settings do not apply
+inline void handOffPushSettings(PushSettings& settings, const std::string& endpoint, Poco::Logger& logger)
+{
+	if (settings.soa || settings.codec != JobCodec::Identity || settings.streamChunk > 0 || !settings.spoolPath.empty() || !settings.shmName.empty())
+	{
+		poco_information(logger, "jobs are handed over in process, push.layout, push.codec, push.stream.chunk, push.spool.file and push.shm.name do not apply");
+	}
+	settings.pushto = endpoint;
+	settings.format = JobFormat::Handoff;
+	settings.soa = false;
+	settings.codec = JobCodec::Identity;
+	settings.streamChunk = 0;
+	settings.spoolPath.clear();
+	settings.shmName.clear();
+	// a handed over job costs no more than a pointer, there is nothing to save by batching
+	settings.batchMax = 1;
+}
@@ -1,102 +1,970 @@
 #pragma once
 #include <string>
-#include <sstream>
 #include <vector>
+#include <deque>
+#include <atomic>
+#include <memory>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
 #include <Poco/Task.h>
 #include <Poco/Logger.h>
 #include <Poco/Format.h>
+#include <Poco/Timestamp.h>
 #include <Poco/NotificationQueue.h>
 #include <zmq_addon.hpp>
+#include "JobTypes.h"
+#include "JobFormat.hpp"
+#include "JobCodec.hpp"
+#include "BufferPool.hpp"
+#include "JobSpool.hpp"
+#include "JobStream.hpp"
+#include "JobHandoff.hpp"
+#include "JobRing.hpp"
+#include "JobBatch.hpp"
+#include "JobBuilder.hpp"
+#include "LatencyHistogram.hpp"
+#include "LoadGenerator.hpp"
+#include "JobRouter.hpp"
+#include "JobDump.hpp"
 
 using std::string;
-using std::ostringstream;
 using std::vector;
 
-struct Point3d
+// counters of the pusher, written by the task and read by the reporter at any time
+struct PushStats
 {
-	double x;
-	double y;
-	double z;
+	std::atomic<uint64_t> sent{ 0 };
+	// bytes of the jobs and chunks the socket took
+	std::atomic<uint64_t> bytes{ 0 };
+	// exceptions in the send loop
+	std::atomic<uint64_t> errors{ 0 };
+	// chunks of streamed jobs, a streamed job counts as sent with its last chunk, and the sends of
+	// a chunk refused by a full pipe, the chunk is sent again
+	std::atomic<uint64_t> chunks{ 0 };
+	std::atomic<uint64_t> retried{ 0 };
+	// batches of small jobs sent as one message, and the jobs sent in them
+	std::atomic<uint64_t> batches{ 0 };
+	std::atomic<uint64_t> batched{ 0 };
+	// jobs the socket refused without credit-based flow control
+	std::atomic<uint64_t> dropped{ 0 };
+	// jobs waiting for credit in the local queue, or in the spool when there is one
+	std::atomic<uint64_t> queued{ 0 };
+	std::atomic<int64_t> credits{ 0 };
+	// time the job generation was held back by a full local queue
+	std::atomic<uint64_t> stallMicroseconds{ 0 };
+	// jobs written to the shared memory ring, and those sent inline because the ring was full
+	std::atomic<uint64_t> shared{ 0 };
+	std::atomic<uint64_t> sharedFull{ 0 };
+	// bytes of the ring held by pullers, and regions taken back after their lease expired
+	std::atomic<uint64_t> sharedUsed{ 0 };
+	std::atomic<uint64_t> sharedExpired{ 0 };
+	// jobs made, and those of an open-loop load made later than the lag threshold after they were due
+	std::atomic<uint64_t> generated{ 0 };
+	std::atomic<uint64_t> late{ 0 };
+	// how long after it was due the last job was made
+	std::atomic<int64_t> lagMicroseconds{ 0 };
+	// nanoseconds to make a job, and the time jobs waited for credit in the local queue
+	LatencyHistogram make;
+	LatencyHistogram queueWait;
+};
+
+struct PushSettings
+{
+	string pushto;
+	int poolBuffers;
+	JobFormat format;
+	// x, y and z lanes instead of interleaved points, single-frame format only
+	bool soa;
+	// points of every job
+	uint32_t points;
+	// single-frame jobs larger than this many bytes are streamed in chunks of this size, 0 to send every job whole
+	std::size_t streamChunk;
+	// milliseconds between two jobs
+	long interval;
+	// points of every job dumped at trace level
+	std::size_t dumpItems;
+	// codec of the payload sections, single-frame format only
+	JobCodec codec;
+	// ZMQ_SNDHWM of the push socket, 0 for unlimited and negative to keep the ZeroMQ default
+	int sndhwm;
+	// endpoint the pullers grant credits to, empty to send without flow control
+	string creditBind;
+	// credits a single puller may grant at most, caps its pull.credit.window
+	int creditMax;
+	// jobs kept locally while there is no credit, the generation stalls beyond that
+	int queueMax;
+	// file jobs wait in when they cannot be sent, empty to keep them in memory only
+	string spoolPath;
+	// bytes of the spool ring, an existing spool keeps its size
+	std::size_t spoolSize;
+	// route jobs by key to the worker owning it on a consistent hash ring instead of round-robin
+	bool keyed;
+	// points of every worker on the hash ring
+	int replicas;
+	// number of distinct keys the generated jobs cycle through
+	uint32_t keys;
+	// shared memory segment single-frame jobs are written to for pullers on this host, empty to send them inline
+	string shmName;
+	// bytes of the shared memory ring
+	std::size_t shmSize;
+	// jobs smaller than this many bytes are sent inline, the descriptor is not worth it
+	std::size_t shmMin;
+	// milliseconds a puller may hold a job in the ring before it is taken back
+	long shmLease;
+	// open-loop load replacing the fixed interval and size, if its rate is set
+	LoadSettings load;
+	// jobs coalesced into one message at most, 1 to send every job on its own; single-frame jobs sent round-robin only
+	int batchMax;
+	// bytes of a batch at most, larger jobs are always sent on their own
+	std::size_t batchBytes;
+	// microseconds a job may be held back waiting for the next one to share its message
+	long batchDelay;
 };
 
 class TaskPush : public Poco::Task
 {
 private:
 	Poco::Logger& _logger;
-	const string _pushto;
+	const PushSettings _settings;
+	PushStats _stats;
+	// lays out every job in the configured format and encodes it
+	JobBuilder _builder;
+	std::unique_ptr<JobSpool> _spool;
+	std::unique_ptr<JobRingWriter> _ring;
+	// sequence number of the last job made, single-frame jobs carry it to the sink
+	uint64_t _sequence;
+	JobRouter _router;
+	LoadGenerator _load;
+	// when the first job was scheduled, the arrivals of a load are drawn from here
+	Poco::Timestamp _started;
+	// context and pool shared with the pullers of the process, null when the task has its own
+	zmq::context_t* _context;
+	BufferPool* _pool;
+
+	// a job made chunk by chunk as the socket takes it, the whole job is never in memory
+	struct OutgoingStream
+	{
+		JobHeader header;
+		uint64_t total;
+		// bytes made into chunks so far
+		uint64_t offset;
+		// value n of the job is the square root of first + n, like makeJob generates them
+		uint64_t first;
+		// the next chunk, kept when the socket refused it
+		zmq::multipart_t held;
+	};
+
+	// build the next job in pooled buffers, job counts the generated values
+	zmq::multipart_t makeJob(BufferPool& pool, uint64_t& job)
+	{
+		uint64_t made = jobClock();
+		uint64_t job_start = job;
+		const int numOfPoints = (int)_load.points(_settings.points);
+		const int sizeOfDoubleArray = 3 * numOfPoints;
+		// a large single-frame job goes to the shared memory ring if there is room, the descriptor is sent instead
+		void* data = nullptr;
+		JobRingDescriptor shared;
+		if (_ring && _builder.format() == JobFormat::SingleFrame)
+		{
+			std::size_t size = _builder.layout(numOfPoints, sizeOfDoubleArray).size();
+			if (size >= _settings.shmMin)
+			{
+				data = _ring->allocate(size, shared);
+				if (!data)
+					++_stats.sharedFull;
+			}
+		}
+		// payload frames are filled in place, ZeroMQ returns the buffers to the pool when they are sent
+		if (data)
+			_builder.begin(*_ring, data, shared, numOfPoints, sizeOfDoubleArray);
+		else
+			_builder.begin(pool, numOfPoints, sizeOfDoubleArray);
+		double* px = _builder.x();
+		double* py = _builder.y();
+		double* pz = _builder.z();
+		const std::size_t step = _builder.step();
+		double* dvector = _builder.doubles();
+
+		for (int i = 0; i < numOfPoints; ++i)
+		{
+			double& x = px[i * step];
+			x = std::sqrt((double)job++);
+			dvector[3 * i] = x;
+
+			double& y = py[i * step];
+			y = std::sqrt((double)job++);
+			dvector[3 * i + 1] = y;
+
+			double& z = pz[i * step];
+			z = std::sqrt((double)job++);
+			dvector[3 * i + 2] = z;
+		}
+		uint64_t job_end = job - 1;
+		double dscalar = dvector[sizeOfDoubleArray - 1];
+		if (JobHeader* header = _builder.header())
+		{
+			header->sequence = ++_sequence;
+			header->key = (_sequence - 1) % std::max<uint32_t>(1, _settings.keys);
+			// the end-to-end latency measured by the sink includes the wait for credit
+			header->sendTime = jobClock();
+		}
+
+		poco_debug(_logger, Poco::format("push job#%Lu-%Lu", (Poco::UInt64)job_start, (Poco::UInt64)job_end));
+		// the formatting is only paid for when trace is enabled, and then only for the first points
+		if (_logger.trace())
+		{
+			PointsView points = (step == 1)
+				? PointsView(px, py, pz, numOfPoints)
+				: PointsView(FrameView<Point3d>(reinterpret_cast<const Point3d*>(px), numOfPoints));
+			std::string& text = dumpBuffer();
+			dumpAppend(text, "push job#%llu-%llu:\n", (unsigned long long)job_start, (unsigned long long)job_end);
+			dumpPoints(text, points, _settings.dumpItems);
+			poco_trace(_logger, text);
+		}
+
+		zmq::multipart_t msgOutgoing = _builder.finish(pool, dscalar);
+		if (_builder.shared())
+		{
+			++_stats.shared;
+			_stats.sharedUsed = _ring->used();
+			_stats.sharedExpired = _ring->expired();
+		}
+		_stats.make.record(jobClock() - made);
+		return msgOutgoing;
+	}
+
+	// a job that is not sent gives its region of the shared memory ring back right away
+	void discard(const zmq::multipart_t& msg)
+	{
+		JobRingDescriptor shared;
+		if (_ring && msg.size() == 1 && isRingDescriptor(msg.peek(0)->data(), msg.peek(0)->size()))
+		{
+			readRingDescriptor(msg.peek(0)->data(), msg.peek(0)->size(), shared);
+			_ring->discard(shared);
+		}
+	}
+
+	// send a job or a chunk and count its bytes, see JobRouter::send
+	bool send(zmq::socket_t& pusher, zmq::multipart_t& msg)
+	{
+		std::size_t bytes = 0;
+		for (std::size_t i = 0; i < msg.size(); ++i)
+			bytes += msg.peek(i)->size();
+		if (!_router.send(pusher, msg))
+			return false;
+		_stats.bytes += bytes;
+		return true;
+	}
+
+	// count jobs sent on their own or in a batch
+	void countSent(std::size_t jobs)
+	{
+		_stats.sent += jobs;
+		if (jobs > 1)
+		{
+			++_stats.batches;
+			_stats.batched += jobs;
+		}
+	}
+
+	// true if the job may share a message with others: a small single-frame job that is not in the shared memory ring
+	bool batchable(const zmq::multipart_t& msg) const
+	{
+		return _settings.batchMax > 1 && _settings.format == JobFormat::SingleFrame
+			&& msg.size() == 1 && msg.peek(0)->size() <= _settings.batchBytes
+			&& !isRingDescriptor(msg.peek(0)->data(), msg.peek(0)->size());
+	}
+
+	// the jobs at the front that go out as one message, at most limit of them; bytes is set to the size of their batch
+	std::size_t frontBatch(const std::deque<zmq::multipart_t>& jobs, std::size_t limit, std::size_t& bytes) const
+	{
+		std::size_t count = 0;
+		std::size_t payload = 0;
+		while (count < jobs.size() && count < limit && batchable(jobs[count]))
+		{
+			std::size_t next = payload + alignJob(jobs[count].peek(0)->size());
+			if (count > 0 && jobBatchTableSize(count + 1) + next > _settings.batchBytes)
+				break;
+			payload = next;
+			++count;
+		}
+		bytes = jobBatchTableSize(count) + payload;
+		return count;
+	}
+
+	// a batch of jobs whose oldest was made age microseconds ago waits for the job due at nextJob only if it
+	// has room for it and the job is due within the delay, so a pusher that is not busy sends every job right away
+	bool holdBatch(std::size_t jobs, std::size_t bytes, Poco::Timestamp::TimeDiff age, const Poco::Timestamp& nextJob) const
+	{
+		if (jobs >= (std::size_t)_settings.batchMax || bytes >= _settings.batchBytes)
+			return false;
+		Poco::Timestamp::TimeDiff budget = _settings.batchDelay - age;
+		return budget > 0 && nextJob - Poco::Timestamp() < budget;
+	}
+
+	// the held jobs as one message, a single job as it is and more in a batch
+	zmq::multipart_t takeBatch(std::deque<zmq::multipart_t>& held, BufferPool& pool)
+	{
+		zmq::multipart_t msgOutgoing;
+		if (held.size() == 1)
+			msgOutgoing = std::move(held.front());
+		else if (held.size() > 1)
+			msgOutgoing.add(makeJobBatch(pool, held, held.size()));
+		held.clear();
+		return msgOutgoing;
+	}
+
+	// a writable socket takes at least one whole job without blocking
+	static bool writable(zmq::socket_t& pusher, long timeout = 0)
+	{
+		zmq::pollitem_t item = { pusher, 0, ZMQ_POLLOUT, 0 };
+		return zmq::poll(&item, 1, timeout) > 0;
+	}
+
+	// send the oldest spooled job, the record is dropped only once the socket took the job
+	bool sendSpooled(zmq::socket_t& pusher, BufferPool& pool)
+	{
+		zmq::multipart_t msgOutgoing = _spool->front(pool);
+		std::size_t jobs = batchedJobs(msgOutgoing);
+		if (!send(pusher, msgOutgoing))
+			return false;
+		_spool->pop();
+		countSent(jobs);
+		return true;
+	}
+
+	// append the next job to the spool, a job that does not fit is held back until it does
+	bool spoolJob(BufferPool& pool, uint64_t& job, zmq::multipart_t& held)
+	{
+		if (held.empty())
+			held = makeJob(pool, job);
+		if (!_spool->append(held))
+			return false;
+		held.clear();
+		return true;
+	}
+
+	// start the next job as a stream, its values are generated only as the chunks are made
+	std::unique_ptr<OutgoingStream> beginStream(uint64_t& job)
+	{
+		std::unique_ptr<OutgoingStream> stream(new OutgoingStream);
+		uint32_t points = _load.points(_settings.points);
+		JobLayout layout(points, 3 * points, _settings.soa ? JOB_FLAG_SOA : 0);
+		JobHeader* header = layout.writeHeader(&stream->header);
+		stream->total = layout.size();
+		stream->offset = 0;
+		stream->first = job;
+		job += 3 * (uint64_t)points;
+		// the scalar is the last value of the double array, as in makeJob
+		header->scalar = std::sqrt((double)(job - 1));
+		header->sequence = ++_sequence;
+		header->key = (_sequence - 1) % std::max<uint32_t>(1, _settings.keys);
+		header->sendTime = jobClock();
+		poco_debug(_logger, Poco::format("push job#%Lu-%Lu as a stream of %Lu bytes",
+			(Poco::UInt64)stream->first, (Poco::UInt64)(job - 1), (Poco::UInt64)stream->total));
+		return stream;
+	}
+
+	// write the bytes offset ... offset + length of a streamed job, section bounds and chunk
+	// sizes are multiples of 8, so every double is written by one chunk
+	static void fillStream(const OutgoingStream& stream, unsigned char* out, uint64_t offset, std::size_t length)
+	{
+		static_assert(sizeof(JobHeader) % sizeof(double) == 0, "the header must end on a double boundary");
+		const JobHeader& header = stream.header;
+		const uint64_t laneStride = jobLaneStride(header.pointCount) / sizeof(double);
+		for (uint64_t at = offset; at < offset + length; at += sizeof(double), out += sizeof(double))
+		{
+			// header and padding bytes are copied, the padding is zero
+			double value = 0.0;
+			if (at < sizeof(JobHeader))
+			{
+				std::memcpy(out, reinterpret_cast<const unsigned char*>(&header) + at, sizeof(double));
+				continue;
+			}
+			if (at >= header.points.offset && at < header.points.offset + header.points.length)
+			{
+				uint64_t index = (at - header.points.offset) / sizeof(double);
+				if (header.flags & JOB_FLAG_SOA)
+				{
+					// lane index / laneStride holds coordinate index / laneStride of every point
+					uint64_t point = index % laneStride;
+					if (point < header.pointCount)
+						value = std::sqrt((double)(stream.first + 3 * point + index / laneStride));
+				}
+				else
+					value = std::sqrt((double)(stream.first + index));
+			}
+			else if (at >= header.doubles.offset)
+				value = std::sqrt((double)(stream.first + (at - header.doubles.offset) / sizeof(double)));
+			std::memcpy(out, &value, sizeof(value));
+		}
+	}
+
+	// the next chunk of the stream in a pooled buffer
+	zmq::multipart_t nextChunk(OutgoingStream& stream, BufferPool& pool)
+	{
+		std::size_t length = (std::size_t)std::min<uint64_t>(_settings.streamChunk, stream.total - stream.offset);
+		bool last = (stream.offset + length == stream.total);
+		JobChunkHeader chunk = makeChunkHeader(stream.header.sequence, stream.offset, stream.total, stream.header.key, last ? CHUNK_FLAG_LAST : 0);
+		zmq::message_t frameChunk = pool.acquire(sizeof(chunk) + length);
+		std::memcpy(frameChunk.data(), &chunk, sizeof(chunk));
+		fillStream(stream, static_cast<unsigned char*>(frameChunk.data()) + sizeof(chunk), stream.offset, length);
+		stream.offset += length;
+		zmq::multipart_t msgOutgoing;
+		msgOutgoing.add(std::move(frameChunk));
+		return msgOutgoing;
+	}
+
+	// when the first job is due
+	Poco::Timestamp firstJob()
+	{
+		_started.update();
+		Poco::Timestamp due(_started);
+		due += _load.active() ? _load.next(0) : _settings.interval * 1000;
+		return due;
+	}
+
+	// the job due at nextJob was made, schedule the next one; an open-loop load keeps its schedule
+	// however late the job was made, so falling behind shows as lag instead of a lower rate
+	void advance(Poco::Timestamp& nextJob)
+	{
+		++_stats.generated;
+		if (!_load.active())
+		{
+			nextJob += _settings.interval * 1000;
+			return;
+		}
+		Poco::Timestamp::TimeDiff lag = std::max<Poco::Timestamp::TimeDiff>(0, nextJob.elapsed());
+		_stats.lagMicroseconds = lag;
+		if (lag > (Poco::Timestamp::TimeDiff)_load.settings().lagThreshold * 1000)
+			++_stats.late;
+		nextJob += _load.next(nextJob - _started);
+	}
+
+	// true once the load ran for its duration
+	bool finished() const
+	{
+		return _load.finished(_started);
+	}
+
+	// send a job or a batch right away, it must not overtake spooled jobs; a message the socket does
+	// not take goes to the spool, without a spool it is lost
+	void deliver(zmq::socket_t& pusher, zmq::multipart_t& msgOutgoing)
+	{
+		std::size_t jobs = batchedJobs(msgOutgoing);
+		if (!_spool)
+		{
+			if (send(pusher, msgOutgoing))
+				countSent(jobs);
+			else
+			{
+				_stats.dropped += jobs;
+				discard(msgOutgoing);
+				poco_warning(_logger, _router.ready() ? "push queue is full, job dropped" : "no worker connected, job dropped");
+			}
+			return;
+		}
+		// a job refused by a full pipe is left as it was, see JobRouter::send, and is spooled like one that was not tried
+		if (_spool->empty() && _router.ready() && writable(pusher) && send(pusher, msgOutgoing))
+			countSent(jobs);
+		else if (!_spool->append(msgOutgoing))
+		{
+			_stats.dropped += jobs;
+			poco_warning(_logger, "job spool is full, job dropped");
+		}
+	}
+
+	// send the held jobs as one message
+	void sendHeld(zmq::socket_t& pusher, BufferPool& pool, std::deque<zmq::multipart_t>& held)
+	{
+		if (held.empty())
+			return;
+		zmq::multipart_t msgOutgoing = takeBatch(held, pool);
+		deliver(pusher, msgOutgoing);
+	}
+
+	// send one job every interval, a job the socket does not take right away goes to the spool
+	// and waits there until the spooled jobs before it are sent, without a spool it is lost;
+	// small jobs due within the batch delay of each other are sent together
+	void runUnlimited(zmq::socket_t& pusher, BufferPool& pool)
+	{
+		uint64_t job = 1;
+		Poco::Timestamp nextJob = firstJob();
+		// small jobs held back to share a message with the next ones, and when the oldest of them was made
+		std::deque<zmq::multipart_t> held;
+		Poco::Timestamp heldSince;
+		while (!isCancelled() && !finished())
+		{
+			try
+			{
+				_router.receive(pusher);
+				Poco::Timestamp now;
+				// wake up for the next job, or when the held jobs have waited long enough
+				Poco::Timestamp wake = nextJob;
+				if (!held.empty() && heldSince + _settings.batchDelay < wake)
+					wake = heldSince + _settings.batchDelay;
+				long timeout = (long)std::max<Poco::Timestamp::TimeDiff>(0, (wake - now) / 1000);
+				if (_spool && !_spool->empty() && _router.ready())
+				{
+					// replay in order while the socket takes jobs, until the next job is due
+					bool replayed = false;
+					if (writable(pusher, std::min(timeout, 100L)))
+					{
+						while (!_spool->empty() && !nextJob.isElapsed(0) && sendSpooled(pusher, pool))
+							replayed = true;
+					}
+					// a router is writable even when the worker of the next job is at its high water mark
+					if (!replayed && sleep(std::min(timeout, 10L)))
+						break;
+				}
+				else if (sleep(timeout))
+					break;
+
+				_stats.queued = _spool ? _spool->records() : 0;
+				if (!nextJob.isElapsed(0))
+				{
+					if (!held.empty() && heldSince.isElapsed(_settings.batchDelay))
+						sendHeld(pusher, pool, held);
+					continue;
+				}
+				advance(nextJob);
+
+				zmq::multipart_t msgOutgoing = makeJob(pool, job);
+				if (!batchable(msgOutgoing))
+				{
+					// the held jobs go first, a job that cannot share their message must not overtake them
+					sendHeld(pusher, pool, held);
+					deliver(pusher, msgOutgoing);
+				}
+				else
+				{
+					held.push_back(std::move(msgOutgoing));
+					std::size_t bytes = 0;
+					// a job that does not fit into the batch of the held jobs closes it and starts the next one
+					if (frontBatch(held, held.size(), bytes) < held.size())
+					{
+						zmq::multipart_t msgNext = std::move(held.back());
+						held.pop_back();
+						sendHeld(pusher, pool, held);
+						held.push_back(std::move(msgNext));
+						frontBatch(held, 1, bytes);
+					}
+					if (held.size() == 1)
+						heldSince.update();
+					if (!holdBatch(held.size(), bytes, heldSince.elapsed(), nextJob))
+						sendHeld(pusher, pool, held);
+				}
+				_stats.queued = _spool ? _spool->records() : 0;
+			}
+			catch (std::exception &e)
+			{
+				++_stats.errors;
+				poco_debug(_logger, "outgoing error: " + std::string(e.what()));
+			}
+		}
+		// the held jobs go out with the last one
+		sendHeld(pusher, pool, held);
+	}
+
+	// jobs are sent only against credit granted by the pullers and wait in a bounded
+	// local queue meanwhile, the generation stalls instead of dropping jobs when it is full,
+	// with a spool the jobs wait in the spool instead of the local queue; small jobs at the front
+	// of the local queue are sent together as far as the credit goes
+	void runCredited(zmq::socket_t& pusher, zmq::socket_t& credit, BufferPool& pool)
+	{
+		std::deque<zmq::multipart_t> queue;
+		// jobClock() when every queued job was made
+		std::deque<uint64_t> queuedAt;
+		zmq::multipart_t held;
+		auto waiting = [&]() { return _spool ? (std::size_t)_spool->records() : queue.size(); };
+		uint64_t job = 1;
+		Poco::Timestamp nextJob = firstJob();
+		bool stalled = false;
+		Poco::Timestamp stalledSince;
+		// the socket or the credit of the worker refused the next job, wait for credit or the next job before trying again
+		bool refused = false;
+		// the jobs at the front wait for the next one to share their message, until the batch delay of the oldest is up
+		bool holding = false;
+		Poco::Timestamp heldUntil;
+
+		zmq::pollitem_t items[] = {
+			{ credit, 0, ZMQ_POLLIN, 0 },
+			{ pusher, 0, ZMQ_POLLOUT, 0 }
+		};
+
+		while (!isCancelled() && !finished())
+		{
+			try
+			{
+				// wake up for credit, for a writable socket while jobs wait for it, or for the next job
+				items[1].events = (_router.credit() > 0 && waiting() > 0 && _router.ready() && !refused && !holding) ? ZMQ_POLLOUT : 0;
+				// the workers announce themselves on the job socket
+				if (_router.addressed())
+					items[1].events |= ZMQ_POLLIN;
+				Poco::Timestamp now;
+				long timeout = stalled ? 100 : (long)std::max<Poco::Timestamp::TimeDiff>(0, (nextJob - now) / 1000);
+				// the held jobs are looked at again when the next job is due or their delay is up, the poll
+				// counts in milliseconds and is rounded up so that it does not spin for a fraction of one
+				if (holding)
+				{
+					Poco::Timestamp::TimeDiff left = std::min(nextJob, heldUntil) - now;
+					timeout = (long)std::max<Poco::Timestamp::TimeDiff>(0, (left + 999) / 1000);
+				}
+				zmq::poll(items, 2, std::min(timeout, 100L));
+				refused = false;
+				holding = false;
+
+				if (items[0].revents & ZMQ_POLLIN)
+				{
+					zmq::message_t grant;
+					while (credit.recv(&grant, ZMQ_DONTWAIT))
+						_router.grant(grant);
+				}
+
+				_router.receive(pusher);
+
+				while (_router.credit() > 0 && waiting() > 0 && _router.ready())
+				{
+					if (!writable(pusher))
+						break;
+					if (_spool)
+					{
+						if (!sendSpooled(pusher, pool))
+						{
+							refused = true;
+							break;
+						}
+						continue;
+					}
+					std::size_t bytes = 0;
+					std::size_t jobs = frontBatch(queue, (std::size_t)std::min<int64_t>(_router.credit(), _settings.batchMax), bytes);
+					// a batch that has all queued jobs and credit to spare waits for the next job if it is due soon
+					Poco::Timestamp::TimeDiff age = jobs > 0 ? (Poco::Timestamp::TimeDiff)((jobClock() - queuedAt.front()) / 1000) : 0;
+					if (jobs > 0 && jobs == queue.size() && (int64_t)jobs < _router.credit() && holdBatch(jobs, bytes, age, nextJob))
+					{
+						holding = true;
+						heldUntil = Poco::Timestamp() + (_settings.batchDelay - age);
+						break;
+					}
+					if (jobs > 1)
+					{
+						// the jobs stay queued until the socket took their batch
+						zmq::multipart_t msgBatch;
+						msgBatch.add(makeJobBatch(pool, queue, jobs));
+						if (!send(pusher, msgBatch))
+						{
+							refused = true;
+							break;
+						}
+						countSent(jobs);
+						for (std::size_t i = 0; i < jobs; ++i)
+						{
+							_stats.queueWait.record(jobClock() - queuedAt.front());
+							queue.pop_front();
+							queuedAt.pop_front();
+						}
+						continue;
+					}
+					// a refused job stays queued as it was and is tried again later
+					if (!send(pusher, queue.front()))
+					{
+						refused = true;
+						break;
+					}
+					++_stats.sent;
+					_stats.queueWait.record(jobClock() - queuedAt.front());
+					queue.pop_front();
+					queuedAt.pop_front();
+				}
+
+				if (nextJob.isElapsed(0) || stalled)
+				{
+					if (_spool ? spoolJob(pool, job, held) : (int)queue.size() < _settings.queueMax)
+					{
+						if (stalled)
+						{
+							_stats.stallMicroseconds += (uint64_t)stalledSince.elapsed();
+							stalled = false;
+							// carry on at the regular pace instead of catching up, a load catches up
+							if (!_load.active())
+								nextJob.update();
+						}
+						if (!_spool)
+						{
+							queue.push_back(makeJob(pool, job));
+							queuedAt.push_back(jobClock());
+						}
+						advance(nextJob);
+					}
+					else if (!stalled)
+					{
+						stalled = true;
+						stalledSince.update();
+						poco_debug(_logger, Poco::format("no credit for %z queued jobs, job generation stalled", waiting()));
+					}
+				}
+
+				_stats.queued = waiting();
+				_stats.credits = _router.credits();
+			}
+			catch (std::exception &e)
+			{
+				++_stats.errors;
+				poco_debug(_logger, "outgoing error: " + std::string(e.what()));
+			}
+		}
+
+		if (!queue.empty())
+		{
+			poco_warning(_logger, Poco::format("%z queued jobs discarded on cancellation", queue.size()));
+		}
+		if (!held.empty())
+		{
+			poco_warning(_logger, "job held back by the full spool discarded on cancellation");
+		}
+	}
+
+	// jobs are made and sent chunk by chunk as the socket takes them, one job at a time, so
+	// neither side ever holds a whole job; with flow control every chunk costs one credit,
+	// the next job starts when it is due and the previous one is out, there is no queue or spool
+	void runStreamed(zmq::socket_t& pusher, zmq::socket_t& credit, BufferPool& pool)
+	{
+		const bool credited = !_settings.creditBind.empty();
+		uint64_t job = 1;
+		Poco::Timestamp nextJob = firstJob();
+		std::unique_ptr<OutgoingStream> stream;
+		bool stalled = false;
+		Poco::Timestamp stalledSince;
+		// the socket refused the next chunk, a router reports POLLOUT even then
+		bool refused = false;
+
+		zmq::pollitem_t items[] = {
+			{ pusher, 0, 0, 0 },
+			{ credit, 0, ZMQ_POLLIN, 0 }
+		};
+
+		while (!isCancelled() && !finished())
+		{
+			try
+			{
+				bool sendable = stream && (!credited || _router.credit() > 0) && _router.ready();
+				items[0].events = (sendable && !refused) ? ZMQ_POLLOUT : 0;
+				if (_router.addressed())
+					items[0].events |= ZMQ_POLLIN;
+				Poco::Timestamp now;
+				long timeout = stream ? (refused ? 10 : 100) : (long)std::max<Poco::Timestamp::TimeDiff>(0, (nextJob - now) / 1000);
+				zmq::poll(items, credited ? 2 : 1, std::min(timeout, 100L));
+				refused = false;
+
+				if (credited && (items[1].revents & ZMQ_POLLIN))
+				{
+					zmq::message_t grant;
+					while (credit.recv(&grant, ZMQ_DONTWAIT))
+						_router.grant(grant);
+				}
+
+				_router.receive(pusher);
+
+				if (nextJob.isElapsed(0))
+				{
+					if (!stream)
+					{
+						if (stalled)
+						{
+							_stats.stallMicroseconds += (uint64_t)stalledSince.elapsed();
+							stalled = false;
+							// carry on at the regular pace instead of catching up, a load catches up
+							if (!_load.active())
+								nextJob.update();
+						}
+						stream = beginStream(job);
+						advance(nextJob);
+					}
+					else if (!stalled)
+					{
+						stalled = true;
+						stalledSince.update();
+					}
+				}
+
+				while (stream && (!credited || _router.credit() > 0) && _router.ready() && writable(pusher))
+				{
+					if (stream->held.empty())
+						stream->held = nextChunk(*stream, pool);
+					// a chunk the worker cannot take yet stays held as it was, the loop waits a moment and sends it again
+					if (!send(pusher, stream->held))
+					{
+						++_stats.retried;
+						refused = true;
+						break;
+					}
+					++_stats.chunks;
+					if (stream->offset == stream->total)
+					{
+						++_stats.sent;
+						stream.reset();
+					}
+				}
+
+				_stats.queued = stream ? 1 : 0;
+				_stats.credits = _router.credits();
+			}
+			catch (std::exception &e)
+			{
+				++_stats.errors;
+				poco_debug(_logger, "outgoing error: " + std::string(e.what()));
+			}
+		}
+
+		if (stream)
+		{
+			poco_warning(_logger, Poco::format("streamed job#%Lu discarded on cancellation after %Lu of %Lu bytes",
+				(Poco::UInt64)stream->header.sequence, (Poco::UInt64)stream->offset, (Poco::UInt64)stream->total));
+		}
+	}
 
 public:
 
-	TaskPush(string pushto)
+	TaskPush(const PushSettings& settings)
 		: Task("Pusher")
 		, _logger(Poco::Logger::get("Pusher"))
-		, _pushto(pushto)
+		, _settings(settings)
+		, _builder(settings.format, settings.soa, settings.codec)
+		, _sequence(0)
+		, _router(settings.keyed, settings.replicas, !settings.creditBind.empty(), settings.creditMax)
+		, _load(settings.load)
+		, _context(nullptr)
+		, _pool(nullptr)
+	{
+	}
+
+	// run on the context of the process, pool must outlive it, handed over jobs need both ends on one context
+	TaskPush(zmq::context_t& context, BufferPool& pool, const PushSettings& settings)
+		: Task("Pusher")
+		, _logger(Poco::Logger::get("Pusher"))
+		, _settings(settings)
+		, _builder(settings.format, settings.soa, settings.codec)
+		, _sequence(0)
+		, _router(settings.keyed, settings.replicas, !settings.creditBind.empty(), settings.creditMax)
+		, _load(settings.load)
+		, _context(&context)
+		, _pool(&pool)
+	{
+	}
+
+	const PushStats& stats() const
+	{
+		return _stats;
+	}
+
+	// true if the jobs are too large for one message and are sent in chunks
+	static bool streamed(const PushSettings& settings)
+	{
+		return settings.format == JobFormat::SingleFrame && settings.streamChunk > 0
+			&& JobLayout(settings.points, 3 * settings.points, settings.soa ? JOB_FLAG_SOA : 0).size() > settings.streamChunk;
+	}
+
+	// jobs every worker received since the last call, empty without keyed routing
+	std::vector<WorkerLoad> takeLoad()
 	{
+		return _router.takeLoad();
 	}
 
 	void runTask()
 	{
+		if (_context)
+		{
+			run(*_context, *_pool);
+			return;
+		}
+		// the pool must outlive the context, ZeroMQ may still hold its buffers until the context terminates
+		BufferPool pool(64 * 1024, _settings.poolBuffers);
 		zmq::context_t context(1);
-		zmq::socket_t pusher(context, zmq::socket_type::push);
+		run(context, pool);
+	}
+
+	void run(zmq::context_t& context, BufferPool& pool)
+	{
+		zmq::socket_t pusher(context, _router.socketType());
+		zmq::socket_t credit(context, zmq::socket_type::pull);
 		try
 		{
-			pusher.bind(_pushto);
+			if (_settings.sndhwm >= 0)
+				pusher.setsockopt(ZMQ_SNDHWM, &_settings.sndhwm, sizeof(_settings.sndhwm));
+			if (_context)
+			{
+				// jobs still queued must not hold up the shared context, they are freed when dropped
+				int linger = 0;
+				pusher.setsockopt(ZMQ_LINGER, &linger, sizeof(linger));
+				credit.setsockopt(ZMQ_LINGER, &linger, sizeof(linger));
+			}
+			_router.configure(pusher);
+			pusher.bind(_settings.pushto);
+			if (!_settings.creditBind.empty())
+				credit.bind(_settings.creditBind);
 		}
 		catch (std::exception &e)
 		{
-			poco_debug(_logger, "Failed to connect to " + _pushto + ": " + std::string(e.what()));
+			poco_debug(_logger, "Failed to connect to " + _settings.pushto + ": " + std::string(e.what()));
 			return;
 		}
 
-		int job = 1;
-		// try one receive and one send for every 10 msec.
-		while (!sleep(1000))
+		if (!_settings.spoolPath.empty() && _settings.format == JobFormat::Handoff)
+		{
+			// a handed over job is a pointer into this process, it means nothing in the spool
+			poco_warning(_logger, "handed over jobs cannot be spooled, push.spool.file is ignored");
+		}
+		else if (!_settings.spoolPath.empty())
 		{
-			// try send an outgoing message
+			// jobs left by the previous run are sent first
 			try
 			{
-				zmq::multipart_t msgOutgoing;
-				int job_start = job;
-				constexpr int numOfPoints = 4;
-				Point3d p3data[numOfPoints];
-				vector<double> dvector;
-				ostringstream strdata;
-				for (int i = 0; i < numOfPoints; ++i)
-				{
-					p3data[i].x = std::sqrt(job++);
-					dvector.push_back(p3data[i].x);
-
-					p3data[i].y = std::sqrt(job++);
-					dvector.push_back(p3data[i].y);
-
-					p3data[i].z = std::sqrt(job++);
-					dvector.push_back(p3data[i].z);
+				_spool.reset(new JobSpool(_settings.spoolPath, _settings.spoolSize));
+				poco_information(_logger, Poco::format("job spool %s: %Lu jobs, %Lu of %Lu bytes in use",
+					_spool->path(), (Poco::UInt64)_spool->records(), (Poco::UInt64)_spool->used(), (Poco::UInt64)_spool->capacity()));
+			}
+			catch (Poco::Exception& e)
+			{
+				poco_error(_logger, "job spool disabled: " + e.displayText());
+			}
+		}
 
-					strdata << "\t[ " << p3data[i].x << ", " << p3data[i].y << ", " << p3data[i].z << " ]\n";
-				}
-				int job_end = job - 1;
-				//msgOutgoing.addstr(strdata.str());
-				// 1st frame number of points
-				msgOutgoing.addtyp<int>(numOfPoints);
-				// 2nd frame Point3d array
-				msgOutgoing.addmem(&p3data, sizeof p3data);
-				// 3rd frame size of double array
-				msgOutgoing.addtyp<uint32_t>((uint32_t)dvector.size());
-				// 4th frame the double array
-				msgOutgoing.addmem(dvector.data(), sizeof(double) * dvector.size());
-				// 5th frame is a double scalar
-				msgOutgoing.addtyp<double>(dvector.back());
-				msgOutgoing.send(pusher, ZMQ_DONTWAIT);
-				poco_information(_logger, Poco::format("push job#%d-%d:\n%s", job_start, job_end, strdata.str()));
+		if (!_settings.shmName.empty())
+		{
+			// pullers on this host map the ring by the name in the descriptors
+			try
+			{
+				_ring.reset(new JobRingWriter(_settings.shmName, _settings.shmSize, _settings.shmLease));
+				poco_information(_logger, Poco::format("shared memory ring %s of %Lu bytes for jobs of %Lu bytes and more",
+					_ring->name(), (Poco::UInt64)_ring->capacity(), (Poco::UInt64)_settings.shmMin));
 			}
-			catch (std::exception &e)
+			catch (Poco::Exception& e)
 			{
-				poco_debug(_logger, "outgoing error: " + std::string(e.what()));
+				poco_error(_logger, "shared memory ring disabled: " + e.displayText());
 			}
 		}
 
-		pusher.disconnect(_pushto);
+		if (streamed(_settings))
+			runStreamed(pusher, credit, pool);
+		else if (_settings.creditBind.empty())
+			runUnlimited(pusher, pool);
+		else
+			runCredited(pusher, credit, pool);
+
+		if (finished())
+		{
+			poco_information(_logger, Poco::format("load finished after %ld ms: %Lu jobs made, %Lu sent, %Lu dropped, %Lu late",
+				_load.settings().duration,
+				(Poco::UInt64)_stats.generated.load(),
+				(Poco::UInt64)_stats.sent.load(),
+				(Poco::UInt64)_stats.dropped.load(),
+				(Poco::UInt64)_stats.late.load()));
+		}
+		pusher.disconnect(_settings.pushto);
+		_spool.reset();
+		_ring.reset();
 	}
 
 };
-
@@ -0,0 +1,212 @@
+﻿#include <iostream>
+#include <string>
+#include <algorithm>
+#include <Poco/Util/Option.h>
+#include <Poco/Util/HelpFormatter.h>
+#include <Poco/ErrorHandler.h>
+#include <Poco/AutoPtr.h>
+#include <Poco/AsyncChannel.h>
+#include <Poco/ConsoleChannel.h>
+#include <Poco/TaskManager.h>
+#include <Poco/Format.h>
+#include <Poco/Notification.h>
+#include <Poco/NotificationQueue.h>
+#include "Poco/Util/AbstractConfiguration.h"
+#include "AppSinkWorker.h"
+#include "TaskSink.hpp"
+
+using std::string;
+using Poco::Util::Application;
+using Poco::Util::Option;
+using Poco::Util::OptionSet;
+using Poco::Util::OptionCallback;
+using Poco::Util::HelpFormatter;
+using Poco::Util::AbstractConfiguration;
+using Poco::TaskManager;
+using Poco::Notification;
+
+#define DEFAULT_SINK_ADDRESS "tcp://127.0.0.1:6868"
+#define DEFAULT_SINK_WINDOW 1024
+#define DEFAULT_GAP_TIMEOUT 1000
+#define DEFAULT_SINK_BATCH 64
+#define DEFAULT_REPORT_INTERVAL 10000
+
+class TaskErrorHandler : public Poco::ErrorHandler
+{
+public:
+	void exception(const Poco::Exception& e)
+	{
+		std::cerr << "Unhandled task exception: " <<  e.displayText() << std::endl;
+	}
+
+	void exception(const std::exception& e)
+	{
+		std::cerr << "Unhandled task exception: " << e.what() << std::endl;
+	}
+
+	void exception()
+	{
+		std::cerr << "unHandled task exception: unknown exception" << std::endl;
+	}
+};
+
+// static members initialize
+Poco::Event AppSinkWorker::_eventTerminated;
+Poco::NotificationQueue AppSinkWorker::_stateQueue;
+
+BOOL AppSinkWorker::ConsoleCtrlHandler(DWORD ctrlType)
+{
+	switch (ctrlType)
+	{
+	case CTRL_C_EVENT:
+	case CTRL_CLOSE_EVENT:
+	case CTRL_BREAK_EVENT:
+		terminate();
+		return _eventTerminated.tryWait(3000) ? TRUE : FALSE;
+	default:
+		return FALSE;
+	}
+}
+
+void AppSinkWorker::handleHelp(const string & name, const string & value)
+{
+	_helpRequested = true;
+	// display help
+	HelpFormatter helpFormatter(options());
+	helpFormatter.setCommand(commandName());
+	helpFormatter.setUsage("Options");
+	helpFormatter.setHeader("Collects the job results of the pull workers.");
+	helpFormatter.format(std::cout);
+	// stop further processing
+	stopOptionsProcessing();
+}
+
+void AppSinkWorker::initialize(Application & self)
+{
+	poco_information(logger(), config().getString("application.baseName", name()) + " initialize");
+	// load default configuration file
+	loadConfiguration();
+	// all registered subsystems are initialized in ancestor's initialize procedure
+	Application::initialize(self);
+	// catch the termination request
+	SetConsoleCtrlHandler(ConsoleCtrlHandler, TRUE);
+}
+
+void AppSinkWorker::uninitialize()
+{
+	poco_information(logger(), config().getString("application.baseName", name()) + " uninitialize");
+	// ancestor uninitialization
+	Application::uninitialize();
+}
+
+void AppSinkWorker::defineOptions(Poco::Util::OptionSet & options)
+{
+	Application::defineOptions(options);
+
+	options.addOption(
+		Option("help", "h", "display help information on command line arguments")
+		.required(false)
+		.repeatable(false)
+		.callback(OptionCallback<AppSinkWorker>(this, &AppSinkWorker::handleHelp)));
+}
+
+int AppSinkWorker::main(const ArgVec & args)
+{
+	if (!_helpRequested)
+	{
+
+		// install the unhandled error catcher for threads
+		TaskErrorHandler newEH;
+		Poco::ErrorHandler* pOldEH = Poco::ErrorHandler::set(&newEH);
+
+		SinkSettings settings;
+		settings.bind = config().getString("application.sink.bind", DEFAULT_SINK_ADDRESS);
+		// unordered delivers results as they arrive, ordered puts them back in job order
+		string order = config().getString("application.sink.order", "unordered");
+		if (order != "ordered" && order != "unordered")
+		{
+			poco_warning(logger(), "unknown sink.order " + order + ", delivering unordered");
+		}
+		settings.ordered = (order == "ordered");
+		settings.window = std::max(1, config().getInt("application.sink.window", DEFAULT_SINK_WINDOW));
+		settings.gapTimeout = std::max(0, config().getInt("application.sink.gap.timeout", DEFAULT_GAP_TIMEOUT));
+		settings.batch = std::max(1, config().getInt("application.sink.batch", DEFAULT_SINK_BATCH));
+		settings.rcvhwm = config().getInt("application.sink.rcvhwm", -1);
+		long reportInterval = config().getInt("application.sink.report.interval", DEFAULT_REPORT_INTERVAL);
+
+		TaskManager taskmanager;
+		// the task manager takes one reference, the other one keeps the counters readable
+		Poco::AutoPtr<TaskSink> pSink = new TaskSink(settings);
+		taskmanager.start(pSink.duplicate());
+
+		SinkStatsSnapshot lastStats{ 0, 0, 0, 0 };
+		for (;;)
+		{
+			Notification::Ptr pNotify(reportInterval > 0
+				? _stateQueue.waitDequeueNotification(reportInterval)
+				: _stateQueue.waitDequeueNotification());
+			if (pNotify)
+			{
+				// no terminating state, check the event here and exist right away
+				if (pNotify.cast<Event_TerminateRequest>())
+				{
+					poco_information(logger(), "termination request -> exist state loop");
+					break;
+				}
+			}
+			else if (reportInterval > 0)
+				reportStats(pSink->stats(), lastStats, reportInterval);
+			else
+				break;
+		}
+
+		_eventTerminated.set();
+
+		taskmanager.cancelAll();
+
+		// Note: Close the AsyncChannel before taskManager joinAll() get called.
+		//       otherwise, default thread pool can be spin-locked on waiting to join. 
+		Poco::AsyncChannel* pAsyncChannel = dynamic_cast<Poco::AsyncChannel*>(logger().getChannel());
+		if (pAsyncChannel)
+		{
+			pAsyncChannel->close();
+			Poco::AutoPtr<Poco::ConsoleChannel> pCC = new Poco::ConsoleChannel;
+			logger().setChannel("", pCC);
+		}
+
+		taskmanager.joinAll();
+
+		// put back the original error handler
+		Poco::ErrorHandler::set(pOldEH);
+	}
+
+	return Application::EXIT_OK;
+}
+
+void AppSinkWorker::reportStats(const SinkStats& stats, SinkStatsSnapshot& last, long interval)
+{
+	SinkStatsSnapshot now{ stats.delivered.load(), stats.blockedMicroseconds.load(), stats.latencyNanoseconds.load(), stats.latencySamples.load() };
+	double seconds = interval / 1000.0;
+	uint64_t samples = now.latencySamples - last.latencySamples;
+	poco_information(logger(), Poco::format("%.1f results/s, %.3f ms average latency, %Lu held, %.1f%% blocked, %.1f ms longest block, %Lu late, %Lu skipped, %Lu invalid, %Lu delivered",
+		(now.delivered - last.delivered) / seconds,
+		samples ? (now.latencyNanoseconds - last.latencyNanoseconds) / 1e6 / samples : 0.0,
+		(Poco::UInt64)stats.held.load(),
+		(now.blockedMicroseconds - last.blockedMicroseconds) / (interval * 10.0),
+		stats.maxBlockedMicroseconds.load() / 1000.0,
+		(Poco::UInt64)stats.late.load(),
+		(Poco::UInt64)stats.skipped.load(),
+		(Poco::UInt64)stats.invalid.load(),
+		(Poco::UInt64)now.delivered));
+	last = now;
+}
+
+bool AppSinkWorker::helpRequested()
+{
+	return _helpRequested;
+}
+
+void AppSinkWorker::terminate()
+{
+	_stateQueue.enqueueUrgentNotification(new Event_TerminateRequest);
+}
@@ -0,0 +1,52 @@
+﻿#pragma once
+#include <string>
+#include <cstdint>
+#include <Poco/Util/Application.h>
+#include <Poco/Util/OptionSet.h>
+#include <Poco/Event.h>
+#include <Poco/Notification.h>
+#include <Poco/NotificationQueue.h>
+
+struct SinkStats;
+
+// counters of the sink as seen at the last report
+struct SinkStatsSnapshot
+{
+	uint64_t delivered;
+	uint64_t blockedMicroseconds;
+	uint64_t latencyNanoseconds;
+	uint64_t latencySamples;
+};
+
+class AppSinkWorker: public Poco::Util::Application
+{
+private:
+	// for handling Ctrl+C and terminate request
+	static Poco::Event _eventTerminated;
+	static BOOL __stdcall ConsoleCtrlHandler(DWORD ctrlType);
+	// for the help request by user
+	bool _helpRequested{ false };
+	void handleHelp(const std::string& name, const std::string& value);
+	// for events handle by state machine
+	static Poco::NotificationQueue _stateQueue;
+	// log the delivery rate, latency and head-of-line blocking since the last report
+	void reportStats(const SinkStats& stats, SinkStatsSnapshot& last, long interval);
+
+protected:
+	void initialize(Poco::Util::Application& self);
+	void uninitialize();
+	void defineOptions(Poco::Util::OptionSet& options);
+	void printProperties(const std::string& base);
+	int main(const ArgVec& args);
+
+public:
+	AppSinkWorker() {};
+	bool helpRequested();
+	static void terminate();
+};
+
+class Event_TerminateRequest : public Poco::Notification
+{
+public:
+	Event_TerminateRequest() {}
+};
@@ -0,0 +1,274 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+#include <cstdint>
+#include <Poco/Task.h>
+#include <Poco/Logger.h>
+#include <Poco/Format.h>
+#include <Poco/Timestamp.h>
+#include <zmq_addon.hpp>
+#include "JobFormat.hpp"
+#include "JobResult.hpp"
+
+using std::string;
+using std::vector;
+
+// counters of the sink, written by the task and read by the reporter at any time
+struct SinkStats
+{
+	std::atomic<uint64_t> delivered{ 0 };
+	// results that arrived after their place in the order was given up, delivered right away
+	std::atomic<uint64_t> late{ 0 };
+	// sequence numbers given up because the window overflowed or the gap timed out
+	std::atomic<uint64_t> skipped{ 0 };
+	std::atomic<uint64_t> invalid{ 0 };
+	// results held in the reorder window
+	std::atomic<uint64_t> held{ 0 };
+	// time results were held behind a missing one, and the longest single wait
+	std::atomic<uint64_t> blockedMicroseconds{ 0 };
+	std::atomic<uint64_t> maxBlockedMicroseconds{ 0 };
+	// send to delivery of the results with a send time
+	std::atomic<uint64_t> latencyNanoseconds{ 0 };
+	std::atomic<uint64_t> latencySamples{ 0 };
+};
+
+struct SinkSettings
+{
+	string bind;
+	// deliver in the order of the job sequence numbers instead of as they arrive
+	bool ordered;
+	// sequence numbers the reorder window spans, a result beyond it gives up the oldest missing ones
+	int window;
+	// milliseconds a missing result holds back the ones after it before it is given up
+	long gapTimeout;
+	// maximum number of results drained per wakeup
+	int batch;
+	// ZMQ_RCVHWM of the sink socket, 0 for unlimited and negative to keep the ZeroMQ default
+	int rcvhwm;
+};
+
+// collects the results of all pull workers, either as they arrive or put back in job order
+class TaskSink : public Poco::Task
+{
+private:
+	Poco::Logger& _logger;
+	const SinkSettings _settings;
+	SinkStats _stats;
+	// results of sequence numbers _next ... _next + window - 1, at the sequence number modulo the window
+	vector<zmq::multipart_t> _window;
+	vector<uint64_t> _slotSequence;
+	// sequence number delivered next, zero until the first numbered result
+	uint64_t _next;
+	std::size_t _held;
+	Poco::Timestamp _blockedSince;
+
+	void deliver(const ResultHeader& header, const zmq::multipart_t& msgResult)
+	{
+		_stats.delivered.fetch_add(1, std::memory_order_relaxed);
+		if (header.sendTime)
+		{
+			uint64_t now = jobClock();
+			_stats.latencyNanoseconds.fetch_add(now > header.sendTime ? now - header.sendTime : 0, std::memory_order_relaxed);
+			_stats.latencySamples.fetch_add(1, std::memory_order_relaxed);
+		}
+		poco_debug(_logger, Poco::format("result of job#%Lu from worker %u, %z bytes",
+			(Poco::UInt64)header.sequence, header.worker, msgResult.size() > 1 ? msgResult.peek(1)->size() : (std::size_t)0));
+	}
+
+	// the results held while _next was missing are waiting no longer
+	void unblock()
+	{
+		uint64_t blocked = (uint64_t)_blockedSince.elapsed();
+		_stats.blockedMicroseconds.fetch_add(blocked, std::memory_order_relaxed);
+		if (blocked > _stats.maxBlockedMicroseconds.load(std::memory_order_relaxed))
+			_stats.maxBlockedMicroseconds.store(blocked, std::memory_order_relaxed);
+	}
+
+	// move the window past _next, delivering its result or giving it up when it is missing
+	void advance()
+	{
+		zmq::multipart_t& slot = _window[_next % _window.size()];
+		if (slot.empty())
+			_stats.skipped.fetch_add(1, std::memory_order_relaxed);
+		else
+		{
+			deliver(readResultHeader(*slot.peek(0)), slot);
+			slot.clear();
+			--_held;
+		}
+		++_next;
+	}
+
+	// deliver the results that are next in order
+	void drain()
+	{
+		while (_held > 0 && !_window[_next % _window.size()].empty())
+			advance();
+		if (_held == 0)
+			unblock();
+		_stats.held = _held;
+	}
+
+	void receiveOrdered(const ResultHeader& header, zmq::multipart_t& msgResult)
+	{
+		uint64_t sequence = header.sequence;
+		// a pusher that restarted numbers its jobs from 1 again
+		if (_next == 0 || (sequence == 1 && _next > 1))
+		{
+			if (_held > 0)
+			{
+				while (_held > 0)
+					advance();
+				unblock();
+			}
+			// a run that just started may have its first results overtaken by the next ones
+			_next = (sequence <= _window.size()) ? 1 : sequence;
+		}
+		if (sequence < _next)
+		{
+			_stats.late.fetch_add(1, std::memory_order_relaxed);
+			deliver(header, msgResult);
+			return;
+		}
+
+		// the window is bounded, a result beyond it gives up the oldest missing ones
+		if (sequence >= _next + _window.size())
+		{
+			bool blocked = _held > 0;
+			while (_held > 0 && sequence >= _next + _window.size())
+				advance();
+			if (sequence >= _next + _window.size())
+			{
+				// nothing held any more, jump instead of stepping through every missing number
+				uint64_t first = sequence - _window.size() + 1;
+				_stats.skipped.fetch_add(first - _next, std::memory_order_relaxed);
+				_next = first;
+			}
+			if (blocked && _held == 0)
+				unblock();
+		}
+
+		// in order and nothing held, the common case
+		if (sequence == _next && _held == 0)
+		{
+			deliver(header, msgResult);
+			++_next;
+			return;
+		}
+
+		std::size_t index = sequence % _window.size();
+		if (!_window[index].empty() && _slotSequence[index] == sequence)
+		{
+			_stats.invalid.fetch_add(1, std::memory_order_relaxed);
+			poco_debug(_logger, Poco::format("duplicate result of job#%Lu dropped", (Poco::UInt64)sequence));
+			return;
+		}
+		if (_held == 0)
+			_blockedSince.update();
+		_window[index] = std::move(msgResult);
+		_slotSequence[index] = sequence;
+		++_held;
+		drain();
+	}
+
+	void receive(zmq::multipart_t& msgResult)
+	{
+		if (msgResult.empty())
+			throw Poco::DataFormatException("result", "no frames");
+		ResultHeader header = readResultHeader(*msgResult.peek(0));
+		// results of jobs without a sequence number have no place in the order
+		if (_settings.ordered && header.sequence != 0)
+			receiveOrdered(header, msgResult);
+		else
+			deliver(header, msgResult);
+	}
+
+public:
+
+	TaskSink(const SinkSettings& settings)
+		: Task("Sink")
+		, _logger(Poco::Logger::get("Sink"))
+		, _settings(settings)
+		, _window(std::max(1, settings.window))
+		, _slotSequence(std::max(1, settings.window), 0)
+		, _next(0)
+		, _held(0)
+	{
+	}
+
+	const SinkStats& stats() const
+	{
+		return _stats;
+	}
+
+	void runTask()
+	{
+		zmq::context_t context(1);
+		zmq::socket_t sink(context, zmq::socket_type::pull);
+		try
+		{
+			if (_settings.rcvhwm >= 0)
+				sink.setsockopt(ZMQ_RCVHWM, &_settings.rcvhwm, sizeof(_settings.rcvhwm));
+			sink.bind(_settings.bind);
+		}
+		catch (std::exception &e)
+		{
+			poco_error(_logger, "Failed to bind to " + _settings.bind + ": " + std::string(e.what()));
+			return;
+		}
+
+		zmq::pollitem_t items[] = { { sink, 0, ZMQ_POLLIN, 0 } };
+		while (!isCancelled())
+		{
+			try
+			{
+				// wake up now and then to check for cancellation and for gaps that timed out
+				long timeout = 100;
+				if (_held > 0)
+					timeout = std::min(timeout, std::max(0L, _settings.gapTimeout - (long)(_blockedSince.elapsed() / 1000)));
+				zmq::poll(items, 1, timeout);
+
+				if (items[0].revents & ZMQ_POLLIN)
+				{
+					for (int n = 0; n < _settings.batch; ++n)
+					{
+						zmq::multipart_t msgResult;
+						if (!msgResult.recv(sink, ZMQ_DONTWAIT))
+							break;
+						try
+						{
+							receive(msgResult);
+						}
+						catch (std::exception &e)
+						{
+							_stats.invalid.fetch_add(1, std::memory_order_relaxed);
+							poco_debug(_logger, "invalid result: " + std::string(e.what()));
+						}
+					}
+				}
+
+				// give up a missing result that held back the ones after it for too long
+				if (_held > 0 && _blockedSince.isElapsed((Poco::Timestamp::TimeDiff)_settings.gapTimeout * 1000))
+				{
+					poco_debug(_logger, Poco::format("result of job#%Lu missing, given up", (Poco::UInt64)_next));
+					unblock();
+					_blockedSince.update();
+					advance();
+					drain();
+				}
+			}
+			catch (std::exception &e)
+			{
+				poco_debug(_logger, "incoming error: " + std::string(e.what()));
+			}
+		}
+
+		if (_held > 0)
+		{
+			poco_warning(_logger, Poco::format("%z held results discarded on cancellation", _held));
+		}
+		sink.unbind(_settings.bind);
+	}
+};
@@ -0,0 +1,123 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <iterator>
+#include <memory>
+#include <vector>
+#include <Poco/Mutex.h>
+#include <zmq.hpp>
+
+// BufferPool hands out reusable byte buffers wrapped in zmq::message_t, so they
+// can be filled in place and sent without copying. ZeroMQ calls the free callback
+// from its I/O thread once the buffer is on the wire, the buffer then goes back
+// to the pool. The pool must outlive every message it handed out, i.e. declare
+// it before the zmq::context_t whose sockets send those messages.
+class BufferPool
+{
+public:
+	// every buffer starts on a cache line, which is enough for any payload type
+	static constexpr std::size_t ALIGNMENT = 64;
+
+private:
+	struct Buffer
+	{
+		BufferPool* pool;
+		std::size_t capacity;
+		std::unique_ptr<unsigned char[]> storage;
+		unsigned char* data;
+
+		Buffer(BufferPool* owner, std::size_t size)
+			: pool(owner)
+			, capacity(size)
+			, storage(new unsigned char[size + ALIGNMENT])
+		{
+			std::uintptr_t addr = reinterpret_cast<std::uintptr_t>(storage.get());
+			data = storage.get() + (ALIGNMENT - addr % ALIGNMENT) % ALIGNMENT;
+		}
+	};
+
+	Poco::FastMutex _mutex;
+	std::vector<Buffer*> _free;
+	const std::size_t _blockSize;
+	const std::size_t _maxFree;
+	std::atomic<std::size_t> _allocated{ 0 };
+
+	static void freeBuffer(void* data, void* hint)
+	{
+		Buffer* buffer = static_cast<Buffer*>(hint);
+		buffer->pool->release(buffer);
+	}
+
+	void release(Buffer* buffer)
+	{
+		Poco::FastMutex::ScopedLock lock(_mutex);
+		if (_free.size() < _maxFree)
+		{
+			_free.push_back(buffer);
+		}
+		else
+		{
+			--_allocated;
+			delete buffer;
+		}
+	}
+
+public:
+	// capacities are rounded up to multiple of blockSize, at most maxFree idle buffers are kept
+	BufferPool(std::size_t blockSize = 64 * 1024, std::size_t maxFree = 16)
+		: _blockSize(blockSize ? blockSize : 1)
+		, _maxFree(maxFree)
+	{
+	}
+
+	~BufferPool()
+	{
+		for (Buffer* buffer : _free)
+			delete buffer;
+	}
+
+	BufferPool(const BufferPool&) = delete;
+	BufferPool& operator=(const BufferPool&) = delete;
+
+	// take a buffer of at least size bytes, the returned message owns it until it is sent or destroyed
+	zmq::message_t acquire(std::size_t size)
+	{
+		Buffer* buffer = nullptr;
+		{
+			Poco::FastMutex::ScopedLock lock(_mutex);
+			// prefer the most recently released buffer, it is likely still in cache
+			for (auto it = _free.rbegin(); it != _free.rend(); ++it)
+			{
+				if ((*it)->capacity >= size)
+				{
+					buffer = *it;
+					_free.erase(std::next(it).base());
+					break;
+				}
+			}
+		}
+
+		if (buffer == nullptr)
+		{
+			std::size_t capacity = (size + _blockSize - 1) / _blockSize * _blockSize;
+			buffer = new Buffer(this, capacity ? capacity : _blockSize);
+			++_allocated;
+		}
+
+		return zmq::message_t(buffer->data, size, &BufferPool::freeBuffer, buffer);
+	}
+
+	// number of buffers owned by the pool, in flight or idle
+	std::size_t allocated() const
+	{
+		return _allocated;
+	}
+
+	// number of idle buffers ready for reuse
+	std::size_t available()
+	{
+		Poco::FastMutex::ScopedLock lock(_mutex);
+		return _free.size();
+	}
+};
@@ -0,0 +1,114 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <utility>
+#include <algorithm>
+
+// Consistent hashing of 64-bit keys onto a set of named nodes. Every node owns
+// `replicas` points on a 64-bit ring and a key belongs to the node of the first
+// point at or after the hash of the key. A node that joins takes over only the
+// keys between its points and their predecessors, a node that leaves hands only
+// its own keys to the nodes after its points, all other keys stay where they are.
+class HashRing
+{
+private:
+	// hash of the point, index into _nodes
+	std::vector<std::pair<uint64_t, uint32_t>> _points;
+	std::vector<std::string> _nodes;
+	int _replicas;
+
+	static uint64_t mix(uint64_t x)
+	{
+		// finalizer of splitmix64, spreads neighbouring keys over the whole ring
+		x ^= x >> 30;
+		x *= 0xBF58476D1CE4E5B9ull;
+		x ^= x >> 27;
+		x *= 0x94D049BB133111EBull;
+		x ^= x >> 31;
+		return x;
+	}
+
+	// FNV-1a of the node name and the replica number
+	static uint64_t pointHash(const std::string& node, int replica)
+	{
+		uint64_t h = 0xCBF29CE484222325ull;
+		for (unsigned char c : node)
+			h = (h ^ c) * 0x100000001B3ull;
+		return mix(h ^ (uint64_t)replica);
+	}
+
+	void rebuild()
+	{
+		_points.clear();
+		_points.reserve(_nodes.size() * _replicas);
+		for (uint32_t n = 0; n < _nodes.size(); ++n)
+			for (int r = 0; r < _replicas; ++r)
+				_points.emplace_back(pointHash(_nodes[n], r), n);
+		std::sort(_points.begin(), _points.end());
+	}
+
+public:
+	// more replicas spread the keys more evenly at the cost of a larger ring
+	explicit HashRing(int replicas = 100)
+		: _replicas(std::max(1, replicas))
+	{
+	}
+
+	static uint64_t keyHash(uint64_t key)
+	{
+		return mix(key);
+	}
+
+	// false if the node is already on the ring
+	bool add(const std::string& node)
+	{
+		if (std::find(_nodes.begin(), _nodes.end(), node) != _nodes.end())
+			return false;
+		_nodes.push_back(node);
+		rebuild();
+		return true;
+	}
+
+	// false if the node is not on the ring
+	bool remove(const std::string& node)
+	{
+		auto it = std::find(_nodes.begin(), _nodes.end(), node);
+		if (it == _nodes.end())
+			return false;
+		_nodes.erase(it);
+		rebuild();
+		return true;
+	}
+
+	bool contains(const std::string& node) const
+	{
+		return std::find(_nodes.begin(), _nodes.end(), node) != _nodes.end();
+	}
+
+	bool empty() const
+	{
+		return _nodes.empty();
+	}
+
+	std::size_t size() const
+	{
+		return _nodes.size();
+	}
+
+	const std::vector<std::string>& nodes() const
+	{
+		return _nodes;
+	}
+
+	// the node the key belongs to, the ring must not be empty
+	const std::string& lookup(uint64_t key) const
+	{
+		uint64_t h = keyHash(key);
+		auto it = std::lower_bound(_points.begin(), _points.end(), std::make_pair(h, (uint32_t)0));
+		if (it == _points.end())
+			it = _points.begin();
+		return _nodes[it->second];
+	}
+};
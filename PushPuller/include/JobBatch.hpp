@@ -0,0 +1,139 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <Poco/Exception.h>
+#include <zmq_addon.hpp>
+#include "JobFormat.hpp"
+#include "BufferPool.hpp"
+
+// Small single-frame jobs sent together as one frame, to pay the cost of a message once:
+//
+//   | JobBatchHeader | JobBatchEntry * count | padding | job 1 | padding | job 2 | ... |
+//
+// Every job starts on a JOB_ALIGNMENT boundary, so its sections are aligned within the
+// batch like they are within a frame of their own and the receiver uses them in place.
+// A batch of one job is never made, the job is sent as it is.
+
+// "PPBA" in little endian byte order
+#define BATCH_MAGIC 0x41425050u
+#define BATCH_FORMAT_VERSION 1
+
+struct JobBatchHeader
+{
+	uint32_t magic;
+	uint16_t version;
+	// size of the header as written by the sender, the entries follow it
+	uint16_t headerSize;
+	// number of jobs and entries
+	uint32_t count;
+	uint32_t reserved;
+};
+
+// where a job is in the batch frame
+struct JobBatchEntry
+{
+	uint64_t offset;
+	uint64_t length;
+};
+
+// true if the frame starts with the magic of a batch
+inline bool isJobBatch(const void* data, std::size_t size)
+{
+	uint32_t magic = 0;
+	if (size < sizeof(magic))
+		return false;
+	std::memcpy(&magic, data, sizeof(magic));
+	return magic == BATCH_MAGIC;
+}
+
+// number of jobs a message carries, the jobs of a batch or 1
+inline std::size_t batchedJobs(const zmq::multipart_t& msg)
+{
+	JobBatchHeader header;
+	if (msg.size() != 1 || msg.peek(0)->size() < sizeof(header) || !isJobBatch(msg.peek(0)->data(), msg.peek(0)->size()))
+		return 1;
+	std::memcpy(&header, msg.peek(0)->data(), sizeof(header));
+	return header.count;
+}
+
+// size of the header and the entries of a batch of count jobs, the first job follows
+inline std::size_t jobBatchTableSize(std::size_t count)
+{
+	return alignJob(sizeof(JobBatchHeader) + count * sizeof(JobBatchEntry));
+}
+
+// a batch frame from the pool with copies of the first count jobs, each a single-frame message
+inline zmq::message_t makeJobBatch(BufferPool& pool, const std::deque<zmq::multipart_t>& jobs, std::size_t count)
+{
+	std::size_t size = jobBatchTableSize(count);
+	for (std::size_t i = 0; i < count; ++i)
+		size += alignJob(jobs[i].peek(0)->size());
+	zmq::message_t frameBatch = pool.acquire(size);
+	unsigned char* base = static_cast<unsigned char*>(frameBatch.data());
+	// the padding goes out as well, it must not carry stale bytes of the pool
+	std::memset(base, 0, jobBatchTableSize(count));
+	JobBatchHeader header;
+	std::memset(&header, 0, sizeof(header));
+	header.magic = BATCH_MAGIC;
+	header.version = BATCH_FORMAT_VERSION;
+	header.headerSize = (uint16_t)sizeof(JobBatchHeader);
+	header.count = (uint32_t)count;
+	std::memcpy(base, &header, sizeof(header));
+	std::size_t offset = jobBatchTableSize(count);
+	for (std::size_t i = 0; i < count; ++i)
+	{
+		const zmq::message_t& frameJob = *jobs[i].peek(0);
+		JobBatchEntry entry = { offset, frameJob.size() };
+		std::memcpy(base + sizeof(header) + i * sizeof(entry), &entry, sizeof(entry));
+		std::memcpy(base + offset, frameJob.data(), frameJob.size());
+		std::memset(base + offset + frameJob.size(), 0, alignJob(frameJob.size()) - frameJob.size());
+		offset += alignJob(frameJob.size());
+	}
+	return frameBatch;
+}
+
+// hands out the jobs of a batch frame as frames of their own, the batch frame must outlive them
+class JobBatchReader
+{
+private:
+	const zmq::message_t& _frame;
+	JobBatchHeader _header;
+
+	// the bytes of a job stay owned by the batch frame
+	static void keepFrame(void* data, void* hint)
+	{
+	}
+
+public:
+	explicit JobBatchReader(const zmq::message_t& frame)
+		: _frame(frame)
+	{
+		std::memset(&_header, 0, sizeof(_header));
+		std::memcpy(&_header, frame.data(), std::min(frame.size(), sizeof(JobBatchHeader)));
+		if (_header.version == 0 || _header.version > BATCH_FORMAT_VERSION)
+			throw Poco::DataFormatException("job batch", "unsupported version " + std::to_string(_header.version));
+		if (_header.headerSize < sizeof(JobBatchHeader) || _header.headerSize > frame.size()
+			|| _header.count > (frame.size() - _header.headerSize) / sizeof(JobBatchEntry))
+			throw Poco::DataFormatException("job batch", "invalid header of " + std::to_string(_header.count) + " jobs");
+	}
+
+	std::size_t count() const
+	{
+		return _header.count;
+	}
+
+	// job i as a frame referring to the batch frame, it is not copied
+	zmq::message_t job(std::size_t i) const
+	{
+		JobBatchEntry entry;
+		std::memcpy(&entry, static_cast<const unsigned char*>(_frame.data()) + _header.headerSize + i * sizeof(entry), sizeof(entry));
+		if (entry.offset % JOB_ALIGNMENT != 0 || entry.offset > _frame.size() || entry.length > _frame.size() - entry.offset)
+			throw Poco::DataFormatException("job batch", "job " + std::to_string(i) + " is out of bounds");
+		unsigned char* data = static_cast<unsigned char*>(const_cast<void*>(_frame.data())) + entry.offset;
+		return zmq::message_t(data, (std::size_t)entry.length, &keepFrame, nullptr);
+	}
+};
@@ -0,0 +1,189 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+#include <zmq_addon.hpp>
+#include "JobTypes.h"
+#include "JobFormat.hpp"
+#include "JobCodec.hpp"
+#include "JobHandoff.hpp"
+#include "JobRing.hpp"
+#include "BufferPool.hpp"
+
+// Builds jobs in the wire format of a pusher: a handed over object, a single frame with
+// interleaved points or lanes in a pooled buffer or in the shared memory ring, or the
+// legacy multipart format. begin() lays out a job and points x(), y(), z() and doubles()
+// at where its values go, the caller fills them in, sets the header fields it cares about
+// and takes the message to send from finish(), encoded if there is a codec. PushWorker
+// and the bench build their jobs the same way through this, one job at a time.
+class JobBuilder
+{
+private:
+	const JobFormat _format;
+	const uint32_t _flags;
+	const JobCodec _codec;
+	// encoded frame, reused for every job
+	std::vector<unsigned char> _encoded;
+	zmq::multipart_t _msg;
+	std::unique_ptr<JobObject> _object;
+	// the ring the job was placed in, null while the job is sent inline
+	JobRingWriter* _ring;
+	JobRingDescriptor _shared;
+	JobHeader* _header;
+	// x, y and z of point i are at x()[i * step()], y()[i * step()] and z()[i * step()]
+	double* _x;
+	double* _y;
+	double* _z;
+	std::size_t _step;
+	double* _doubles;
+
+	void start()
+	{
+		_msg.clear();
+		_object.reset();
+		_ring = nullptr;
+		_header = nullptr;
+		_step = 3;
+	}
+
+	// point the arrays at a single frame laid out at data
+	void place(const JobLayout& layout, void* data)
+	{
+		_header = layout.writeHeader(data);
+		if (layout.soa())
+		{
+			_x = layout.lane(data, 0);
+			_y = layout.lane(data, 1);
+			_z = layout.lane(data, 2);
+			_step = 1;
+		}
+		else
+		{
+			Point3d* p3data = layout.points(data);
+			_x = &p3data->x;
+			_y = &p3data->y;
+			_z = &p3data->z;
+		}
+		_doubles = layout.doubles(data);
+	}
+
+public:
+	// soa lays the points out as lanes and codec encodes the sections, both for single-frame jobs only
+	JobBuilder(JobFormat format, bool soa, JobCodec codec)
+		: _format(format)
+		, _flags((format == JobFormat::SingleFrame && soa) ? JOB_FLAG_SOA : 0)
+		, _codec(format == JobFormat::SingleFrame ? codec : JobCodec::Identity)
+		, _ring(nullptr)
+		, _header(nullptr)
+		, _x(nullptr)
+		, _y(nullptr)
+		, _z(nullptr)
+		, _step(3)
+		, _doubles(nullptr)
+	{
+	}
+
+	JobFormat format() const { return _format; }
+
+	// the layout of a single-frame job, its size() is what a region of the ring needs
+	JobLayout layout(uint32_t numOfPoints, uint32_t sizeOfDoubleArray) const
+	{
+		return JobLayout(numOfPoints, sizeOfDoubleArray, _flags);
+	}
+
+	// lay out the next job in buffers of the pool, or in the object to hand over
+	void begin(BufferPool& pool, uint32_t numOfPoints, uint32_t sizeOfDoubleArray)
+	{
+		start();
+		if (_format == JobFormat::Handoff)
+		{
+			// the arrays are filled where the puller reads them, nothing is copied or encoded
+			_object.reset(new JobObject);
+			_header = JobLayout(numOfPoints, sizeOfDoubleArray, 0).writeHeader(&_object->header);
+			_object->points.resize(numOfPoints);
+			_object->doubles.resize(sizeOfDoubleArray);
+			_x = &_object->points.data()->x;
+			_y = &_object->points.data()->y;
+			_z = &_object->points.data()->z;
+			_doubles = _object->doubles.data();
+		}
+		else if (_format == JobFormat::SingleFrame)
+		{
+			// one frame carries the header and both arrays
+			JobLayout single = layout(numOfPoints, sizeOfDoubleArray);
+			zmq::message_t frameJob = pool.acquire(single.size());
+			place(single, frameJob.data());
+			_msg.add(std::move(frameJob));
+		}
+		else
+		{
+			zmq::message_t framePoint3d = pool.acquire(sizeof(Point3d) * numOfPoints);
+			zmq::message_t frameDoubleArray = pool.acquire(sizeof(double) * sizeOfDoubleArray);
+			Point3d* p3data = static_cast<Point3d*>(framePoint3d.data());
+			_x = &p3data->x;
+			_y = &p3data->y;
+			_z = &p3data->z;
+			_doubles = static_cast<double*>(frameDoubleArray.data());
+			// 1st frame number of points
+			_msg.addtyp<int>((int)numOfPoints);
+			// 2nd frame Point3d array
+			_msg.add(std::move(framePoint3d));
+			// 3rd frame size of double array
+			_msg.addtyp<uint32_t>(sizeOfDoubleArray);
+			// 4th frame the double array
+			_msg.add(std::move(frameDoubleArray));
+		}
+	}
+
+	// lay out the next single-frame job in the region of the ring the caller allocated
+	// with the size of its layout(), the descriptor is sent instead of the job
+	void begin(JobRingWriter& ring, void* data, const JobRingDescriptor& shared, uint32_t numOfPoints, uint32_t sizeOfDoubleArray)
+	{
+		start();
+		_ring = &ring;
+		_shared = shared;
+		place(layout(numOfPoints, sizeOfDoubleArray), data);
+	}
+
+	// null for the multipart format, which has no header
+	JobHeader* header() const { return _header; }
+	double* x() const { return _x; }
+	double* y() const { return _y; }
+	double* z() const { return _z; }
+	std::size_t step() const { return _step; }
+	double* doubles() const { return _doubles; }
+	// true if the job is in the shared memory ring
+	bool shared() const { return _ring != nullptr; }
+
+	// the job as it is sent, the header is taken as the caller left it
+	zmq::multipart_t finish(BufferPool& pool, double scalar)
+	{
+		zmq::multipart_t msgOutgoing(std::move(_msg));
+		_msg.clear();
+		if (_header)
+			_header->scalar = scalar;
+		else
+			// 5th frame is a double scalar
+			msgOutgoing.addtyp<double>(scalar);
+
+		if (_object)
+			msgOutgoing.add(handOff(std::move(_object)));
+		else if (_ring)
+		{
+			_shared.key = _header->key;
+			msgOutgoing.add(_ring->frame(_shared));
+		}
+		else if (_header && _codec != JobCodec::Identity)
+		{
+			// the plain frame goes back to the pool when it is replaced by the encoded one
+			encodeJob(msgOutgoing.peek(0)->data(), _codec, _encoded);
+			zmq::message_t frameEncoded = pool.acquire(_encoded.size());
+			std::memcpy(frameEncoded.data(), _encoded.data(), _encoded.size());
+			msgOutgoing.clear();
+			msgOutgoing.add(std::move(frameEncoded));
+		}
+		return msgOutgoing;
+	}
+};
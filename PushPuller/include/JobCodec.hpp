@@ -0,0 +1,247 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <sstream>
+#include <vector>
+#include <Poco/Exception.h>
+#include <Poco/DeflatingStream.h>
+#include <Poco/InflatingStream.h>
+#include <Poco/MemoryStream.h>
+#include "JobTypes.h"
+#include "JobFormat.hpp"
+
+// Lossless codecs for the payload sections of single-frame jobs. A section is
+// coded as a series of double streams, one per coordinate for the points and
+// one for the double array, so that neighbouring values of the same kind meet.
+// The encoded bytes use the byte order of the host, like the rest of the job.
+
+enum class JobCodec : uint32_t
+{
+	// sections as they are, the job is sent without JOB_FLAG_ENCODED
+	Identity,
+	// every value XORed with the previous one of its stream, leading zero bytes dropped
+	XorDelta,
+	// zlib deflate of the streams, trades CPU for bandwidth
+	Deflate
+};
+
+inline const char* jobCodecName(JobCodec codec)
+{
+	switch (codec)
+	{
+	case JobCodec::Identity: return "identity";
+	case JobCodec::XorDelta: return "xor";
+	case JobCodec::Deflate: return "deflate";
+	default: return "unknown";
+	}
+}
+
+// "identity", "xor" or "deflate"
+inline JobCodec jobCodecFromName(const std::string& name)
+{
+	if (name == "xor")
+		return JobCodec::XorDelta;
+	if (name == "deflate")
+		return JobCodec::Deflate;
+	if (name == "identity")
+		return JobCodec::Identity;
+	throw Poco::InvalidArgumentException("job codec", name);
+}
+
+// values of one stream are data[0], data[stride], ... data[(count - 1) * stride]
+struct DoubleStream
+{
+	double* data;
+	std::size_t count;
+	std::size_t stride;
+};
+
+// the x, y and z streams of a Point3d section laid out for the given flags
+inline void pointStreams(double* section, std::size_t numOfPoints, uint32_t flags, DoubleStream streams[3])
+{
+	bool soa = (flags & JOB_FLAG_SOA) != 0;
+	std::size_t lane = jobLaneStride(numOfPoints) / sizeof(double);
+	for (std::size_t axis = 0; axis < 3; ++axis)
+		streams[axis] = soa ? DoubleStream{ section + axis * lane, numOfPoints, 1 } : DoubleStream{ section + axis, numOfPoints, 3 };
+}
+
+// worst case size of a XorDelta stream: one control nibble and eight bytes per value,
+// plus room for the last value to be written as a whole word
+inline std::size_t xorDeltaBound(std::size_t count)
+{
+	return (count + 1) / 2 + sizeof(uint64_t) * (count + 1);
+}
+
+// out must hold xorDeltaBound(stream.count) bytes, returns the bytes written
+inline std::size_t xorDeltaEncode(const DoubleStream& stream, unsigned char* out)
+{
+	// control nibbles first, each one the number of significant bytes of a residual
+	std::size_t controlBytes = (stream.count + 1) / 2;
+	std::memset(out, 0, controlBytes);
+	unsigned char* payload = out + controlBytes;
+	uint64_t previous = 0;
+	for (std::size_t i = 0; i < stream.count; ++i)
+	{
+		uint64_t bits;
+		std::memcpy(&bits, stream.data + i * stream.stride, sizeof(bits));
+		uint64_t residual = bits ^ previous;
+		previous = bits;
+
+		unsigned n = 0;
+		for (uint64_t rest = residual; rest; rest >>= 8)
+			++n;
+		out[i / 2] |= (unsigned char)(n << (4 * (i & 1)));
+		// the low bytes come first in little endian, the excess is overwritten by the next value
+		std::memcpy(payload, &residual, sizeof(residual));
+		payload += n;
+	}
+	return payload - out;
+}
+
+// decode stream.count values from at most size bytes, returns the bytes consumed
+inline std::size_t xorDeltaDecode(const unsigned char* in, std::size_t size, const DoubleStream& stream)
+{
+	std::size_t controlBytes = (stream.count + 1) / 2;
+	if (size < controlBytes)
+		throw Poco::DataFormatException("xor stream", "truncated control bytes");
+	const unsigned char* payload = in + controlBytes;
+	const unsigned char* end = in + size;
+	uint64_t previous = 0;
+	for (std::size_t i = 0; i < stream.count; ++i)
+	{
+		unsigned n = (in[i / 2] >> (4 * (i & 1))) & 0x0F;
+		if (n > sizeof(uint64_t) || n > (std::size_t)(end - payload))
+			throw Poco::DataFormatException("xor stream", "truncated value " + std::to_string(i));
+		uint64_t residual = 0;
+		std::memcpy(&residual, payload, n);
+		payload += n;
+		previous ^= residual;
+		std::memcpy(stream.data + i * stream.stride, &previous, sizeof(previous));
+	}
+	return payload - in;
+}
+
+// append the encoded streams to out, returns the number of bytes appended
+inline std::size_t encodeStreams(JobCodec codec, const DoubleStream* streams, std::size_t numOfStreams, std::vector<unsigned char>& out)
+{
+	std::size_t start = out.size();
+	switch (codec)
+	{
+	case JobCodec::Identity:
+		for (std::size_t s = 0; s < numOfStreams; ++s)
+		{
+			std::size_t pos = out.size();
+			out.resize(pos + sizeof(double) * streams[s].count);
+			for (std::size_t i = 0; i < streams[s].count; ++i)
+				std::memcpy(&out[pos + sizeof(double) * i], streams[s].data + i * streams[s].stride, sizeof(double));
+		}
+		break;
+
+	case JobCodec::XorDelta:
+		for (std::size_t s = 0; s < numOfStreams; ++s)
+		{
+			std::size_t pos = out.size();
+			out.resize(pos + xorDeltaBound(streams[s].count));
+			out.resize(pos + xorDeltaEncode(streams[s], out.data() + pos));
+		}
+		break;
+
+	case JobCodec::Deflate:
+	{
+		std::ostringstream compressed;
+		Poco::DeflatingOutputStream deflater(compressed, Poco::DeflatingStreamBuf::STREAM_ZLIB);
+		std::vector<double> values;
+		for (std::size_t s = 0; s < numOfStreams; ++s)
+		{
+			values.resize(streams[s].count);
+			for (std::size_t i = 0; i < streams[s].count; ++i)
+				values[i] = streams[s].data[i * streams[s].stride];
+			deflater.write(reinterpret_cast<const char*>(values.data()), sizeof(double) * values.size());
+		}
+		deflater.close();
+		const std::string& bytes = compressed.str();
+		out.insert(out.end(), bytes.begin(), bytes.end());
+		break;
+	}
+
+	default:
+		throw Poco::InvalidArgumentException("job codec", std::to_string((uint32_t)codec));
+	}
+	return out.size() - start;
+}
+
+// decode exactly size bytes into the streams
+inline void decodeStreams(JobCodec codec, const unsigned char* in, std::size_t size, const DoubleStream* streams, std::size_t numOfStreams)
+{
+	std::size_t consumed = 0;
+	switch (codec)
+	{
+	case JobCodec::Identity:
+		for (std::size_t s = 0; s < numOfStreams; ++s)
+		{
+			if (size - consumed < sizeof(double) * streams[s].count)
+				throw Poco::DataFormatException("identity stream", "truncated");
+			for (std::size_t i = 0; i < streams[s].count; ++i, consumed += sizeof(double))
+				std::memcpy(streams[s].data + i * streams[s].stride, in + consumed, sizeof(double));
+		}
+		break;
+
+	case JobCodec::XorDelta:
+		for (std::size_t s = 0; s < numOfStreams; ++s)
+			consumed += xorDeltaDecode(in + consumed, size - consumed, streams[s]);
+		break;
+
+	case JobCodec::Deflate:
+	{
+		Poco::MemoryInputStream source(reinterpret_cast<const char*>(in), size);
+		Poco::InflatingInputStream inflater(source, Poco::InflatingStreamBuf::STREAM_ZLIB);
+		std::vector<double> values;
+		for (std::size_t s = 0; s < numOfStreams; ++s)
+		{
+			values.resize(streams[s].count);
+			inflater.read(reinterpret_cast<char*>(values.data()), sizeof(double) * values.size());
+			if ((std::size_t)inflater.gcount() != sizeof(double) * values.size())
+				throw Poco::DataFormatException("deflate stream", "truncated");
+			for (std::size_t i = 0; i < streams[s].count; ++i)
+				streams[s].data[i * streams[s].stride] = values[i];
+		}
+		// the inflater reads ahead, trailing bytes cannot be told apart from the zlib trailer
+		consumed = size;
+		break;
+	}
+
+	default:
+		throw Poco::DataFormatException("job codec", "unknown codec " + std::to_string((uint32_t)codec));
+	}
+
+	if (consumed != size)
+		throw Poco::DataFormatException("encoded section", std::to_string(size - consumed) + " bytes left over");
+}
+
+// encode the sections of a plain single-frame job, out then holds the encoded frame
+inline void encodeJob(const void* frame, JobCodec codec, std::vector<unsigned char>& out)
+{
+	JobHeader header;
+	std::memcpy(&header, frame, sizeof(header));
+	unsigned char* base = static_cast<unsigned char*>(const_cast<void*>(frame));
+	uint32_t doubleCount = (uint32_t)(header.doubles.length / sizeof(double));
+
+	out.assign(alignJob(sizeof(JobHeader)), 0);
+	DoubleStream points[3];
+	pointStreams(reinterpret_cast<double*>(base + header.points.offset), header.pointCount, header.flags, points);
+	header.points.offset = out.size();
+	header.points.length = encodeStreams(codec, points, 3, out);
+
+	out.resize(alignJob(out.size()), 0);
+	DoubleStream doubles = { reinterpret_cast<double*>(base + header.doubles.offset), doubleCount, 1 };
+	header.doubles.offset = out.size();
+	header.doubles.length = encodeStreams(codec, &doubles, 1, out);
+
+	header.headerSize = (uint16_t)sizeof(JobHeader);
+	header.flags |= JOB_FLAG_ENCODED;
+	header.codec = (uint32_t)codec;
+	header.doubleCount = doubleCount;
+	std::memcpy(out.data(), &header, sizeof(header));
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <zmq.hpp>
+
+// Credit a pull worker grants to the pusher over the back channel, one frame:
+//
+//   | JobCreditGrant | identity of the worker |
+//
+// The grant is absolute: since the worker started, it may have been sent limit jobs
+// in total, the jobs it took off its queue plus its window. The pusher counts the jobs
+// it sent to every worker, so a grant repeated while the worker is idle, in case the
+// pusher restarted, does not add anything. A worker that restarts starts a new epoch
+// and counts from zero again.
+
+// "PPCR" in little endian byte order
+#define CREDIT_MAGIC 0x52435050u
+
+struct JobCreditGrant
+{
+	uint32_t magic;
+	// jobs the worker may have queued at once
+	uint32_t window;
+	// chosen by the worker when it starts
+	uint64_t epoch;
+	// jobs taken off the queue since the epoch started, plus the window
+	uint64_t limit;
+};
+
+inline zmq::message_t makeCreditGrant(const std::string& identity, uint64_t epoch, uint64_t taken, uint32_t window)
+{
+	JobCreditGrant grant;
+	std::memset(&grant, 0, sizeof(grant));
+	grant.magic = CREDIT_MAGIC;
+	grant.window = window;
+	grant.epoch = epoch;
+	grant.limit = taken + window;
+	zmq::message_t frame(sizeof(grant) + identity.size());
+	std::memcpy(frame.data(), &grant, sizeof(grant));
+	std::memcpy(static_cast<char*>(frame.data()) + sizeof(grant), identity.data(), identity.size());
+	return frame;
+}
+
+// false if the frame is not a grant
+inline bool readCreditGrant(const zmq::message_t& frame, JobCreditGrant& grant, std::string& identity)
+{
+	if (frame.size() <= sizeof(grant))
+		return false;
+	std::memcpy(&grant, frame.data(), sizeof(grant));
+	if (grant.magic != CREDIT_MAGIC || grant.limit < grant.window)
+		return false;
+	identity.assign(static_cast<const char*>(frame.data()) + sizeof(grant), frame.size() - sizeof(grant));
+	return true;
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include <cstddef>
+#include <cstdio>
+#include <algorithm>
+#include <string>
+#include "JobTypes.h"
+#include "JobView.hpp"
+
+// Bounded text dumps of job payloads for trace logging. The text goes into a
+// buffer owned by the calling thread and reused for every dump, so once it has
+// grown to the size of a dump no further allocation happens. Callers check the
+// logger level first, nothing here is meant to run when trace is disabled.
+
+// points and doubles dumped per job unless configured otherwise
+constexpr std::size_t DEFAULT_DUMP_ITEMS = 8;
+
+// the dump buffer of the calling thread, emptied
+inline std::string& dumpBuffer()
+{
+	thread_local std::string text;
+	text.clear();
+	return text;
+}
+
+// append printf-style formatted text without a temporary string
+template <typename... Args>
+void dumpAppend(std::string& out, const char* fmt, Args... args)
+{
+	char line[128];
+	int n = std::snprintf(line, sizeof(line), fmt, args...);
+	if (n > 0)
+		out.append(line, std::min<std::size_t>((std::size_t)n, sizeof(line) - 1));
+}
+
+// the first maxItems points, one per line, then the bounds of all of them
+inline void dumpPoints(std::string& out, const PointsView& points, std::size_t maxItems)
+{
+	std::size_t shown = std::min(points.size(), maxItems);
+	for (std::size_t i = 0; i < shown; ++i)
+		dumpAppend(out, "\t[ %g, %g, %g ]\n", points.x(i), points.y(i), points.z(i));
+	if (points.empty())
+		return;
+
+	Point3d lower = points[0], upper = points[0];
+	for (std::size_t i = 1; i < points.size(); ++i)
+	{
+		lower.x = std::min(lower.x, points.x(i));
+		lower.y = std::min(lower.y, points.y(i));
+		lower.z = std::min(lower.z, points.z(i));
+		upper.x = std::max(upper.x, points.x(i));
+		upper.y = std::max(upper.y, points.y(i));
+		upper.z = std::max(upper.z, points.z(i));
+	}
+	if (shown < points.size())
+		dumpAppend(out, "\t... %zu more\n", points.size() - shown);
+	dumpAppend(out, "\t%zu points within [ %g, %g, %g ] - [ %g, %g, %g ]\n",
+		points.size(), lower.x, lower.y, lower.z, upper.x, upper.y, upper.z);
+}
+
+// the first maxItems values on one line
+inline void dumpDoubles(std::string& out, const double* values, std::size_t size, std::size_t maxItems)
+{
+	std::size_t shown = std::min(size, maxItems);
+	out += "\t[ ";
+	for (std::size_t i = 0; i < shown; ++i)
+		dumpAppend(out, "%g, ", values[i]);
+	if (shown < size)
+		dumpAppend(out, "... %zu more ", size - shown);
+	out += "]\n";
+}
@@ -0,0 +1,189 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include "JobTypes.h"
+
+// Single-frame job layout, decodable in place by the receiver:
+//
+//   | JobHeader | pad | Point3d section | pad | double section |
+//
+// With JOB_FLAG_SOA the Point3d section holds three lanes instead of interleaved points:
+//
+//   | x lane | pad | y lane | pad | z lane | pad |
+//
+// With JOB_FLAG_ENCODED both sections hold the output of a codec instead, the
+// receiver decodes them into the layout above before handing out views.
+//
+// Every section starts on a JOB_ALIGNMENT boundary counted from the start of the frame.
+// Compatible additions append fields to JobHeader and are recognized by headerSize,
+// the version only changes when an existing field changes its meaning.
+
+// "PPJB" in little endian byte order
+#define JOB_MAGIC 0x424A5050u
+#define JOB_FORMAT_VERSION 1
+
+constexpr std::size_t JOB_ALIGNMENT = 64;
+
+// points are carried as separate x, y and z lanes, each aligned to JOB_ALIGNMENT
+#define JOB_FLAG_SOA 0x0001u
+// the payload sections are encoded with JobHeader::codec, see JobCodec.hpp
+#define JOB_FLAG_ENCODED 0x0002u
+// flags this build understands, a job with any other flag set is rejected
+#define JOB_FLAGS_SUPPORTED (JOB_FLAG_SOA | JOB_FLAG_ENCODED)
+
+// commands a worker sends to a pusher with keyed routing, over its DEALER socket
+#define JOB_ROUTE_HELLO "HELLO"
+#define JOB_ROUTE_BYE "BYE"
+
+enum class JobFormat : uint8_t
+{
+	// five frames: count, Point3d array, array size, double array, scalar
+	Multipart,
+	// one frame starting with a JobHeader
+	SingleFrame,
+	// one frame holding a JobObject handed over within the process, see JobHandoff.hpp
+	Handoff
+};
+
+struct JobSection
+{
+	// from the start of the frame, in bytes
+	uint64_t offset;
+	uint64_t length;
+};
+
+struct JobHeader
+{
+	uint32_t magic;
+	uint16_t version;
+	// size of the header as written by the sender
+	uint16_t headerSize;
+	uint32_t flags;
+	uint32_t pointCount;
+	JobSection points;
+	JobSection doubles;
+	double scalar;
+	// steady clock of the sender in nanoseconds when the job was sent, zero if not stamped
+	uint64_t sendTime;
+	// codec of the payload sections, only valid with JOB_FLAG_ENCODED
+	uint32_t codec;
+	// number of doubles in the double section once decoded, only valid with JOB_FLAG_ENCODED
+	uint32_t doubleCount;
+	// number of the job within the run of the sender starting at 1, zero if not numbered
+	uint64_t sequence;
+	// entity the job belongs to, keyed routing sends the jobs of one key to the same worker
+	uint64_t key;
+};
+
+// the fields every sender writes, a shorter header is invalid
+constexpr std::size_t JOB_HEADER_MIN_SIZE = 56;
+static_assert(sizeof(JobHeader) >= JOB_HEADER_MIN_SIZE, "JobHeader fields can only be appended");
+
+// steady clock in nanoseconds for JobHeader::sendTime, comparable between processes on the same host
+inline uint64_t jobClock()
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+inline std::size_t alignJob(std::size_t n)
+{
+	return (n + JOB_ALIGNMENT - 1) / JOB_ALIGNMENT * JOB_ALIGNMENT;
+}
+
+// distance in bytes between the x, y and z lanes of a JOB_FLAG_SOA job
+inline std::size_t jobLaneStride(std::size_t numOfPoints)
+{
+	return alignJob(sizeof(double) * numOfPoints);
+}
+
+// length in bytes of the Point3d section for the given layout
+inline std::size_t jobPointsLength(std::size_t numOfPoints, uint32_t flags)
+{
+	return (flags & JOB_FLAG_SOA) ? 3 * jobLaneStride(numOfPoints) : sizeof(Point3d) * numOfPoints;
+}
+
+// section offsets and total size of a single-frame job
+class JobLayout
+{
+private:
+	uint32_t _numOfPoints;
+	uint32_t _sizeOfDoubleArray;
+	uint32_t _flags;
+	std::size_t _pointsOffset;
+	std::size_t _doublesOffset;
+	std::size_t _size;
+
+public:
+	JobLayout(uint32_t numOfPoints, uint32_t sizeOfDoubleArray, uint32_t flags = 0)
+		: _numOfPoints(numOfPoints)
+		, _sizeOfDoubleArray(sizeOfDoubleArray)
+		, _flags(flags)
+		, _pointsOffset(alignJob(sizeof(JobHeader)))
+		, _doublesOffset(alignJob(_pointsOffset + jobPointsLength(numOfPoints, flags)))
+		, _size(_doublesOffset + sizeof(double) * sizeOfDoubleArray)
+	{
+	}
+
+	std::size_t size() const { return _size; }
+	bool soa() const { return (_flags & JOB_FLAG_SOA) != 0; }
+
+	// initialize the header at the start of frame, the scalar can be set later through the returned header
+	JobHeader* writeHeader(void* frame) const
+	{
+		JobHeader* header = static_cast<JobHeader*>(frame);
+		std::memset(header, 0, sizeof(JobHeader));
+		header->magic = JOB_MAGIC;
+		header->version = JOB_FORMAT_VERSION;
+		header->headerSize = (uint16_t)sizeof(JobHeader);
+		header->flags = _flags;
+		header->pointCount = _numOfPoints;
+		header->points.offset = _pointsOffset;
+		header->points.length = jobPointsLength(_numOfPoints, _flags);
+		header->doubles.offset = _doublesOffset;
+		header->doubles.length = sizeof(double) * _sizeOfDoubleArray;
+		return header;
+	}
+
+	// interleaved points, only valid without JOB_FLAG_SOA
+	Point3d* points(void* frame) const
+	{
+		return reinterpret_cast<Point3d*>(static_cast<unsigned char*>(frame) + _pointsOffset);
+	}
+
+	// lane 0, 1 or 2 for x, y or z, only valid with JOB_FLAG_SOA
+	double* lane(void* frame, int axis) const
+	{
+		return reinterpret_cast<double*>(static_cast<unsigned char*>(frame) + _pointsOffset + axis * jobLaneStride(_numOfPoints));
+	}
+
+	double* doubles(void* frame) const
+	{
+		return reinterpret_cast<double*>(static_cast<unsigned char*>(frame) + _doublesOffset);
+	}
+};
+
+// the key of a single-frame job, zero if the frame is not one or its header has no key
+inline uint64_t jobKey(const void* data, std::size_t size)
+{
+	JobHeader header;
+	if (size < JOB_HEADER_MIN_SIZE)
+		return 0;
+	std::memcpy(&header, data, std::min(size, sizeof(header)));
+	if (header.magic != JOB_MAGIC || header.headerSize < offsetof(JobHeader, key) + sizeof(header.key) || size < offsetof(JobHeader, key) + sizeof(header.key))
+		return 0;
+	return header.key;
+}
+
+// true if the frame starts with the magic of a single-frame job
+inline bool isSingleFrameJob(const void* data, std::size_t size)
+{
+	uint32_t magic = 0;
+	if (size < sizeof(magic))
+		return false;
+	std::memcpy(&magic, data, sizeof(magic));
+	return magic == JOB_MAGIC;
+}
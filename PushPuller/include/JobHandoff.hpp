@@ -0,0 +1,71 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <vector>
+#include <zmq.hpp>
+#include "JobTypes.h"
+#include "JobFormat.hpp"
+
+// Jobs handed between the tasks of one process without serialization. The frame
+// of the message is the JobObject itself: ZeroMQ passes a message that wraps user
+// memory between the sockets of one context by pointer, so the receiver reads the
+// arrays where the sender filled them. The last message referring to the object
+// deletes it, a job dropped on the way or discarded on shutdown is freed as well.
+// Such a frame means nothing outside the process that made it, it must only be
+// sent over inproc:// and a receiver rejects one that carries another process id.
+
+// "PPHO" in little endian byte order
+#define JOB_HANDOFF_MAGIC 0x4F485050u
+
+struct JobObject
+{
+	uint32_t magic;
+	// handoffProcess() of the process that made the object
+	uint64_t process;
+	// pointCount, scalar, sendTime, sequence and key apply, the sections are unused
+	JobHeader header;
+	std::vector<Point3d> points;
+	std::vector<double> doubles;
+};
+
+// random per process, tells a handed over object from the bytes of one that went over the wire
+inline uint64_t handoffProcess()
+{
+	static const uint64_t process = ((uint64_t)std::random_device()() << 32) ^ std::random_device()() ^ 1;
+	return process;
+}
+
+inline void deleteJobObject(void* data, void* hint)
+{
+	delete static_cast<JobObject*>(data);
+}
+
+// wrap the object in a frame that takes it over
+inline zmq::message_t handOff(std::unique_ptr<JobObject> job)
+{
+	job->magic = JOB_HANDOFF_MAGIC;
+	job->process = handoffProcess();
+	JobObject* object = job.release();
+	return zmq::message_t(object, sizeof(JobObject), &deleteJobObject, nullptr);
+}
+
+// true if the frame is a JobObject handed over within this process
+inline bool isJobObject(const void* data, std::size_t size)
+{
+	uint32_t magic = 0;
+	uint64_t process = 0;
+	if (size != sizeof(JobObject))
+		return false;
+	std::memcpy(&magic, static_cast<const unsigned char*>(data) + offsetof(JobObject, magic), sizeof(magic));
+	std::memcpy(&process, static_cast<const unsigned char*>(data) + offsetof(JobObject, process), sizeof(process));
+	return magic == JOB_HANDOFF_MAGIC && process == handoffProcess();
+}
+
+// the object of a frame for which isJobObject() holds, owned by the frame
+inline const JobObject& jobObject(const zmq::message_t& frame)
+{
+	return *static_cast<const JobObject*>(frame.data());
+}
@@ -0,0 +1,75 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <Poco/Exception.h>
+#include <zmq_addon.hpp>
+#include "JobView.hpp"
+#include "JobRing.hpp"
+
+// Reads the job of a received message the way every puller does. A descriptor of a job in
+// the shared memory ring of the pusher is read where the pusher wrote it, and the region
+// is released once the job was processed; whatever was computed from it is valid only if
+// the lease still held then, read() throws otherwise. Handed over objects are accepted
+// only if the caller received them from the pusher of its own process, see JobHandoff.hpp.
+// PullWorker and the bench read their jobs the same way through this.
+class JobReader
+{
+private:
+	// decoded payload of encoded jobs and aligned copies of misaligned frames, reused by every job
+	std::vector<double> _decoded;
+	// the shared memory ring of the pusher, mapped once a descriptor arrives
+	JobRingReader _ring;
+	// jobs read from the ring, and those lost because the pusher took their region back
+	uint64_t _shared;
+	uint64_t _lost;
+	// jobs read from aligned copies of misaligned frames
+	uint64_t _copied;
+
+public:
+	JobReader()
+		: _shared(0)
+		, _lost(0)
+		, _copied(0)
+	{
+	}
+
+	// calls process(const JobView&) with the job, its views are valid during the call only;
+	// throws if the job is invalid, or if the pusher took its region of the ring back meanwhile
+	template <typename Process>
+	void read(zmq::multipart_t&& msg, bool handoff, Process process)
+	{
+		if (msg.size() == 1 && isRingDescriptor(msg.peek(0)->data(), msg.peek(0)->size()))
+		{
+			JobRingDescriptor descriptor;
+			std::string name = readRingDescriptor(msg.peek(0)->data(), msg.peek(0)->size(), descriptor);
+			// the region is released when the job is done, or given up
+			JobRingLease lease(_ring, descriptor, name);
+			{
+				zmq::multipart_t msgShared;
+				msgShared.add(lease.frame());
+				JobView job(std::move(msgShared), &_decoded);
+				process(job);
+			}
+			// the pusher takes a region back whose lease expired, it may have been overwritten meanwhile
+			if (!lease.release())
+			{
+				++_lost;
+				throw Poco::DataFormatException("shared job", "lease expired before the job was done");
+			}
+			++_shared;
+			return;
+		}
+		// frames are decoded in place, the view keeps them alive until the job is done
+		JobView job(std::move(msg), &_decoded, handoff);
+		if (job.copied())
+			++_copied;
+		process(job);
+	}
+
+	JobRingReader& ring() { return _ring; }
+	uint64_t shared() const { return _shared; }
+	uint64_t lost() const { return _lost; }
+	uint64_t copied() const { return _copied; }
+};
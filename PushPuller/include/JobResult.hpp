@@ -0,0 +1,67 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <Poco/Exception.h>
+#include <zmq.hpp>
+
+// Results pushed by the pull workers to the sink, two frames:
+//
+//   | ResultHeader | payload |
+//
+// The payload is whatever the worker computed for the job, e.g. PointStats,
+// and may be empty. The sink orders results by the sequence number of the job,
+// results of jobs without one (multipart format) can only be delivered unordered.
+
+// "PPRS" in little endian byte order
+#define RESULT_MAGIC 0x53525050u
+#define RESULT_FORMAT_VERSION 1
+
+// the payload holds PointStats of the job
+#define RESULT_FLAG_POINT_STATS 0x0001u
+
+struct ResultHeader
+{
+	uint32_t magic;
+	uint16_t version;
+	// size of the header as written by the worker
+	uint16_t headerSize;
+	uint32_t flags;
+	// pull worker that processed the job
+	uint32_t worker;
+	// JobHeader::sequence of the job, zero if not numbered
+	uint64_t sequence;
+	// JobHeader::sendTime of the job, zero if not stamped
+	uint64_t sendTime;
+};
+
+inline ResultHeader makeResultHeader(uint32_t worker, uint64_t sequence, uint64_t sendTime, uint32_t flags = 0)
+{
+	ResultHeader header;
+	std::memset(&header, 0, sizeof(header));
+	header.magic = RESULT_MAGIC;
+	header.version = RESULT_FORMAT_VERSION;
+	header.headerSize = (uint16_t)sizeof(ResultHeader);
+	header.flags = flags;
+	header.worker = worker;
+	header.sequence = sequence;
+	header.sendTime = sendTime;
+	return header;
+}
+
+// copy the header out of the first frame of a result, a newer worker may have appended fields
+inline ResultHeader readResultHeader(const zmq::message_t& frame)
+{
+	ResultHeader header;
+	if (frame.size() < sizeof(header))
+		throw Poco::DataFormatException("result header", "frame of " + std::to_string(frame.size()) + " bytes");
+	std::memcpy(&header, frame.data(), sizeof(header));
+	if (header.magic != RESULT_MAGIC)
+		throw Poco::DataFormatException("result header", "bad magic");
+	if (header.version == 0 || header.version > RESULT_FORMAT_VERSION)
+		throw Poco::DataFormatException("result header", "unsupported version " + std::to_string(header.version));
+	if (header.headerSize < sizeof(ResultHeader) || header.headerSize > frame.size())
+		throw Poco::DataFormatException("result header", "invalid header size " + std::to_string(header.headerSize));
+	return header;
+}
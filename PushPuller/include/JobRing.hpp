@@ -0,0 +1,398 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <string>
+#include <Poco/Exception.h>
+#include <Poco/SharedMemory.h>
+#include <zmq.hpp>
+#include "JobFormat.hpp"
+#if defined(POCO_OS_FAMILY_UNIX)
+#include <sys/mman.h>
+#endif
+
+// JobRing lets a pusher and pullers on the same host exchange jobs through a named
+// shared memory segment instead of the socket. The pusher writes the single-frame job
+// into a region of the ring and sends only a descriptor naming the segment, the offset
+// and length of the job and the generation of the region. The puller maps the segment,
+// processes the job in place and releases the region.
+//
+// Every region starts with a RingBlock whose state holds the generation while the job
+// is out and 0 once it is released. A region never wraps around the end of the ring,
+// the rest of the lap is skipped with a released block. The pusher is the only one to
+// allocate: it takes back regions in ring order once they are released, or once their
+// lease expired, which is how the regions of a crashed puller return to the ring.
+// A puller releases a region by swapping the generation for 0, if that fails the
+// pusher took the region back in the meantime and whatever the puller read from it
+// must be discarded.
+//
+// On Windows the segment lives as long as a process maps it. A pusher that restarts
+// takes over a segment left by its predecessor under a new segment id, descriptors of
+// the old one are rejected and the pullers map the segment again. A POSIX segment is
+// removed only when its pusher closes it cleanly, one left by a crashed pusher stays in
+// /dev/shm; a pusher that starts unlinks the name first and creates a new segment, so
+// a stale one is never resized under the pullers that still map it. They keep it until
+// the first descriptor of the new segment makes them map that one, then it is freed.
+
+#define RING_MAGIC 0x474E4952u // "RING"
+#define RING_VERSION 1
+#define RING_DESCRIPTOR_MAGIC 0x44525050u // "PPRD"
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "the ring needs lock-free 64-bit atomics shared between processes");
+
+struct RingHeader
+{
+	uint32_t magic;
+	uint16_t version;
+	uint16_t headerSize;
+	// bytes of the ring following the header
+	uint64_t capacity;
+	// random per pusher run, written last when the pusher takes the segment over
+	std::atomic<uint64_t> segment;
+};
+
+struct RingBlock
+{
+	// generation of the job in the region, 0 once it is released
+	std::atomic<uint64_t> state;
+	// bytes of the region including this block
+	uint64_t size;
+	// jobClock() after which the pusher takes the region back
+	uint64_t leaseUntil;
+};
+
+// sent in place of the job, followed by the name of the segment
+struct JobRingDescriptor
+{
+	uint32_t magic;
+	uint16_t version;
+	uint16_t nameLength;
+	uint64_t segment;
+	// the job within the segment
+	uint64_t offset;
+	uint64_t length;
+	uint64_t generation;
+	// JobHeader::key of the job, for keyed routing
+	uint64_t key;
+};
+
+// both the header and every block take one cache line, the jobs start on JOB_ALIGNMENT
+constexpr std::size_t RING_HEADER_SIZE = 64;
+constexpr std::size_t RING_BLOCK_SIZE = 64;
+static_assert(RING_BLOCK_SIZE % JOB_ALIGNMENT == 0 || JOB_ALIGNMENT % RING_BLOCK_SIZE == 0, "blocks must keep the jobs aligned");
+
+// true if the frame is a descriptor of a job in a shared memory ring
+inline bool isRingDescriptor(const void* data, std::size_t size)
+{
+	uint32_t magic = 0;
+	if (size < sizeof(JobRingDescriptor))
+		return false;
+	std::memcpy(&magic, data, sizeof(magic));
+	return magic == RING_DESCRIPTOR_MAGIC;
+}
+
+// read and check a descriptor, returns the name of the segment
+inline std::string readRingDescriptor(const void* data, std::size_t size, JobRingDescriptor& descriptor)
+{
+	if (!isRingDescriptor(data, size))
+		throw Poco::DataFormatException("ring descriptor", "no descriptor");
+	std::memcpy(&descriptor, data, sizeof(descriptor));
+	if (descriptor.version != RING_VERSION)
+		throw Poco::DataFormatException("ring descriptor", "unsupported version " + std::to_string(descriptor.version));
+	if (size != sizeof(descriptor) + descriptor.nameLength || descriptor.nameLength == 0)
+		throw Poco::DataFormatException("ring descriptor", "invalid segment name");
+	return std::string(static_cast<const char*>(data) + sizeof(descriptor), descriptor.nameLength);
+}
+
+// the pusher side, allocates the regions and takes them back, used by one thread
+class JobRingWriter
+{
+private:
+	std::string _name;
+	Poco::SharedMemory _mapping;
+	RingHeader* _header;
+	unsigned char* _ring;
+	uint64_t _capacity;
+	// positions in bytes since the segment was taken over, the offset is their remainder by the capacity
+	uint64_t _head;
+	uint64_t _tail;
+	uint64_t _segment;
+	uint64_t _generation;
+	// nanoseconds a puller may hold a region
+	uint64_t _lease;
+	uint64_t _expired;
+
+	RingBlock* block(uint64_t pos) const
+	{
+		return reinterpret_cast<RingBlock*>(_ring + pos % _capacity);
+	}
+
+public:
+
+	// create the segment, or take over the one a previous pusher left, capacity is rounded to
+	// the job alignment, leaseMilliseconds bounds how long a region may stay out
+	JobRingWriter(const std::string& name, std::size_t capacity, long leaseMilliseconds)
+		: _name(name)
+		, _header(nullptr)
+		, _ring(nullptr)
+		, _capacity(alignJob(capacity))
+		, _head(0)
+		, _tail(0)
+		, _lease((uint64_t)std::max(1L, leaseMilliseconds) * 1000000)
+		, _expired(0)
+	{
+		if (_name.empty() || _name.size() > 0xFFFF)
+			throw Poco::InvalidArgumentException("job ring", "invalid segment name");
+		if (_capacity < 2 * RING_BLOCK_SIZE)
+			throw Poco::InvalidArgumentException("job ring", "capacity of at least 128 bytes required");
+
+#if defined(POCO_OS_FAMILY_UNIX)
+		// Poco::SharedMemory names the POSIX segment with a leading slash
+		shm_unlink(("/" + _name).c_str());
+#endif
+		Poco::SharedMemory mapping(_name, RING_HEADER_SIZE + _capacity, Poco::SharedMemory::AM_WRITE);
+		_mapping.swap(mapping);
+		_header = reinterpret_cast<RingHeader*>(_mapping.begin());
+		_ring = reinterpret_cast<unsigned char*>(_mapping.begin()) + RING_HEADER_SIZE;
+
+		// pullers check the segment id before anything else, it is cleared first and set last
+		std::random_device random;
+		_segment = ((uint64_t)random() << 32) ^ random();
+		_header->segment.store(0, std::memory_order_release);
+		_header->magic = RING_MAGIC;
+		_header->version = RING_VERSION;
+		_header->headerSize = (uint16_t)sizeof(RingHeader);
+		_header->capacity = _capacity;
+		// regions left behind by the previous pusher are discarded, generations start anew from the segment id
+		_generation = _segment;
+		_header->segment.store(_segment, std::memory_order_release);
+	}
+
+	JobRingWriter(const JobRingWriter&) = delete;
+	JobRingWriter& operator=(const JobRingWriter&) = delete;
+
+	~JobRingWriter()
+	{
+		// descriptors still queued are rejected once the segment id is gone
+		if (_header)
+			_header->segment.store(0, std::memory_order_release);
+	}
+
+	// take back the released regions at the head, and those whose lease expired
+	void reclaim()
+	{
+		uint64_t now = jobClock();
+		while (_head < _tail)
+		{
+			RingBlock* oldest = block(_head);
+			uint64_t state = oldest->state.load(std::memory_order_acquire);
+			// a late release by a puller that lost the lease fails on the swapped state
+			if (state != 0 && (now < oldest->leaseUntil || !oldest->state.compare_exchange_strong(state, 0)))
+				break;
+			if (state != 0)
+				++_expired;
+			uint64_t size = oldest->size;
+			if (size < RING_BLOCK_SIZE || size > _tail - _head || size % RING_BLOCK_SIZE != 0)
+			{
+				// only this process writes the sizes, a broken one drops whatever is out
+				_head = _tail;
+				break;
+			}
+			_head += size;
+		}
+	}
+
+	// a region for a job of size bytes, the descriptor is filled in, null if the ring is full
+	void* allocate(std::size_t size, JobRingDescriptor& descriptor)
+	{
+		reclaim();
+		uint64_t need = RING_BLOCK_SIZE + alignJob(size);
+		uint64_t rest = _capacity - _tail % _capacity;
+		uint64_t skip = (need > rest) ? rest : 0;
+		if (need > _capacity || _tail + skip + need - _head > _capacity)
+			return nullptr;
+		if (skip > 0)
+		{
+			// a region never wraps, the rest of the lap is a released block
+			RingBlock* wrap = block(_tail);
+			wrap->size = skip;
+			wrap->leaseUntil = 0;
+			wrap->state.store(0, std::memory_order_release);
+			_tail += skip;
+		}
+
+		RingBlock* region = block(_tail);
+		if (++_generation == 0)
+			++_generation;
+		region->size = need;
+		region->leaseUntil = jobClock() + _lease;
+		region->state.store(_generation, std::memory_order_release);
+
+		std::memset(&descriptor, 0, sizeof(descriptor));
+		descriptor.magic = RING_DESCRIPTOR_MAGIC;
+		descriptor.version = RING_VERSION;
+		descriptor.nameLength = (uint16_t)_name.size();
+		descriptor.segment = _segment;
+		descriptor.offset = RING_HEADER_SIZE + _tail % _capacity + RING_BLOCK_SIZE;
+		descriptor.length = size;
+		descriptor.generation = _generation;
+		_tail += need;
+		return reinterpret_cast<unsigned char*>(_mapping.begin()) + descriptor.offset;
+	}
+
+	// give back the region of a job that was not sent
+	void discard(const JobRingDescriptor& descriptor)
+	{
+		if (descriptor.segment != _segment || descriptor.offset < RING_HEADER_SIZE + RING_BLOCK_SIZE
+			|| descriptor.offset - RING_HEADER_SIZE - RING_BLOCK_SIZE >= _capacity)
+			return;
+		uint64_t generation = descriptor.generation;
+		block(descriptor.offset - RING_HEADER_SIZE - RING_BLOCK_SIZE)->state.compare_exchange_strong(generation, 0);
+	}
+
+	// the frame sent in place of the job
+	zmq::message_t frame(const JobRingDescriptor& descriptor) const
+	{
+		zmq::message_t frameDescriptor(sizeof(descriptor) + _name.size());
+		std::memcpy(frameDescriptor.data(), &descriptor, sizeof(descriptor));
+		std::memcpy(static_cast<unsigned char*>(frameDescriptor.data()) + sizeof(descriptor), _name.data(), _name.size());
+		return frameDescriptor;
+	}
+
+	const std::string& name() const { return _name; }
+	uint64_t capacity() const { return _capacity; }
+	// bytes of the regions not taken back yet
+	uint64_t used() const { return _tail - _head; }
+	// regions taken back from pullers that did not release them in time
+	uint64_t expired() const { return _expired; }
+};
+
+// the puller side, maps the segment of the descriptors it receives, used by one thread
+class JobRingReader
+{
+private:
+	std::string _name;
+	std::unique_ptr<Poco::SharedMemory> _mapping;
+	std::size_t _size;
+
+	const RingHeader* header() const
+	{
+		return reinterpret_cast<const RingHeader*>(_mapping->begin());
+	}
+
+	void map(const std::string& name)
+	{
+		_mapping.reset();
+		_size = 0;
+		// the header tells the size of the whole segment
+		Poco::SharedMemory probe(name, RING_HEADER_SIZE, Poco::SharedMemory::AM_WRITE, 0, false);
+		RingHeader* probed = reinterpret_cast<RingHeader*>(probe.begin());
+		if (probed->magic != RING_MAGIC || probed->version != RING_VERSION)
+			throw Poco::DataFormatException("job ring", name + " is not a job ring");
+		std::size_t size = RING_HEADER_SIZE + (std::size_t)probed->capacity;
+		_mapping.reset(new Poco::SharedMemory(name, size, Poco::SharedMemory::AM_WRITE, 0, false));
+		_name = name;
+		_size = size;
+	}
+
+	// the block of the region the descriptor refers to
+	RingBlock* block(const JobRingDescriptor& descriptor) const
+	{
+		return reinterpret_cast<RingBlock*>(_mapping->begin() + descriptor.offset - RING_BLOCK_SIZE);
+	}
+
+public:
+
+	JobRingReader()
+		: _size(0)
+	{
+	}
+
+	// the job a descriptor refers to, the segment is mapped again when the pusher took it
+	// over since, a descriptor whose region was taken back is rejected
+	const void* acquire(const JobRingDescriptor& descriptor, const std::string& name)
+	{
+		bool fits = descriptor.offset >= RING_HEADER_SIZE + RING_BLOCK_SIZE && descriptor.length <= _size
+			&& descriptor.offset <= _size - descriptor.length;
+		if (!_mapping || name != _name || header()->segment.load(std::memory_order_acquire) != descriptor.segment || !fits)
+		{
+			map(name);
+			fits = descriptor.offset >= RING_HEADER_SIZE + RING_BLOCK_SIZE && descriptor.length <= _size
+				&& descriptor.offset <= _size - descriptor.length;
+		}
+		if (header()->segment.load(std::memory_order_acquire) != descriptor.segment)
+			throw Poco::DataFormatException("job ring", "descriptor of a segment " + name + " no longer holds");
+		if (!fits)
+			throw Poco::DataFormatException("job ring", "descriptor exceeds segment " + name);
+		if (block(descriptor)->state.load(std::memory_order_acquire) != descriptor.generation)
+			throw Poco::DataFormatException("job ring", "region taken back before the job arrived");
+		return _mapping->begin() + descriptor.offset;
+	}
+
+	// give the region back, false if the pusher took it back already and the job must be discarded
+	bool release(const JobRingDescriptor& descriptor)
+	{
+		if (!_mapping || header()->segment.load(std::memory_order_acquire) != descriptor.segment)
+			return false;
+		uint64_t generation = descriptor.generation;
+		return block(descriptor)->state.compare_exchange_strong(generation, 0, std::memory_order_acq_rel);
+	}
+
+	bool mapped() const
+	{
+		return _mapping != nullptr;
+	}
+
+	// unmap the segment, e.g. when the pusher is gone
+	void close()
+	{
+		_mapping.reset();
+		_name.clear();
+		_size = 0;
+	}
+};
+
+// holds the region of one received job, released when the job is done or given up
+class JobRingLease
+{
+private:
+	JobRingReader& _reader;
+	JobRingDescriptor _descriptor;
+	const void* _data;
+	bool _released;
+
+public:
+	JobRingLease(JobRingReader& reader, const JobRingDescriptor& descriptor, const std::string& name)
+		: _reader(reader)
+		, _descriptor(descriptor)
+		, _data(reader.acquire(descriptor, name))
+		, _released(false)
+	{
+	}
+
+	JobRingLease(const JobRingLease&) = delete;
+	JobRingLease& operator=(const JobRingLease&) = delete;
+
+	~JobRingLease()
+	{
+		if (!_released)
+			_reader.release(_descriptor);
+	}
+
+	// a frame over the job in the segment, it does not own the memory
+	zmq::message_t frame() const
+	{
+		return zmq::message_t(const_cast<void*>(_data), (std::size_t)_descriptor.length, nullptr, nullptr);
+	}
+
+	// true if the region was still held, whatever was read from it is valid only then
+	bool release()
+	{
+		_released = true;
+		return _reader.release(_descriptor);
+	}
+};
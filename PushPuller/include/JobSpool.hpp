@@ -0,0 +1,285 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <Poco/Exception.h>
+#include <Poco/File.h>
+#include <Poco/SharedMemory.h>
+#include <zmq_addon.hpp>
+#include "BufferPool.hpp"
+
+// JobSpool keeps jobs that cannot be sent in a ring of records inside a memory
+// mapped file, so they survive a restart of the process. A record is a job with
+// all of its frames:
+//
+//   uint32_t length    bytes of the record without the padding
+//   uint32_t frames    number of frames
+//   frames times { uint32_t size, size bytes }
+//
+// padded to 8 bytes. A record never wraps around the end of the ring, the rest
+// of the lap is skipped instead and marked with SPOOL_WRAP when there is room
+// for the marker. head and tail in the file header count bytes since the spool
+// was created, the offset in the ring is their remainder by the capacity.
+//
+// The frames are copied straight into the mapping and the tail is moved only
+// after the record is complete, so a record cut short by a crash is not seen.
+// Nothing is flushed per record, the operating system writes the pages back.
+// A spool is used by one thread at a time.
+
+#define SPOOL_MAGIC 0x4C4F5053u // "SPOL"
+#define SPOOL_VERSION 1
+#define SPOOL_WRAP 0xFFFFFFFFu
+
+struct SpoolHeader
+{
+	uint32_t magic;
+	uint16_t version;
+	uint16_t headerSize;
+	// bytes of the ring following the header
+	uint64_t capacity;
+	// position of the oldest record
+	uint64_t head;
+	// position the next record is written to
+	uint64_t tail;
+};
+
+class JobSpool
+{
+public:
+	// the ring starts on a cache line
+	static constexpr std::size_t HEADER_SIZE = 64;
+	static constexpr std::size_t RECORD_ALIGNMENT = 8;
+
+private:
+	std::string _path;
+	Poco::SharedMemory _mapping;
+	SpoolHeader* _header;
+	unsigned char* _ring;
+	uint64_t _records;
+
+	static std::size_t pad(std::size_t n)
+	{
+		return (n + RECORD_ALIGNMENT - 1) / RECORD_ALIGNMENT * RECORD_ALIGNMENT;
+	}
+
+	uint32_t load32(uint64_t offset) const
+	{
+		uint32_t value;
+		std::memcpy(&value, _ring + offset, sizeof(value));
+		return value;
+	}
+
+	void store32(uint64_t offset, uint32_t value)
+	{
+		std::memcpy(_ring + offset, &value, sizeof(value));
+	}
+
+	// position of the first record at or after pos, skipping the end of a lap
+	uint64_t recordStart(uint64_t pos) const
+	{
+		uint64_t offset = pos % _header->capacity;
+		uint64_t rest = _header->capacity - offset;
+		if (rest < 2 * sizeof(uint32_t) || load32(offset) == SPOOL_WRAP)
+			return pos + rest;
+		return pos;
+	}
+
+	// length of the record at pos, 0 if it is not a valid record
+	std::size_t recordLength(uint64_t pos) const
+	{
+		uint64_t offset = pos % _header->capacity;
+		uint64_t rest = _header->capacity - offset;
+		uint32_t length = load32(offset);
+		uint32_t frames = load32(offset + sizeof(uint32_t));
+		if (length < 2 * sizeof(uint32_t) + frames * sizeof(uint32_t) || length > rest || pad(length) > _header->tail - pos)
+			return 0;
+
+		// the frame sizes have to add up to the record length
+		std::size_t at = 2 * sizeof(uint32_t);
+		for (uint32_t i = 0; i < frames; ++i)
+		{
+			if (length - at < sizeof(uint32_t))
+				return 0;
+			uint32_t size = load32(offset + at);
+			at += sizeof(uint32_t);
+			if (length - at < size)
+				return 0;
+			at += size;
+		}
+		return at == length ? length : 0;
+	}
+
+	void create(const Poco::File& file, std::size_t capacity)
+	{
+		Poco::File(file).setSize(HEADER_SIZE + capacity);
+		Poco::SharedMemory mapping(file, Poco::SharedMemory::AM_WRITE);
+		SpoolHeader header = { SPOOL_MAGIC, SPOOL_VERSION, (uint16_t)sizeof(SpoolHeader), capacity, 0, 0 };
+		std::memcpy(mapping.begin(), &header, sizeof(header));
+		_mapping.swap(mapping);
+	}
+
+public:
+
+	// open the spool at path or create it with capacity bytes, an existing spool keeps
+	// its records and its capacity, a file that is not a spool is left alone
+	JobSpool(const std::string& path, std::size_t capacity)
+		: _path(path)
+		, _header(nullptr)
+		, _ring(nullptr)
+		, _records(0)
+	{
+		capacity = pad(capacity);
+		if (capacity < 1024)
+			throw Poco::InvalidArgumentException("job spool", "capacity of at least 1 KB required");
+
+		Poco::File file(path);
+		if (!file.exists() || file.getSize() == 0)
+		{
+			file.createFile();
+			create(file, capacity);
+		}
+		else
+		{
+			if (file.getSize() < HEADER_SIZE)
+				throw Poco::DataFormatException("job spool", path + " is not a job spool");
+			Poco::SharedMemory mapping(file, Poco::SharedMemory::AM_WRITE);
+			SpoolHeader header;
+			std::memcpy(&header, mapping.begin(), sizeof(header));
+			if (header.magic != SPOOL_MAGIC || header.version != SPOOL_VERSION || header.headerSize < sizeof(SpoolHeader)
+				|| header.capacity % RECORD_ALIGNMENT != 0 || HEADER_SIZE + header.capacity > file.getSize()
+				|| header.head > header.tail || header.tail - header.head > header.capacity)
+				throw Poco::DataFormatException("job spool", path + " is not a job spool or is damaged");
+			_mapping.swap(mapping);
+		}
+
+		_header = reinterpret_cast<SpoolHeader*>(_mapping.begin());
+		_ring = reinterpret_cast<unsigned char*>(_mapping.begin()) + HEADER_SIZE;
+
+		// count the records left by the previous run, a damaged one ends the spool there
+		uint64_t pos = _header->head;
+		while (pos < _header->tail)
+		{
+			pos = recordStart(pos);
+			if (pos >= _header->tail)
+				break;
+			std::size_t length = recordLength(pos);
+			if (length == 0)
+			{
+				_header->tail = pos;
+				break;
+			}
+			pos += pad(length);
+			++_records;
+		}
+		if (_records == 0)
+			_header->head = _header->tail;
+	}
+
+	JobSpool(const JobSpool&) = delete;
+	JobSpool& operator=(const JobSpool&) = delete;
+
+	const std::string& path() const
+	{
+		return _path;
+	}
+
+	bool empty() const
+	{
+		return _records == 0;
+	}
+
+	uint64_t records() const
+	{
+		return _records;
+	}
+
+	// bytes of the ring in use, including skipped lap ends
+	uint64_t used() const
+	{
+		return _header->tail - _header->head;
+	}
+
+	uint64_t capacity() const
+	{
+		return _header->capacity;
+	}
+
+	// append a job at the tail, false if it does not fit
+	bool append(const zmq::multipart_t& msg)
+	{
+		std::size_t length = 2 * sizeof(uint32_t);
+		for (std::size_t i = 0; i < msg.size(); ++i)
+			length += sizeof(uint32_t) + msg.peek(i)->size();
+		if (length > UINT32_MAX - RECORD_ALIGNMENT)
+			return false;
+		std::size_t padded = pad(length);
+
+		uint64_t pos = _header->tail;
+		uint64_t offset = pos % _header->capacity;
+		uint64_t rest = _header->capacity - offset;
+		if (rest < padded)
+		{
+			// the record starts the next lap, the rest of this one is skipped
+			if (used() + rest + padded > _header->capacity)
+				return false;
+			if (rest >= sizeof(uint32_t))
+				store32(offset, SPOOL_WRAP);
+			pos += rest;
+			offset = 0;
+		}
+		else if (used() + padded > _header->capacity)
+			return false;
+
+		store32(offset, (uint32_t)length);
+		store32(offset + sizeof(uint32_t), (uint32_t)msg.size());
+		std::size_t at = offset + 2 * sizeof(uint32_t);
+		for (std::size_t i = 0; i < msg.size(); ++i)
+		{
+			const zmq::message_t* frame = msg.peek(i);
+			store32(at, (uint32_t)frame->size());
+			at += sizeof(uint32_t);
+			std::memcpy(_ring + at, frame->data(), frame->size());
+			at += frame->size();
+		}
+		// publish the record only once it is complete
+		_header->tail = pos + padded;
+		++_records;
+		return true;
+	}
+
+	// copy the oldest job into buffers of the pool, the record stays until pop()
+	zmq::multipart_t front(BufferPool& pool) const
+	{
+		if (empty())
+			throw Poco::IllegalStateException("job spool", "empty");
+
+		uint64_t offset = recordStart(_header->head) % _header->capacity;
+		uint32_t frames = load32(offset + sizeof(uint32_t));
+		std::size_t at = offset + 2 * sizeof(uint32_t);
+		zmq::multipart_t msg;
+		for (uint32_t i = 0; i < frames; ++i)
+		{
+			uint32_t size = load32(at);
+			at += sizeof(uint32_t);
+			// buffers of the pool are aligned, the payload may be read in place again
+			zmq::message_t frame = pool.acquire(size);
+			std::memcpy(frame.data(), _ring + at, size);
+			at += size;
+			msg.add(std::move(frame));
+		}
+		return msg;
+	}
+
+	// drop the oldest job
+	void pop()
+	{
+		if (empty())
+			throw Poco::IllegalStateException("job spool", "empty");
+
+		uint64_t pos = recordStart(_header->head);
+		_header->head = pos + pad(load32(pos % _header->capacity));
+		if (--_records == 0)
+			_header->head = _header->tail;
+	}
+};
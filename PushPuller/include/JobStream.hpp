@@ -0,0 +1,452 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <Poco/Exception.h>
+#include <zmq.hpp>
+#include "JobTypes.h"
+#include "JobFormat.hpp"
+
+// Jobs too large for one message are sent as a stream of chunks, one frame each:
+//
+//   | JobChunkHeader | bytes offset ... offset + length of the single-frame job |
+//
+// Together the chunks of a stream carry the bytes of one single-frame job in order,
+// the first one holds at least the JobHeader. The receiver hands the points and doubles
+// to a JobStreamConsumer as the chunks arrive instead of putting the job together first.
+// All chunks of a stream must reach the same receiver, every chunk carries the key of
+// its job so that keyed routing sends them where the job would go.
+
+// "PPCK" in little endian byte order
+#define CHUNK_MAGIC 0x4B435050u
+#define CHUNK_FORMAT_VERSION 1
+
+// the chunk completes its stream
+#define CHUNK_FLAG_LAST 0x0001u
+// flags this build understands, a chunk with any other flag set is rejected
+#define CHUNK_FLAGS_SUPPORTED (CHUNK_FLAG_LAST)
+
+struct JobChunkHeader
+{
+	uint32_t magic;
+	uint16_t version;
+	// size of the header as written by the sender, the chunk bytes follow it
+	uint16_t headerSize;
+	uint32_t flags;
+	uint32_t reserved;
+	// JobHeader::sequence of the streamed job, unique within the run of the sender
+	uint64_t stream;
+	// position of the chunk bytes within the job
+	uint64_t offset;
+	// size of the whole job in bytes
+	uint64_t total;
+	// JobHeader::key of the streamed job
+	uint64_t key;
+};
+
+inline JobChunkHeader makeChunkHeader(uint64_t stream, uint64_t offset, uint64_t total, uint64_t key, uint32_t flags = 0)
+{
+	JobChunkHeader header;
+	std::memset(&header, 0, sizeof(header));
+	header.magic = CHUNK_MAGIC;
+	header.version = CHUNK_FORMAT_VERSION;
+	header.headerSize = (uint16_t)sizeof(JobChunkHeader);
+	header.flags = flags;
+	header.stream = stream;
+	header.offset = offset;
+	header.total = total;
+	header.key = key;
+	return header;
+}
+
+// true if the frame starts with the magic of a chunk
+inline bool isJobChunk(const void* data, std::size_t size)
+{
+	uint32_t magic = 0;
+	if (size < sizeof(magic))
+		return false;
+	std::memcpy(&magic, data, sizeof(magic));
+	return magic == CHUNK_MAGIC;
+}
+
+// copy the header out of a chunk, a newer sender may have appended fields
+inline JobChunkHeader readChunkHeader(const zmq::message_t& frame)
+{
+	JobChunkHeader header;
+	if (frame.size() < sizeof(header))
+		throw Poco::DataFormatException("chunk header", "frame of " + std::to_string(frame.size()) + " bytes");
+	std::memcpy(&header, frame.data(), sizeof(header));
+	if (header.magic != CHUNK_MAGIC)
+		throw Poco::DataFormatException("chunk header", "bad magic");
+	if (header.version == 0 || header.version > CHUNK_FORMAT_VERSION)
+		throw Poco::DataFormatException("chunk header", "unsupported version " + std::to_string(header.version));
+	if (header.headerSize < sizeof(JobChunkHeader) || header.headerSize > frame.size())
+		throw Poco::DataFormatException("chunk header", "invalid header size " + std::to_string(header.headerSize));
+	if (header.flags & ~CHUNK_FLAGS_SUPPORTED)
+		throw Poco::DataFormatException("chunk header", "unsupported flags " + std::to_string(header.flags));
+	std::size_t length = frame.size() - header.headerSize;
+	if (header.offset > header.total || length > header.total - header.offset)
+		throw Poco::DataFormatException("chunk header", "chunk exceeds the job of " + std::to_string(header.total) + " bytes");
+	if ((header.flags & CHUNK_FLAG_LAST) && header.offset + length != header.total)
+		throw Poco::DataFormatException("chunk header", "last chunk ends before the job");
+	return header;
+}
+
+// the key a job or a chunk of one is routed by, all chunks of a stream go where the job would go;
+// complete is set if the frame is a whole job or the last chunk of one
+inline uint64_t routingKey(const void* data, std::size_t size, bool& complete)
+{
+	complete = true;
+	if (!isJobChunk(data, size))
+		return jobKey(data, size);
+	JobChunkHeader header;
+	if (size < sizeof(header))
+		return 0;
+	std::memcpy(&header, data, sizeof(header));
+	complete = (header.flags & CHUNK_FLAG_LAST) != 0;
+	return header.key;
+}
+
+// receives the pieces of one streamed job in the order of the job, the pointers are only
+// valid during the call
+class JobStreamConsumer
+{
+public:
+	virtual ~JobStreamConsumer() {}
+	// the next count points, first is the index of the first of them within the job
+	virtual void points(const Point3d* points, std::size_t first, std::size_t count) = 0;
+	// the next count values of the double array
+	virtual void doubles(const double* values, std::size_t first, std::size_t count) = 0;
+	// the last chunk arrived, not called for a stream that was given up
+	virtual void end() = 0;
+};
+
+// makes the consumer of a stream when its first chunk arrives
+typedef std::function<std::unique_ptr<JobStreamConsumer>(const JobHeader& header)> JobStreamFactory;
+
+// JobStreamReader follows the streams sent to one receiver. Per stream it holds the header,
+// the bytes of a value split between two chunks and, for JOB_FLAG_SOA jobs, the x and y lanes
+// until the z lane arrives, interleaved points are handed out right from the chunk. What the
+// open streams hold never exceeds the memory ceiling: a new stream first gives up the streams
+// that were idle the longest, a stream that would exceed the ceiling on its own is rejected.
+// Encoded jobs cannot be decoded piece by piece and are rejected as well.
+class JobStreamReader
+{
+public:
+	enum Result
+	{
+		// the chunk was handed to the consumer of its stream
+		Consumed,
+		// the chunk completed its stream
+		Completed,
+		// the chunk belongs to no stream, it was rejected or its start went elsewhere
+		Dropped
+	};
+
+private:
+	enum Region
+	{
+		Points,
+		LaneX,
+		LaneY,
+		LaneZ,
+		Doubles,
+		REGIONS
+	};
+
+	// bytes begin ... end of the job hold values of the region, everything else is header or padding
+	struct Span
+	{
+		uint64_t begin;
+		uint64_t end;
+		Region region;
+	};
+
+	struct Stream
+	{
+		JobHeader header;
+		uint64_t total;
+		// offset the next chunk must start at
+		uint64_t next;
+		std::vector<Span> spans;
+		// a value split between two chunks, and the region it belongs to
+		alignas(double) unsigned char carry[sizeof(Point3d)];
+		std::size_t carryBytes;
+		Region carryRegion;
+		// values of every region handed out so far
+		std::size_t done[REGIONS];
+		// x lane followed by the y lane, JOB_FLAG_SOA only
+		std::vector<double> lanes;
+		std::unique_ptr<JobStreamConsumer> consumer;
+		uint64_t lastActive;
+		// bytes counted against the ceiling
+		std::size_t footprint;
+	};
+
+	JobStreamFactory _factory;
+	const std::size_t _ceiling;
+	std::size_t _held;
+	uint64_t _tick;
+	std::map<uint64_t, Stream> _streams;
+	// points put together from the lanes, or values copied out of an unaligned chunk
+	std::vector<Point3d> _points;
+	std::vector<double> _values;
+	uint64_t _completed;
+	uint64_t _givenUp;
+	uint64_t _rejected;
+
+	static bool aligned(const void* data)
+	{
+		return reinterpret_cast<std::uintptr_t>(data) % alignof(double) == 0;
+	}
+
+	void giveUp(std::map<uint64_t, Stream>::iterator it)
+	{
+		_held -= it->second.footprint;
+		_streams.erase(it);
+		++_givenUp;
+	}
+
+	// the job header of the first chunk, validated like JobView does for a whole job
+	static JobHeader readHeader(const unsigned char* data, std::size_t length, uint64_t total)
+	{
+		JobHeader header;
+		if (length < JOB_HEADER_MIN_SIZE || !isSingleFrameJob(data, length))
+			throw Poco::DataFormatException("stream", "first chunk does not hold a job header");
+		std::memcpy(&header, data, std::min(length, sizeof(JobHeader)));
+		if (header.version == 0 || header.version > JOB_FORMAT_VERSION)
+			throw Poco::DataFormatException("job header", "unsupported version " + std::to_string(header.version));
+		if (header.headerSize < JOB_HEADER_MIN_SIZE || header.headerSize > length)
+			throw Poco::DataFormatException("job header", "invalid header size " + std::to_string(header.headerSize));
+		if (header.headerSize < sizeof(JobHeader))
+			std::memset(reinterpret_cast<unsigned char*>(&header) + header.headerSize, 0, sizeof(JobHeader) - header.headerSize);
+		if (header.flags & ~JOB_FLAGS_SUPPORTED)
+			throw Poco::DataFormatException("job header", "unsupported flags " + std::to_string(header.flags));
+		if (header.flags & JOB_FLAG_ENCODED)
+			throw Poco::DataFormatException("stream", "encoded jobs cannot be streamed");
+		if (header.points.length != jobPointsLength(header.pointCount, header.flags) || header.doubles.length % sizeof(double) != 0)
+			throw Poco::DataFormatException("stream", "section lengths do not match the header");
+		if (header.points.offset > total || header.points.length > total - header.points.offset
+			|| header.doubles.offset > total || header.doubles.length > total - header.doubles.offset)
+			throw Poco::DataFormatException("stream", "section exceeds the job of " + std::to_string(total) + " bytes");
+		// the lanes lie within the points section, a byte of the job belongs to one region at most
+		if (header.points.offset < header.doubles.offset + header.doubles.length
+			&& header.doubles.offset < header.points.offset + header.points.length)
+			throw Poco::DataFormatException("stream", "points and doubles sections overlap");
+		return header;
+	}
+
+	std::map<uint64_t, Stream>::iterator open(const JobChunkHeader& chunk, const unsigned char* data, std::size_t length)
+	{
+		JobHeader header = readHeader(data, length, chunk.total);
+		bool soa = (header.flags & JOB_FLAG_SOA) != 0;
+		std::size_t footprint = sizeof(Stream) + (soa ? 2 * sizeof(double) * header.pointCount : 0);
+		if (footprint > _ceiling)
+		{
+			++_rejected;
+			return _streams.end();
+		}
+		while (_held + footprint > _ceiling && !_streams.empty())
+		{
+			auto idle = std::min_element(_streams.begin(), _streams.end(),
+				[](const std::pair<const uint64_t, Stream>& a, const std::pair<const uint64_t, Stream>& b) { return a.second.lastActive < b.second.lastActive; });
+			giveUp(idle);
+		}
+
+		Stream& stream = _streams[chunk.stream];
+		stream.header = header;
+		stream.total = chunk.total;
+		stream.next = 0;
+		stream.carryBytes = 0;
+		stream.carryRegion = Points;
+		std::fill(stream.done, stream.done + REGIONS, 0);
+		if (soa)
+		{
+			uint64_t stride = jobLaneStride(header.pointCount);
+			uint64_t lane = sizeof(double) * header.pointCount;
+			stream.spans.push_back(Span{ header.points.offset, header.points.offset + lane, LaneX });
+			stream.spans.push_back(Span{ header.points.offset + stride, header.points.offset + stride + lane, LaneY });
+			stream.spans.push_back(Span{ header.points.offset + 2 * stride, header.points.offset + 2 * stride + lane, LaneZ });
+			stream.lanes.resize(2 * (std::size_t)header.pointCount);
+		}
+		else
+			stream.spans.push_back(Span{ header.points.offset, header.points.offset + header.points.length, Points });
+		stream.spans.push_back(Span{ header.doubles.offset, header.doubles.offset + header.doubles.length, Doubles });
+		// a chunk is consumed in the order of its bytes, the regions before the later ones
+		std::sort(stream.spans.begin(), stream.spans.end(), [](const Span& a, const Span& b) { return a.begin < b.begin; });
+		stream.footprint = footprint;
+		_held += footprint;
+		try
+		{
+			stream.consumer = _factory(header);
+		}
+		catch (...)
+		{
+			_held -= footprint;
+			_streams.erase(chunk.stream);
+			throw;
+		}
+		return _streams.find(chunk.stream);
+	}
+
+	// hand count whole values of the region to the consumer
+	void emit(Stream& stream, Region region, const unsigned char* data, std::size_t count)
+	{
+		std::size_t first = stream.done[region];
+		stream.done[region] += count;
+		std::size_t numOfPoints = stream.header.pointCount;
+		switch (region)
+		{
+		case Points:
+			if (aligned(data))
+				stream.consumer->points(reinterpret_cast<const Point3d*>(data), first, count);
+			else
+			{
+				_points.resize(count);
+				std::memcpy(_points.data(), data, count * sizeof(Point3d));
+				stream.consumer->points(_points.data(), first, count);
+			}
+			break;
+		case LaneX:
+		case LaneY:
+			std::memcpy(&stream.lanes[(region == LaneY ? numOfPoints : 0) + first], data, count * sizeof(double));
+			break;
+		case LaneZ:
+			// the z lane comes last, every z value completes a point
+			_points.resize(count);
+			for (std::size_t i = 0; i < count; ++i)
+			{
+				_points[i].x = stream.lanes[first + i];
+				_points[i].y = stream.lanes[numOfPoints + first + i];
+				std::memcpy(&_points[i].z, data + i * sizeof(double), sizeof(double));
+			}
+			stream.consumer->points(_points.data(), first, count);
+			break;
+		case Doubles:
+			if (aligned(data))
+				stream.consumer->doubles(reinterpret_cast<const double*>(data), first, count);
+			else
+			{
+				_values.resize(count);
+				std::memcpy(_values.data(), data, count * sizeof(double));
+				stream.consumer->doubles(_values.data(), first, count);
+			}
+			break;
+		default:
+			break;
+		}
+	}
+
+	// split the bytes of one region into whole values, a value cut off by the chunk end waits in carry
+	void consume(Stream& stream, Region region, const unsigned char* data, std::size_t length)
+	{
+		std::size_t width = (region == Points) ? sizeof(Point3d) : sizeof(double);
+		// every region holds whole values, the carry of one is complete before the next region starts
+		if (stream.carryBytes > 0 && stream.carryRegion != region)
+			throw Poco::DataFormatException("stream", "value split across sections");
+		if (stream.carryBytes > 0)
+		{
+			std::size_t n = std::min(length, width - stream.carryBytes);
+			std::memcpy(stream.carry + stream.carryBytes, data, n);
+			stream.carryBytes += n;
+			data += n;
+			length -= n;
+			if (stream.carryBytes < width)
+				return;
+			stream.carryBytes = 0;
+			emit(stream, region, stream.carry, 1);
+		}
+		std::size_t count = length / width;
+		if (count > 0)
+			emit(stream, region, data, count);
+		stream.carryBytes = length - count * width;
+		stream.carryRegion = region;
+		std::memcpy(stream.carry, data + count * width, stream.carryBytes);
+	}
+
+public:
+	// ceiling is the number of bytes all open streams may hold together
+	JobStreamReader(const JobStreamFactory& factory, std::size_t ceiling)
+		: _factory(factory)
+		, _ceiling(ceiling)
+		, _held(0)
+		, _tick(0)
+		, _completed(0)
+		, _givenUp(0)
+		, _rejected(0)
+	{
+	}
+
+	JobStreamReader(const JobStreamReader&) = delete;
+	JobStreamReader& operator=(const JobStreamReader&) = delete;
+
+	// streams open, and the bytes they hold
+	std::size_t open() const { return _streams.size(); }
+	std::size_t held() const { return _held; }
+	uint64_t completed() const { return _completed; }
+	// streams dropped before their last chunk, to make room or after a missing chunk
+	uint64_t givenUp() const { return _givenUp; }
+	// streams that would exceed the ceiling on their own
+	uint64_t rejected() const { return _rejected; }
+
+	Result receive(const zmq::message_t& frame)
+	{
+		JobChunkHeader chunk = readChunkHeader(frame);
+		const unsigned char* data = static_cast<const unsigned char*>(frame.data()) + chunk.headerSize;
+		std::size_t length = frame.size() - chunk.headerSize;
+		++_tick;
+
+		auto it = _streams.find(chunk.stream);
+		if (chunk.offset == 0)
+		{
+			// a sender that restarted numbers its streams from 1 again
+			if (it != _streams.end())
+				giveUp(it);
+			it = open(chunk, data, length);
+			if (it == _streams.end())
+				return Dropped;
+		}
+		else if (it == _streams.end())
+			return Dropped;
+
+		Stream& stream = it->second;
+		if (chunk.offset != stream.next || chunk.total != stream.total)
+		{
+			// a chunk went missing, the rest of the stream is of no use
+			giveUp(it);
+			return Dropped;
+		}
+
+		try
+		{
+			uint64_t end = chunk.offset + length;
+			for (const Span& span : stream.spans)
+			{
+				uint64_t begin = std::max(chunk.offset, span.begin);
+				uint64_t until = std::min(end, span.end);
+				if (begin < until)
+					consume(stream, span.region, data + (begin - chunk.offset), (std::size_t)(until - begin));
+			}
+			stream.next = end;
+			stream.lastActive = _tick;
+			if (!(chunk.flags & CHUNK_FLAG_LAST))
+				return Consumed;
+			stream.consumer->end();
+		}
+		catch (...)
+		{
+			giveUp(it);
+			throw;
+		}
+		_held -= stream.footprint;
+		_streams.erase(it);
+		++_completed;
+		return Completed;
+	}
+};
@@ -0,0 +1,12 @@
+#pragma once
+
+// element type of the point cloud carried by a job, shared by pusher and puller
+struct Point3d
+{
+	double x;
+	double y;
+	double z;
+};
+
+// the wire layout is the raw memory of the array, it must not contain any padding
+static_assert(sizeof(Point3d) == 3 * sizeof(double), "Point3d must be tightly packed");
@@ -0,0 +1,372 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <Poco/Exception.h>
+#include <zmq_addon.hpp>
+#include "JobTypes.h"
+#include "JobFormat.hpp"
+#include "JobCodec.hpp"
+#include "JobHandoff.hpp"
+
+// an encoded job must not decode to more than this, whatever its header claims
+constexpr std::size_t JOB_DECODED_MAX = (std::size_t)1 << 30;
+
+// read-only view of a typed array that lives in a received frame
+template <typename T>
+class FrameView
+{
+private:
+	const T* _data;
+	std::size_t _size;
+
+public:
+	FrameView() : _data(nullptr), _size(0) {}
+	FrameView(const T* data, std::size_t size) : _data(data), _size(size) {}
+
+	const T* data() const { return _data; }
+	std::size_t size() const { return _size; }
+	bool empty() const { return _size == 0; }
+	const T* begin() const { return _data; }
+	const T* end() const { return _data + _size; }
+	const T& operator[](std::size_t i) const { return _data[i]; }
+
+	// bounds-checked element access
+	const T& at(std::size_t i) const
+	{
+		if (i >= _size)
+			throw Poco::RangeException("FrameView", "index " + std::to_string(i) + " out of " + std::to_string(_size));
+		return _data[i];
+	}
+};
+
+// map received bytes onto an array of count elements without copying, the bytes are
+// rejected if their size or alignment does not fit; JobView copies a frame received
+// at a misaligned address before it looks at it, so this only rejects a bad offset
+template <typename T>
+FrameView<T> viewMemory(const void* data, std::size_t bytes, std::size_t count, const std::string& what)
+{
+	static_assert(std::is_trivially_copyable<T>::value, "frame element must be trivially copyable");
+	if (bytes != count * sizeof(T))
+		throw Poco::DataFormatException(what, "frame has " + std::to_string(bytes)
+			+ " bytes, expected " + std::to_string(count * sizeof(T)));
+	if (count == 0)
+		return FrameView<T>();
+	if (reinterpret_cast<std::uintptr_t>(data) % alignof(T) != 0)
+		throw Poco::DataFormatException(what, "data is not aligned to " + std::to_string(alignof(T)) + " bytes");
+	return FrameView<T>(static_cast<const T*>(data), count);
+}
+
+// map a section of a single-frame job of size bytes at data, the section must lie within the frame
+template <typename T>
+FrameView<T> viewSection(const void* data, std::size_t size, const JobSection& section, std::size_t count, const std::string& what)
+{
+	if (section.offset > size || section.length > size - section.offset)
+		throw Poco::DataFormatException(what, "section exceeds the frame of " + std::to_string(size) + " bytes");
+	return viewMemory<T>(static_cast<const unsigned char*>(data) + section.offset, (std::size_t)section.length, count, what);
+}
+
+// read a scalar frame, scalars are small enough to be copied out regardless of alignment
+template <typename T>
+T readScalar(const zmq::message_t& frame, const std::string& what)
+{
+	static_assert(std::is_trivially_copyable<T>::value, "scalar must be trivially copyable");
+	if (frame.size() != sizeof(T))
+		throw Poco::DataFormatException(what, "frame has " + std::to_string(frame.size())
+			+ " bytes, expected " + std::to_string(sizeof(T)));
+	T value;
+	std::memcpy(&value, frame.data(), sizeof(T));
+	return value;
+}
+
+// PointsView presents interleaved Point3d and separate x, y, z lanes through one interface,
+// consumers that prefer one layout can ask for interleaved() or lanes directly
+class PointsView
+{
+private:
+	const double* _x;
+	const double* _y;
+	const double* _z;
+	// distance between two points of a lane, in doubles
+	std::size_t _step;
+	std::size_t _size;
+
+public:
+	class const_iterator
+	{
+	private:
+		const PointsView* _view;
+		std::size_t _index;
+
+	public:
+		const_iterator(const PointsView* view, std::size_t index) : _view(view), _index(index) {}
+		Point3d operator*() const { return (*_view)[_index]; }
+		const_iterator& operator++() { ++_index; return *this; }
+		bool operator==(const const_iterator& other) const { return _index == other._index; }
+		bool operator!=(const const_iterator& other) const { return _index != other._index; }
+	};
+
+	PointsView() : _x(nullptr), _y(nullptr), _z(nullptr), _step(1), _size(0) {}
+
+	// interleaved Point3d array
+	explicit PointsView(const FrameView<Point3d>& points)
+		: _x(points.empty() ? nullptr : &points.data()->x)
+		, _y(points.empty() ? nullptr : &points.data()->y)
+		, _z(points.empty() ? nullptr : &points.data()->z)
+		, _step(3)
+		, _size(points.size())
+	{
+	}
+
+	// separate x, y and z lanes
+	PointsView(const double* x, const double* y, const double* z, std::size_t size)
+		: _x(x), _y(y), _z(z), _step(1), _size(size)
+	{
+	}
+
+	std::size_t size() const { return _size; }
+	bool empty() const { return _size == 0; }
+	bool interleaved() const { return _step == 3; }
+
+	// the Point3d array if the points are interleaved, null otherwise
+	const Point3d* data() const { return interleaved() ? reinterpret_cast<const Point3d*>(_x) : nullptr; }
+	// the lanes if the points are not interleaved, null otherwise
+	const double* xs() const { return interleaved() ? nullptr : _x; }
+	const double* ys() const { return interleaved() ? nullptr : _y; }
+	const double* zs() const { return interleaved() ? nullptr : _z; }
+
+	double x(std::size_t i) const { return _x[i * _step]; }
+	double y(std::size_t i) const { return _y[i * _step]; }
+	double z(std::size_t i) const { return _z[i * _step]; }
+	Point3d operator[](std::size_t i) const { return Point3d{ x(i), y(i), z(i) }; }
+
+	// bounds-checked element access
+	Point3d at(std::size_t i) const
+	{
+		if (i >= _size)
+			throw Poco::RangeException("PointsView", "index " + std::to_string(i) + " out of " + std::to_string(_size));
+		return (*this)[i];
+	}
+
+	const_iterator begin() const { return const_iterator(this, 0); }
+	const_iterator end() const { return const_iterator(this, _size); }
+};
+
+// JobView takes over the received frames of a job and decodes them in place.
+// The single-frame, the handoff and the legacy multipart format are detected,
+// points() hides whether the points arrived interleaved or as lanes. A handed over
+// object is a pointer into the memory of the process, it is only recognised if the
+// caller says the frames came over an inproc socket from a pusher of this process.
+// Views returned by points() and doubles() refer to the wire buffer, or to the decoded
+// copy of an encoded job, or to an aligned copy of a frame received at a misaligned
+// address, or to the handed over object, and stay valid as long as the JobView lives, hence it can be
+// neither copied nor moved.
+class JobView
+{
+private:
+	zmq::multipart_t _frames;
+	JobFormat _format;
+	// the multipart format has no header, all fields beyond the payload stay zero
+	JobHeader _header;
+	PointsView _points;
+	FrameView<double> _doubles;
+	// decoded sections of an encoded job, or aligned copies of misaligned frames
+	std::vector<double> _decoded;
+	std::vector<double>* _scratch;
+	// doubles of the scratch buffer taken by aligned copies, 0 if the frames are used in place
+	std::size_t _copied;
+	double _scalar;
+
+	static bool aligned(const void* data)
+	{
+		return reinterpret_cast<std::uintptr_t>(data) % alignof(double) == 0;
+	}
+
+	// make room for aligned copies of up to bytes in total, the scratch buffer is not resized
+	// again while views point into it
+	void reserveCopies(std::size_t bytes)
+	{
+		std::size_t words = (bytes + sizeof(double) - 1) / sizeof(double);
+		if (_scratch->size() < words)
+			_scratch->resize(words);
+		_copied = 0;
+	}
+
+	// zero-copy receives over TCP often hand out frames at any address, the bytes of such
+	// a frame are copied to the scratch buffer, those of an aligned one are used in place
+	const void* alignedCopy(const void* data, std::size_t bytes)
+	{
+		if (aligned(data) || bytes == 0)
+			return data;
+		double* copy = _scratch->data() + _copied;
+		std::memcpy(copy, data, bytes);
+		_copied += (bytes + sizeof(double) - 1) / sizeof(double);
+		return copy;
+	}
+
+	void decodeSingleFrame(const zmq::message_t& frame)
+	{
+		// fields the sender did not know about stay zero
+		std::memcpy(&_header, frame.data(), std::min(frame.size(), sizeof(JobHeader)));
+		if (_header.version == 0 || _header.version > JOB_FORMAT_VERSION)
+			throw Poco::DataFormatException("job header", "unsupported version " + std::to_string(_header.version));
+		if (_header.headerSize < JOB_HEADER_MIN_SIZE || _header.headerSize > frame.size())
+			throw Poco::DataFormatException("job header", "invalid header size " + std::to_string(_header.headerSize));
+		if (_header.headerSize < sizeof(JobHeader))
+			std::memset(reinterpret_cast<unsigned char*>(&_header) + _header.headerSize, 0, sizeof(JobHeader) - _header.headerSize);
+
+		if (_header.flags & ~JOB_FLAGS_SUPPORTED)
+			throw Poco::DataFormatException("job header", "unsupported flags " + std::to_string(_header.flags));
+
+		if (_header.flags & JOB_FLAG_ENCODED)
+		{
+			decodeSections(frame);
+			_scalar = _header.scalar;
+			return;
+		}
+
+		// the sections sit at aligned offsets, a copy of the whole frame keeps them there
+		const void* data = frame.data();
+		if (!aligned(data))
+		{
+			reserveCopies(frame.size());
+			data = alignedCopy(data, frame.size());
+		}
+		if (_header.flags & JOB_FLAG_SOA)
+		{
+			// three lanes, each padded to the job alignment
+			std::size_t stride = jobLaneStride(_header.pointCount) / sizeof(double);
+			FrameView<double> lanes = viewSection<double>(data, frame.size(), _header.points, 3 * stride, "Point3d lanes");
+			_points = PointsView(lanes.data(), lanes.data() + stride, lanes.data() + 2 * stride, _header.pointCount);
+		}
+		else
+		{
+			_points = PointsView(viewSection<Point3d>(data, frame.size(), _header.points, _header.pointCount, "Point3d section"));
+		}
+		_doubles = viewSection<double>(data, frame.size(), _header.doubles, (std::size_t)(_header.doubles.length / sizeof(double)), "double section");
+		_scalar = _header.scalar;
+	}
+
+	// encoded sections cannot be used in place, they are decoded into the scratch buffer
+	// in the same layout a plain job has on the wire
+	void decodeSections(const zmq::message_t& frame)
+	{
+		std::size_t numOfPoints = _header.pointCount;
+		std::size_t pointsLength = jobPointsLength(numOfPoints, _header.flags);
+		std::size_t doublesOffset = alignJob(pointsLength);
+		std::size_t decodedSize = doublesOffset + sizeof(double) * _header.doubleCount;
+		if (decodedSize > JOB_DECODED_MAX)
+			throw Poco::DataFormatException("encoded job", "decodes to " + std::to_string(decodedSize) + " bytes");
+
+		_scratch->resize(decodedSize / sizeof(double));
+		double* base = _scratch->data();
+		FrameView<unsigned char> points = viewSection<unsigned char>(frame.data(), frame.size(), _header.points, (std::size_t)_header.points.length, "encoded Point3d section");
+		FrameView<unsigned char> doubles = viewSection<unsigned char>(frame.data(), frame.size(), _header.doubles, (std::size_t)_header.doubles.length, "encoded double section");
+
+		DoubleStream streams[3];
+		pointStreams(base, numOfPoints, _header.flags, streams);
+		decodeStreams((JobCodec)_header.codec, points.data(), points.size(), streams, 3);
+		DoubleStream values = { base + doublesOffset / sizeof(double), _header.doubleCount, 1 };
+		decodeStreams((JobCodec)_header.codec, doubles.data(), doubles.size(), &values, 1);
+
+		if (_header.flags & JOB_FLAG_SOA)
+			_points = PointsView(streams[0].data, streams[1].data, streams[2].data, numOfPoints);
+		else
+			_points = PointsView(FrameView<Point3d>(reinterpret_cast<const Point3d*>(base), numOfPoints));
+		_doubles = FrameView<double>(values.data, values.count);
+	}
+
+	// the arrays of a handed over object are used where the sender filled them
+	void viewObject(const JobObject& object)
+	{
+		_header = object.header;
+		if (object.points.size() != _header.pointCount)
+			throw Poco::DataFormatException("handed over job", "holds " + std::to_string(object.points.size())
+				+ " points, expected " + std::to_string(_header.pointCount));
+		_points = PointsView(FrameView<Point3d>(object.points.data(), object.points.size()));
+		_doubles = FrameView<double>(object.doubles.data(), object.doubles.size());
+		_header.doubleCount = (uint32_t)object.doubles.size();
+		_scalar = _header.scalar;
+	}
+
+	void decodeMultipart()
+	{
+		// 1st frame is an integer to indicate the number of point
+		int numOfPoints = readScalar<int>(*_frames.peek(0), "number of points");
+		if (numOfPoints < 0)
+			throw Poco::DataFormatException("number of points", std::to_string(numOfPoints));
+		const zmq::message_t& points = *_frames.peek(1);
+		const zmq::message_t& doubles = *_frames.peek(3);
+		// each copy starts on a double, the first one rounded up takes at most a double more
+		reserveCopies((aligned(points.data()) ? 0 : points.size() + sizeof(double)) + (aligned(doubles.data()) ? 0 : doubles.size()));
+		// 2nd frame is 3D points array
+		_points = PointsView(viewMemory<Point3d>(alignedCopy(points.data(), points.size()), points.size(), (std::size_t)numOfPoints, "Point3d array"));
+		// 3rd frame is the size of double array
+		uint32_t sizeOfDoubleArray = readScalar<uint32_t>(*_frames.peek(2), "size of double array");
+		// 4th frame is double array
+		_doubles = viewMemory<double>(alignedCopy(doubles.data(), doubles.size()), doubles.size(), sizeOfDoubleArray, "double array");
+		// 5th frame is a double scalar
+		_scalar = readScalar<double>(*_frames.peek(4), "double scalar");
+		_header.pointCount = (uint32_t)numOfPoints;
+		_header.scalar = _scalar;
+	}
+
+public:
+	// encoded jobs are decoded into scratch, which a worker can keep across jobs to avoid
+	// reallocation, without it the view decodes into a buffer of its own; handoff accepts
+	// handed over objects, never set it for frames that may have come over the network
+	explicit JobView(zmq::multipart_t&& frames, std::vector<double>* scratch = nullptr, bool handoff = false)
+		: _frames(std::move(frames))
+		, _format(JobFormat::Multipart)
+		, _scratch(scratch ? scratch : &_decoded)
+		, _copied(0)
+		, _scalar(0.0)
+	{
+		std::memset(&_header, 0, sizeof(_header));
+		if (handoff && _frames.size() == 1 && isJobObject(_frames.peek(0)->data(), _frames.peek(0)->size()))
+		{
+			_format = JobFormat::Handoff;
+			viewObject(jobObject(*_frames.peek(0)));
+		}
+		else if (_frames.size() == 1 && isSingleFrameJob(_frames.peek(0)->data(), _frames.peek(0)->size()))
+		{
+			_format = JobFormat::SingleFrame;
+			decodeSingleFrame(*_frames.peek(0));
+		}
+		else if (_frames.size() == 5)
+		{
+			decodeMultipart();
+		}
+		else
+		{
+			throw Poco::DataFormatException("job", "expected 1 or 5 frames, got " + std::to_string(_frames.size()));
+		}
+	}
+
+	JobView(const JobView&) = delete;
+	JobView& operator=(const JobView&) = delete;
+
+	JobFormat format() const { return _format; }
+	const JobHeader& header() const { return _header; }
+	const PointsView& points() const { return _points; }
+	const FrameView<double>& doubles() const { return _doubles; }
+	double scalar() const { return _scalar; }
+	// true if a frame arrived at a misaligned address and the job is read from an aligned copy
+	bool copied() const { return _copied > 0; }
+
+	// total payload size of the job as received, the arrays of a handed over job
+	std::size_t bytes() const
+	{
+		if (_format == JobFormat::Handoff)
+			return sizeof(Point3d) * _points.size() + sizeof(double) * _doubles.size();
+		std::size_t total = 0;
+		for (std::size_t i = 0; i < _frames.size(); ++i)
+			total += _frames.peek(i)->size();
+		return total;
+	}
+};
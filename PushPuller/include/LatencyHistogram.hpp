@@ -0,0 +1,177 @@
+#pragma once
+#include <atomic>
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// LatencyHistogram counts nanosecond latencies HDR-style: a value falls into its power of
+// two and one of LATENCY_SUB_BUCKETS linear steps within it, so every bucket is narrower
+// than 1 / LATENCY_SUB_BUCKETS of its values over the whole range, at a fixed size and
+// without any allocation when recording. Values below LATENCY_SUB_BUCKETS are exact,
+// values beyond 2^LATENCY_MAX_BITS ns (about 18 minutes) land in the last bucket.
+//
+// One thread records, recording is a few relaxed loads and stores without any locked
+// instruction. Any thread may take a snapshot at any time, a snapshot taken while a
+// value is recorded may count it in the bucket but not yet in the total, or the other
+// way round, which the reporter can live with.
+
+constexpr unsigned LATENCY_SUB_BITS = 5;
+constexpr unsigned LATENCY_SUB_BUCKETS = 1u << LATENCY_SUB_BITS;
+constexpr unsigned LATENCY_MAX_BITS = 40;
+constexpr std::size_t LATENCY_BUCKETS = (LATENCY_MAX_BITS - LATENCY_SUB_BITS + 1) * LATENCY_SUB_BUCKETS;
+
+// index of the most significant bit of a value that is not 0
+inline unsigned latencyMsb(uint64_t value)
+{
+#if defined(_MSC_VER)
+	unsigned long index;
+	_BitScanReverse64(&index, value);
+	return (unsigned)index;
+#else
+	return 63u - (unsigned)__builtin_clzll(value);
+#endif
+}
+
+inline std::size_t latencyBucket(uint64_t value)
+{
+	if (value < LATENCY_SUB_BUCKETS)
+		return (std::size_t)value;
+	unsigned msb = latencyMsb(value);
+	if (msb >= LATENCY_MAX_BITS)
+		return LATENCY_BUCKETS - 1;
+	unsigned shift = msb - LATENCY_SUB_BITS;
+	return (std::size_t)(shift + 1) * LATENCY_SUB_BUCKETS + (std::size_t)((value >> shift) - LATENCY_SUB_BUCKETS);
+}
+
+// the largest value that falls into the bucket
+inline uint64_t latencyBucketValue(std::size_t bucket)
+{
+	std::size_t group = bucket / LATENCY_SUB_BUCKETS;
+	uint64_t step = bucket % LATENCY_SUB_BUCKETS;
+	if (group == 0)
+		return step;
+	unsigned shift = (unsigned)group - 1;
+	return ((LATENCY_SUB_BUCKETS + step + 1) << shift) - 1;
+}
+
+// the counts of a histogram at one point in time, or the difference of two such points
+struct LatencySnapshot
+{
+	std::vector<uint64_t> counts;
+	uint64_t count;
+	uint64_t sum;
+
+	LatencySnapshot()
+		: counts(LATENCY_BUCKETS, 0)
+		, count(0)
+		, sum(0)
+	{
+	}
+
+	// what was recorded since the earlier snapshot
+	LatencySnapshot since(const LatencySnapshot& earlier) const
+	{
+		LatencySnapshot delta;
+		for (std::size_t i = 0; i < LATENCY_BUCKETS; ++i)
+			delta.counts[i] = counts[i] - earlier.counts[i];
+		delta.count = count - earlier.count;
+		delta.sum = sum - earlier.sum;
+		return delta;
+	}
+
+	// nearest-rank percentile in nanoseconds, the upper end of the bucket it falls into
+	uint64_t percentile(double p) const
+	{
+		uint64_t total = 0;
+		for (uint64_t n : counts)
+			total += n;
+		if (total == 0)
+			return 0;
+		uint64_t rank = (uint64_t)(p / 100.0 * total + 0.5);
+		rank = rank < 1 ? 1 : (rank > total ? total : rank);
+		uint64_t seen = 0;
+		for (std::size_t i = 0; i < LATENCY_BUCKETS; ++i)
+		{
+			seen += counts[i];
+			if (seen >= rank)
+				return latencyBucketValue(i);
+		}
+		return latencyBucketValue(LATENCY_BUCKETS - 1);
+	}
+
+	// the upper end of the highest bucket that counted a value
+	uint64_t max() const
+	{
+		for (std::size_t i = LATENCY_BUCKETS; i-- > 0;)
+		{
+			if (counts[i] > 0)
+				return latencyBucketValue(i);
+		}
+		return 0;
+	}
+
+	double mean() const
+	{
+		return count ? (double)sum / count : 0.0;
+	}
+};
+
+class LatencyHistogram
+{
+private:
+	std::atomic<uint64_t> _counts[LATENCY_BUCKETS];
+	std::atomic<uint64_t> _count;
+	std::atomic<uint64_t> _sum;
+
+	// the recording thread is the only writer, a plain increment is enough to publish
+	static void increment(std::atomic<uint64_t>& counter, uint64_t n)
+	{
+		counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+	}
+
+public:
+	LatencyHistogram()
+		: _count(0)
+		, _sum(0)
+	{
+		for (auto& counter : _counts)
+			counter.store(0, std::memory_order_relaxed);
+	}
+
+	LatencyHistogram(const LatencyHistogram&) = delete;
+	LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+	void record(uint64_t nanoseconds)
+	{
+		increment(_counts[latencyBucket(nanoseconds)], 1);
+		increment(_count, 1);
+		increment(_sum, nanoseconds);
+	}
+
+	LatencySnapshot snapshot() const
+	{
+		LatencySnapshot result;
+		for (std::size_t i = 0; i < LATENCY_BUCKETS; ++i)
+			result.counts[i] = _counts[i].load(std::memory_order_relaxed);
+		result.count = _count.load(std::memory_order_relaxed);
+		result.sum = _sum.load(std::memory_order_relaxed);
+		return result;
+	}
+};
+
+// percentiles and maximum of a snapshot in microseconds, for the report lines
+inline std::string latencyText(const LatencySnapshot& latency)
+{
+	char text[128];
+	std::snprintf(text, sizeof(text), "p50 %.1f us, p99 %.1f us, p99.9 %.1f us, max %.1f us",
+		latency.percentile(50.0) / 1000.0,
+		latency.percentile(99.0) / 1000.0,
+		latency.percentile(99.9) / 1000.0,
+		latency.max() / 1000.0);
+	return text;
+}